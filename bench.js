@@ -0,0 +1,329 @@
+// @ts-check
+"use strict";
+
+/**
+ * Benchmark suite: measures calls/s, bytes/s and per call latency
+ * (mean, p50, p99) of transfer(), transferInto() and transferSync()
+ * across message sizes, messages per call and concurrency levels.
+ *
+ * No slave device is needed: the received data is not checked.
+ * With --backend=loopback no hardware is needed at all, the bus time
+ * is emulated from the clock speed, so results are reproducible and
+ * can be tracked between releases with --json.
+ *
+ * Run with:
+ * node bench.js
+ *
+ * Optional flags:
+ *
+ * --device, -d Set the device e.g --device=/dev/spidev0.1
+ * The default device is /dev/spidev0.0
+ *
+ * --backend, -B kernel (default) or loopback.
+ *
+ * --size, -n Bytes per message, a comma separated list. The default is 3.
+ *
+ * --batch, -m Messages per call, a comma separated list. The default is 1.
+ *
+ * --concurrency, -c Calls in flight, a comma separated list.
+ * The default is 1. (--burst, -b is an alias)
+ *
+ * --iterations, -i Number of calls per measurement. The default is 10_000.
+ *
+ * --speed, -s Set the maximum clock speed. The default is 1Mhz.
+ *
+ * --queue, -q How transfers are queued: threadpool (default),
+ * io_thread or coalesce.
+ *
+ * --json, -j Print the results as JSON.
+ */
+
+import SPIDevice from '@eeemarv/io-spi';
+import { readFileSync } from 'node:fs';
+
+const showHelp = () => {
+  console.log(`Usage: node bench.js [options]
+
+Benchmark suite: transfer(), transferInto() and transferSync()
+
+Options:
+  --device=<path>, -d=<path>         Set the SPI device path. Default is /dev/spidev0.0.
+  --backend=<name>, -B=<name>        kernel or loopback (no hardware needed). Default is kernel.
+  --size=<list>, -n=<list>           Bytes per message, e.g. 3,64,4096. Default is 3.
+  --batch=<list>, -m=<list>          Messages per call, e.g. 1,8. Default is 1.
+  --concurrency=<list>, -c=<list>    Calls in flight, e.g. 1,16,64. Default is 1.
+  --iterations=<number>, -i=<number> Calls per measurement. Default is 10_000.
+  --speed=<number>, -s=<number>      Set the maximum clock speed in Hz. Default is 1_000_000 (1MHz).
+  --queue=<name>, -q=<name>          threadpool, io_thread or coalesce. Default is threadpool.
+  --json, -j                         Print the results as JSON.
+  --help, -h                         Show this help message. `);
+};
+
+/**
+ * @param {string | undefined} value comma separated positive integers
+ * @param {string} name
+ */
+const parseList = (value, name) => {
+  const list = (value ?? '').split(',').map((v) => Number(v.replace(/_/g, '')));
+  if (list.some((v) => !Number.isInteger(v) || v < 1)) {
+    throw new Error(`Invalid ${name}`);
+  }
+  return list;
+};
+
+/**
+ * @param {number[]} samples sorted latencies in nanoseconds
+ * @param {number} p percentile 0-100
+ */
+const percentile = (samples, p) => {
+  const i = Math.min(samples.length - 1, Math.floor(samples.length * p / 100));
+  return samples[i];
+};
+
+/**
+ * @param {string} api
+ * @param {{ size: number, batch: number, concurrency: number }} point
+ * @param {number[]} samples latencies in nanoseconds
+ * @param {number} elapsed wall time of the measurement in nanoseconds
+ */
+const summarize = (api, point, samples, elapsed) => {
+  samples.sort((a, b) => a - b);
+  const total = samples.reduce((a, b) => a + b, 0);
+  const us = (/** @type {number} */ ns) => Math.round(ns / 100) / 10;
+  const calls = samples.length;
+  return {
+    api,
+    ...point,
+    calls,
+    callsPerSec: Math.round(calls * 1e9 / elapsed),
+    bytesPerSec: Math.round(calls * point.size * point.batch * 1e9 / elapsed),
+    meanUs: us(total / calls),
+    p50Us: us(percentile(samples, 50)),
+    p99Us: us(percentile(samples, 99))
+  };
+};
+
+/**
+ * Closed loop: `concurrency` callers, each starts a new call as soon
+ * as its previous one resolves, until `iterations` calls are done.
+ * @param {() => Promise<unknown>} call
+ * @param {number} iterations
+ * @param {number} concurrency
+ */
+const measureAsync = async (call, iterations, concurrency) => {
+  /** @type {number[]} */
+  const samples = [];
+  let started = 0;
+
+  const caller = async () => {
+    while (started < iterations) {
+      started++;
+      const start = process.hrtime.bigint();
+      await call();
+      samples.push(Number(process.hrtime.bigint() - start));
+    }
+  };
+
+  const start = process.hrtime.bigint();
+  await Promise.all(Array.from({ length: concurrency }, caller));
+  return { samples, elapsed: Number(process.hrtime.bigint() - start) };
+};
+
+/**
+ * @param {() => unknown} call
+ * @param {number} iterations
+ */
+const measureSync = (call, iterations) => {
+  /** @type {number[]} */
+  const samples = [];
+  const start = process.hrtime.bigint();
+  for (let i = 0; i < iterations; i++) {
+    const t = process.hrtime.bigint();
+    call();
+    samples.push(Number(process.hrtime.bigint() - t));
+  }
+  return { samples, elapsed: Number(process.hrtime.bigint() - start) };
+};
+
+(async () => {
+  let device = '/dev/spidev0.0';
+  let backend = 'kernel';
+  let sizes = [3];
+  let batches = [1];
+  let concurrencies = [1];
+  let iterations = 10_000;
+  let speed = 1_000_000;
+  let queue = 'threadpool';
+  let json = false;
+  let skipArg = false;
+
+  const args = process.argv.slice(2);
+
+  try {
+    args.forEach((arg, i) => {
+      let key = undefined;
+      let value = undefined;
+      if (skipArg) {
+        skipArg = false;
+        return;
+      }
+
+      if (arg == '--help' || arg === '-h') {
+        showHelp();
+        process.exit(0);
+      }
+
+      if (arg === '--json' || arg === '-j') {
+        json = true;
+        return;
+      }
+
+      if (arg.includes('=')) {
+        [key, value] = arg.split('=');
+      } else {
+        key = arg;
+        value = args[i + 1];
+        skipArg = true;
+      }
+
+      if (key === '--device' || key === '-d') {
+        if (!value) {
+          throw new Error('Missing value for --device');
+        }
+        device = value;
+        return;
+      }
+
+      if (key === '--backend' || key === '-B') {
+        if (!value || !['kernel', 'loopback'].includes(value)) {
+          throw new Error('Invalid backend. Use kernel or loopback.');
+        }
+        backend = value;
+        return;
+      }
+
+      if (key === '--size' || key === '-n') {
+        sizes = parseList(value, 'size');
+        return;
+      }
+
+      if (key === '--batch' || key === '-m') {
+        batches = parseList(value, 'batch');
+        return;
+      }
+
+      if (key === '--concurrency' || key === '-c' || key === '--burst' || key === '-b') {
+        concurrencies = parseList(value, 'concurrency');
+        return;
+      }
+
+      if (key === '--iterations' || key === '-i') {
+        iterations = Number(value?.replace(/_/g, ''));
+        if (!Number.isInteger(iterations) || iterations < 1) {
+          throw new Error('Invalid number of iterations');
+        }
+        return;
+      }
+
+      if (key === '--speed' || key === '-s') {
+        if (!value) {
+          throw new Error('Missing value for --speed');
+        }
+        speed = Number(value.replace(/_/g, ''));
+        return;
+      }
+
+      if (key === '--queue' || key === '-q') {
+        if (!value || !['threadpool', 'io_thread', 'coalesce'].includes(value)) {
+          throw new Error('Invalid queue. Use threadpool, io_thread or coalesce.');
+        }
+        queue = value;
+        return;
+      }
+
+      throw new Error(`Unknown argument: ${arg}`);
+    });
+
+  } catch (err) {
+    console.error('\x1b[1;31mError: \x1b[0m', err.message);
+    showHelp();
+    process.exit(1);
+  }
+
+  const spi = new SPIDevice(device, {
+    backend: /** @type {'kernel' | 'loopback'} */ (backend),
+    max_speed_hz: speed,
+    io_thread: queue !== 'threadpool',
+    coalesce: queue === 'coalesce'
+  });
+
+  if (!json) {
+    console.log(`SPI device: \x1b[1;33m${device}\x1b[0m (${backend})`);
+    console.log(`Queue: \x1b[1;33m${queue}\x1b[0m, \x1b[1;33m${iterations}\x1b[0m calls per measurement`);
+  }
+
+  const results = [];
+
+  /** @param {ReturnType<typeof summarize>} r */
+  const report = (r) => {
+    results.push(r);
+    if (json) {
+      return;
+    }
+    console.log(`\x1b[1;33m${r.api.padEnd(14)}\x1b[0m` +
+      ` size ${String(r.size).padStart(6)} batch ${String(r.batch).padStart(3)}` +
+      ` conc ${String(r.concurrency).padStart(4)}` +
+      ` calls/s ${String(r.callsPerSec).padStart(8)}` +
+      ` MB/s ${(r.bytesPerSec / 1e6).toFixed(2).padStart(8)}` +
+      ` mean ${r.meanUs.toFixed(1).padStart(8)} µs` +
+      ` p50 ${r.p50Us.toFixed(1).padStart(8)} µs` +
+      ` p99 ${r.p99Us.toFixed(1).padStart(8)} µs`);
+  };
+
+  for (const size of sizes) {
+    for (const batch of batches) {
+      const txs = Array.from({ length: batch }, () => Buffer.alloc(size, 0x5a));
+      const rxs = Array.from({ length: batch }, () => Buffer.alloc(size));
+      const msg = txs.map((tx, i) => ({ tx_buf: tx, rx_buf: rxs[i] }));
+
+      // Warm up
+      for (let i = 0; i < 100; i++) {
+        await spi.transfer(txs);
+        spi.transferSync(msg);
+      }
+
+      for (const concurrency of concurrencies) {
+        const point = { size, batch, concurrency };
+
+        let m = await measureAsync(() => spi.transfer(txs), iterations, concurrency);
+        report(summarize('transfer', point, m.samples, m.elapsed));
+
+        // Concurrent calls each need their own rx buffers
+        const rxSets = Array.from({ length: concurrency }, () =>
+          txs.map(() => Buffer.alloc(size)));
+        let next = 0;
+        m = await measureAsync(() => spi.transferInto(txs, rxSets[next++ % concurrency]),
+          iterations, concurrency);
+        report(summarize('transferInto', point, m.samples, m.elapsed));
+      }
+
+      const m = measureSync(() => spi.transferSync(msg), iterations);
+      report(summarize('transferSync', { size, batch, concurrency: 1 }, m.samples, m.elapsed));
+    }
+  }
+
+  if (json) {
+    const pkg = JSON.parse(readFileSync(new URL('./package.json', import.meta.url), 'utf8'));
+    console.log(JSON.stringify({
+      version: pkg.version,
+      node: process.version,
+      date: new Date().toISOString(),
+      device,
+      backend,
+      queue,
+      speed,
+      iterations,
+      results
+    }, null, 2));
+  }
+})();
@@ -5,13 +5,33 @@
       "src/spi_mode.cc",
       "src/spi_bits.cc",
       "src/spi_speed.cc",
+      "src/spi_config.cc",
       "src/spi_ioctl.cc",
+      "src/spi_backend.cc",
+      "src/spi_flash_backend.cc",
       "src/spi_validate_mode.cc",
       "src/spi_validate_bits.cc",
       "src/spi_validate_speed.cc",
       "src/spi_init.cc",
       "src/spi_device.cc",
-      "src/spi_transfer.cc"
+      "src/spi_detach.cc",
+      "src/spi_transfer.cc",
+      "src/spi_arena.cc",
+      "src/spi_poll.cc",
+      "src/spi_trace.cc",
+      "src/spi_pool.cc",
+      "src/spi_abort.cc",
+      "src/spi_io_thread.cc",
+      "src/spi_bus.cc",
+      "src/spi_flash.cc",
+      "src/spi_display.cc",
+      "src/spi_regmap.cc",
+      "src/spi_program.cc",
+      "src/spi_sampler.cc",
+      "src/spi_stats.cc",
+      "src/spi_codec.cc",
+      "src/spi_crc.cc",
+      "src/spi_pixel.cc"
     ],
     "include_dirs": [
       "<!@(node -p \"require('node-addon-api').include_dir\")",
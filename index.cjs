@@ -1,2 +1,6 @@
-const { SPIDevice } = require('./build/Release/spi.node');
+const { SPIDevice, SPIBus, SPIFlash, SPIDisplay, SPIRegmap } = require('./build/Release/spi.node');
 module.exports = SPIDevice;
+module.exports.SPIBus = SPIBus;
+module.exports.SPIFlash = SPIFlash;
+module.exports.SPIDisplay = SPIDisplay;
+module.exports.SPIRegmap = SPIRegmap;
@@ -2,11 +2,28 @@
 
 /**
  * Optional parameters for individual SPI transfers.
- * Mirrors the Linux `spi_ioc_transfer` structure (except `pad` and `rx_buf`).
+ * Mirrors the Linux `spi_ioc_transfer` structure (except `pad`).
  */
 export interface SPITransfer {
-  /** Transmit buffer (required) */
-  tx_buf: Buffer;
+  /**
+   * Transmit buffer. `null` (or omitted) for a receive only transfer,
+   * then zeros are clocked out.
+   */
+  tx_buf?: Buffer | null;
+
+  /**
+   * Receive buffer, at least as long as `tx_buf`.
+   * When omitted a new Buffer is allocated for the received data.
+   * `null` for a transmit only transfer.
+   */
+  rx_buf?: Buffer | NodeJS.TypedArray | null;
+
+  /**
+   * Number of bytes to receive when there is no `tx_buf`.
+   * Without `rx_buf` a Buffer of this length is allocated. An integer
+   * from 1 to 2^32 - 1, a RangeError is thrown otherwise.
+   */
+  rx_len?: number;
 
   /** Delay after transfer, in microseconds */
   delay_usecs?: number;
@@ -37,8 +54,379 @@ export interface SPITransfer {
    * Rarely supported outside some specialized hardware.
    */
   rx_nbits?: number;
+
+  /**
+   * Unpacks the received words into a typed array when the transfer
+   * completes. Without `tx_buf`, `rx_buf` and `rx_len` the transfer
+   * receives exactly the words of `into`.
+   */
+  decode?: SPIWordDecode;
+
+  /**
+   * Packs a typed array into the transmitted words just before the
+   * ioctl. Without `tx_buf` a tx buffer of the right size is allocated.
+   */
+  encode?: SPIWordEncode;
+
+  /**
+   * Appends a CRC to the tx data and / or verifies the CRC of the rx
+   * data, natively next to the ioctl. A mismatch rejects with `code`
+   * `'ERR_SPI_CRC_MISMATCH'`.
+   */
+  crc?: SPICrcOptions;
+}
+
+/**
+ * Layout of the words on the wire for `decode` and `encode`.
+ * A word is `bytes` bytes; the sample is `bits` wide and sits `shift`
+ * bits above the least significant bit of the word.
+ */
+export interface SPIWordFormat {
+  /** Sample width, 1-32. Defaults to `bytes * 8` */
+  bits?: number;
+
+  /**
+   * Bytes per word, 1-4. Defaults to the bytes needed for `bits`,
+   * or to the element size of the typed array.
+   */
+  bytes?: number;
+
+  /** Bits below the sample in the word. Defaults to 0 */
+  shift?: number;
+
+  /**
+   * Byte order of a word. Defaults to `'big'`, the order SPI shifts the
+   * bits with 8 bits per word. spidev stores words in CPU order
+   * (`'little'` on ARM and x86) when `bits_per_word` is 16 or 32.
+   */
+  endian?: 'big' | 'little';
+
+  /** Two's complement samples, sign extended. Defaults to true */
+  signed?: boolean;
+
+  /**
+   * Float32Array only: value = sample * scale when decoding,
+   * sample = round(value / scale), saturated, when encoding. Defaults to 1
+   */
+  scale?: number;
+}
+
+export interface SPIWordDecode extends SPIWordFormat {
+  /** Receives one sample per element */
+  into: Int16Array | Int32Array | Float32Array;
+}
+
+export interface SPIWordEncode extends SPIWordFormat {
+  /** One sample per element, truncated to `bits` */
+  from: Int16Array | Int32Array | Float32Array;
+}
+
+/**
+ * CRC algorithms of the `crc` transfer option. `crc7` is stored as SD
+ * cards expect it, `crc << 1 | 1`; reflected CRCs (`crc8-maxim`,
+ * `crc16-modbus`, `crc32`) little endian, the others big endian.
+ */
+export type SPICrcType = 'crc7' | 'crc8' | 'crc8-maxim' | 'crc8-sensirion' |
+  'crc16-ccitt' | 'crc16-xmodem' | 'crc16-modbus' | 'crc32';
+
+export interface SPICrcOptions {
+  type: SPICrcType;
+
+  /** Append the CRC to `tx_buf`. The message grows by the CRC bytes */
+  tx?: boolean;
+
+  /** Verify the CRC at the end of the received data */
+  rx?: boolean;
+
+  /** Received bytes before the checked data. Defaults to 0 */
+  skip?: number;
+
+  /** A CRC after every `chunk` data bytes instead of one after all. Defaults to 0 */
+  chunk?: number;
+}
+
+
+/**
+ * Memory of a transferArena() call. A SharedArrayBuffer is passed as a
+ * view on it, e.g. `new Uint8Array(sab)`.
+ */
+export type SPIArena = ArrayBuffer | NodeJS.TypedArray | DataView;
+
+/**
+ * Field indices of one message in the transferArena() descriptor table.
+ * Message `i` starts at `i * STRIDE`.
+ */
+export interface SPIArenaLayout {
+  /** Fields per message */
+  readonly STRIDE: number;
+  /** Offset value for no tx (rx only) or no rx (tx only) */
+  readonly NONE: number;
+  /** Byte offset into the tx arena, or `NONE` */
+  readonly TX_OFFSET: number;
+  /** Byte offset into the rx arena, or `NONE` */
+  readonly RX_OFFSET: number;
+  /** Bytes to transfer */
+  readonly LEN: number;
+  /** Clock speed in Hz, 0 for the device default */
+  readonly SPEED_HZ: number;
+  /** `delay_usecs | word_delay_usecs << 16` */
+  readonly DELAYS: number;
+  /** `bits_per_word | cs_change << 8 | tx_nbits << 16 | rx_nbits << 24` */
+  readonly FLAGS: number;
+}
+
+/**
+ * Bytes written into a tx buffer of a prepared program just before it runs.
+ */
+export interface SPITxPatch {
+  /** Index of the transfer in the prepared sequence. Defaults to 0 */
+  index?: number;
+
+  /**
+   * Byte offset into the transfer's `tx_buf`. Defaults to 0. With
+   * `crc.tx` the offset is into the framed message, CRC bytes included.
+   */
+  offset?: number;
+
+  /** Bytes to write */
+  data: Buffer;
+}
+
+/**
+ * Scheduling options of a queued transfer.
+ */
+export interface SPIQueueOptions {
+  /**
+   * `realtime` transfers run before all queued `bulk` transfers, and
+   * between the CS-released (`cs_change`) segments of a running bulk transfer.
+   * @default 'bulk'
+   */
+  priority?: 'realtime' | 'bulk';
+
+  /**
+   * Milliseconds from the call within which the transfer must start.
+   * When it can not start in time it is dropped without touching the bus
+   * and rejected with an error with `code: 'ERR_SPI_DEADLINE'`.
+   */
+  deadline?: number;
+
+  /**
+   * Withdraw the transfer while it is still queued: the Promise rejects
+   * at once with `signal.reason` and the transfer never reaches the bus.
+   * A transfer that already started completes normally.
+   */
+  signal?: AbortSignal;
+
+  /** Like `signal: AbortSignal.timeout(timeoutMs)`, rejects with a `TimeoutError` */
+  timeoutMs?: number;
+}
+
+/**
+ * Options for `SPIDevice.transferUntil()`.
+ */
+export interface SPIPollOptions extends SPIQueueOptions {
+  /** Bits of the rx byte to test. Defaults to 0xff */
+  mask?: number;
+
+  /** Value the masked byte must have. Defaults to 0 */
+  value?: number;
+
+  /** Index into the received bytes of all messages, negative from the end. Defaults to 0 */
+  byteIndex?: number;
+
+  /** Sleep between rounds in microseconds. Defaults to 0 */
+  intervalUs?: number;
+
+  /**
+   * Bound of the whole call in milliseconds, at most 2147483647, defaults
+   * to 1000. Once polling, rejects with `code` `'ERR_SPI_POLL_TIMEOUT'`
+   */
+  timeoutMs?: number;
+}
+
+/**
+ * Result of `SPIDevice.transferUntil()`.
+ */
+export interface SPIPollResult {
+  /** Received data of the matching round, as transfer() resolves it */
+  rx: (Buffer | NodeJS.TypedArray | null)[];
+
+  /** Rounds run, including the matching one */
+  iterations: number;
+}
+
+/**
+ * A transfer sequence validated once by `SPIDevice.prepare()`.
+ * Every run receives into the same rx buffers and resolves with the same array.
+ */
+export interface SPIProgram {
+  /**
+   * Queue the prepared transfers.
+   * @param patches Optional bytes to write into the tx buffers first
+   */
+  run(patches?: SPITxPatch[], options?: SPIQueueOptions): Promise<(Buffer | NodeJS.TypedArray | null)[]>;
+
+  /**
+   * Run the prepared transfers on the calling thread.
+   * @param patches Optional bytes to write into the tx buffers first
+   */
+  runSync(patches?: SPITxPatch[]): (Buffer | NodeJS.TypedArray | null)[];
+}
+
+/**
+ * Options for `SPIDevice.startSampling()`.
+ */
+export interface SPISamplingOptions {
+  /** Program to run for every sample, from `prepare()` on the same device */
+  program: SPIProgram;
+
+  /** Sampling interval in nanoseconds */
+  intervalNs: number | bigint;
+
+  /** Samples per delivered batch. Defaults to 1 */
+  batchSize?: number;
+
+  /** Batches in the native ring buffer, at least 2. Defaults to 4 */
+  ringBatches?: number;
+
+  /** CPU or CPUs to pin the sampling thread to */
+  cpu?: number | number[];
+
+  /** SCHED_FIFO priority (1-99) of the sampling thread. 0 keeps the default policy */
+  priority?: number;
+}
+
+/**
+ * Options for `SPIDevice.armOnEvent()`.
+ */
+export interface SPIEventOptions {
+  /** Runs per delivered batch. Defaults to 1 */
+  batchSize?: number;
+
+  /** Batches in the native ring buffer, at least 2. Defaults to 4 */
+  ringBatches?: number;
+
+  /** CPU or CPUs to pin the trigger thread to */
+  cpu?: number | number[];
+
+  /** SCHED_FIFO priority (1-99) of the trigger thread. 0 keeps the default policy */
+  priority?: number;
+}
+
+/**
+ * Options for `SPIDevice.startTrace()`.
+ */
+export interface SPITraceOptions {
+  /** Size of the ring in bytes, 64 KiB up to 1 GiB. Defaults to 4 MiB */
+  size?: number;
+
+  /** Captured tx and rx bytes per transfer, 0 to 65536. Defaults to 16 */
+  maxBytes?: number;
+}
+
+/**
+ * Usage of the `SPIDevice.allocBuffer()` pool, in bytes unless noted.
+ */
+export interface SPIPoolStats {
+  /** The `pool_size` option */
+  limit: number;
+
+  /** Memory mapped for the pool */
+  reserved: number;
+
+  /** Of which mlock() succeeded, see RLIMIT_MEMLOCK */
+  locked: number;
+
+  /** Blocks held by Buffers or pinned by transfers */
+  inUse: number;
+
+  /** Live pool Buffers */
+  buffers: number;
+
+  /** Blocks used by queued or running transfers and programs */
+  pinned: number;
+
+  /** allocBuffer() calls, and those served from recycled blocks */
+  allocations: number;
+  reuses: number;
+}
+
+/**
+ * Information delivered with each batch of samples.
+ */
+export interface SPISampleBatchInfo {
+  /** Batch sequence number, gaps mean dropped batches */
+  sequence: number;
+
+  /** Samples in the batch */
+  samples: number;
+
+  /** CLOCK_MONOTONIC time of the first and last sample in the batch */
+  firstNs: bigint;
+  lastNs: bigint;
+
+  /** Sampling deadlines missed since the start (cumulative) */
+  overruns: number;
+
+  /** Batches dropped because the ring was full (cumulative) */
+  dropped: number;
+
+  /** Failed transfers since the start (cumulative) */
+  errors: number;
+
+  /** Samples whose rx CRCs did not match, see `crc` (cumulative) */
+  crcErrors: number;
+}
+
+/**
+ * Latency histogram snapshot, all values in nanoseconds.
+ * Percentiles are accurate to within 12.5%.
+ */
+export interface SPILatencyStats {
+  count: number;
+  mean: number;
+  max: number;
+  p50: number;
+  p90: number;
+  p99: number;
+  p999: number;
 }
 
+/**
+ * Snapshot of the per device counters returned by `getStats()`.
+ */
+export interface SPIStats {
+  /** Transfer sequences executed. A coalesced group or a split transfer counts once */
+  transfers: number;
+
+  /** spi_ioc_transfer messages executed */
+  messages: number;
+
+  /** Queued transfers dropped because they could not start before their deadline */
+  deadlineMisses: number;
+
+  /** Times a bulk transfer was paused to let realtime transfers run */
+  preemptions: number;
+
+  /** Queued transfers withdrawn through their AbortSignal or timeoutMs */
+  aborted: number;
+
+  /** Bytes received and sent by successful transfers */
+  bytesIn: number;
+  bytesOut: number;
+
+  /** Failed transfers by errno, e.g. `{ 5: 2 }` for two EIO errors */
+  errors: Record<number, number>;
+
+  /** From the transfer() call until the transfer starts, includes waiting for the device */
+  queueWait: SPILatencyStats;
+
+  /** Time spent in the ioctl(s) of one transfer sequence */
+  ioctl: SPILatencyStats;
+
+  /** From the end of the ioctl until the Promise is settled on the JS thread */
+  completion: SPILatencyStats;
+}
 
 /**
  * Options for configuring the SPI device at initialization.
@@ -65,12 +453,373 @@ export interface SPIDeviceOptions {
    * @default 0
    */
   mode?: 0 | 1 | 2 | 3;
+
+  /**
+   * Maximum bytes per SPI_IOC_MESSAGE ioctl. Like spidev, each transfer
+   * counts its length rounded up to the kernel DMA alignment (128 bytes
+   * on arm64, 64 on 32 bit ARM, 8 on x86), tx and rx separately; the
+   * value must be at least that alignment. Larger transfers are split
+   * transparently. Defaults to the spidev `bufsiz` module parameter
+   * read from `/sys/module/spidev/parameters/bufsiz` (4096 if unavailable).
+   * The loopback backend defaults to 4096.
+   */
+  bufsiz?: number;
+
+  /**
+   * Maximum bytes of the `allocBuffer()` pool, at least 64 KiB.
+   * @default 4194304
+   */
+  pool_size?: number;
+
+  /**
+   * Where the transfers go. `loopback` is an in-process emulator for
+   * testing and benchmarking without hardware: rx receives the tx data and
+   * each transfer takes the time the bus would need at its clock speed.
+   * The device path is not opened. `flash` emulates a SPI NOR flash
+   * (JEDEC ID, SFDP, reads, page program, erase), see {@link SPIFlash}.
+   * @default 'kernel'
+   */
+  backend?: 'kernel' | 'loopback' | 'flash';
+
+  /**
+   * Size in bytes of the emulated flash of the `flash` backend,
+   * a power of 2 from 64 KiB to 256 MiB.
+   * @default 16777216
+   */
+  flash_size?: number;
+
+  /**
+   * Run transfers on a dedicated I/O thread owned by this device
+   * instead of the libuv threadpool.
+   * Pass an object to pin the thread to CPUs or to run it with SCHED_FIFO
+   * priority (needs CAP_SYS_NICE).
+   * @default false
+   */
+  io_thread?: boolean | SPIIoThreadOptions;
+
+  /**
+   * Merge transfer() calls that are queued at the same time into one
+   * SPI_IOC_MESSAGE ioctl. CS is still released between callers.
+   * Implies `io_thread`.
+   * @default false
+   */
+  coalesce?: boolean;
+}
+
+/**
+ * Options for the dedicated I/O thread.
+ */
+export interface SPIIoThreadOptions {
+  /** CPU or CPUs to pin the I/O thread to */
+  cpu?: number | number[];
+
+  /** SCHED_FIFO priority (1-99). 0 keeps the default scheduling policy */
+  priority?: number;
+}
+
+/**
+ * Options for `new SPIBus()`.
+ */
+export interface SPIBusOptions {
+  /**
+   * `fair`: each device gets bus time in proportion to its weight.
+   * `priority`: a device with a higher priority always goes first,
+   * devices with the same priority share fairly.
+   * @default 'fair'
+   */
+  policy?: 'fair' | 'priority';
+
+  /** CPU affinity and SCHED_FIFO priority of the bus thread */
+  thread?: SPIIoThreadOptions;
+}
+
+/**
+ * Options for `SPIBus.add()`.
+ */
+export interface SPIBusMemberOptions {
+  /** Share of the bus relative to the other devices. Defaults to 1 */
+  weight?: number;
+
+  /** Priority with the 'priority' policy, higher goes first. Defaults to 0 */
+  priority?: number;
+
+  /** Bandwidth budget in bytes per second. 0 (default) for no budget */
+  bandwidth?: number;
+}
+
+/**
+ * Schedules the transfers of several devices (chip selects) on the same
+ * SPI controller from one thread.
+ */
+export class SPIBus {
+  constructor(options?: SPIBusOptions);
+
+  /**
+   * Route all queued work of the device (transfer(), transferInto(),
+   * program runs, async setters) through this bus.
+   * The device must not have an `io_thread` or pending transfers.
+   */
+  add(device: SPIDevice, options?: SPIBusMemberOptions): void;
+
+  /** Give the device back its own queue. Throws while it has pending transfers */
+  remove(device: SPIDevice): void;
+}
+
+/**
+ * Options for `new SPIFlash()`. Without them, the flash is treated as a
+ * part with 3 byte addresses until probe() reads its parameters.
+ */
+export interface SPIFlashOptions {
+  /** Size in bytes. Defaults to the size found by probe() */
+  size?: number;
+
+  /** Page program size in bytes. Defaults to 256 */
+  pageSize?: number;
+
+  /** 3 or 4. Defaults to 3, or 4 once probe() finds more than 16 MiB */
+  addressBytes?: 3 | 4;
+}
+
+/**
+ * Result of `SPIFlash.probe()`.
+ */
+export interface SPIFlashInfo {
+  /** The 3 bytes answered to RDID (0x9F) */
+  jedecId: Buffer;
+  manufacturer: number;
+  memoryType: number;
+  capacity: number;
+
+  /** Size in bytes, from SFDP or the capacity byte. null if unknown */
+  size: number | null;
+
+  /** Whether the part has a SFDP basic flash parameter table */
+  sfdp: boolean;
+
+  /** 1-1-2 fast read supported, per SFDP */
+  dual: boolean;
+
+  /** 1-1-4 fast read supported, per SFDP */
+  quad: boolean;
+
+  addressBytes: 3 | 4;
+
+  /** Erase sizes in bytes, largest first */
+  eraseSizes: number[];
+}
+
+/**
+ * Options for `SPIFlash.read()`.
+ */
+export interface SPIFlashReadOptions extends SPIQueueOptions {
+  /**
+   * Data lines of the fast read: 1-1-1 (0x0B), 1-1-2 (0x3B) or 1-1-4 (0x6B).
+   * Dual and quad need a controller and a device tree with
+   * spi-rx-bus-width set accordingly.
+   * @default 'single'
+   */
+  mode?: 'single' | 'dual' | 'quad';
+
+  /** Read straight into this memory instead of a new Buffer */
+  into?: NodeJS.TypedArray;
+
+  /** Write the data to this file descriptor instead */
+  fd?: number;
+
+  /** pwrite() offset in the file. Defaults to the current file position */
+  fdOffset?: number;
+}
+
+/**
+ * SPI NOR flash on a SPIDevice. Every operation is one queued job: the
+ * command sequences, chunking and status polling run natively.
+ */
+export class SPIFlash {
+  constructor(device: SPIDevice, options?: SPIFlashOptions);
+
+  /** Size in bytes, null while unknown */
+  readonly size: number | null;
+
+  /** Read the JEDEC ID and the SFDP parameters, updates size and erase sizes */
+  probe(options?: SPIQueueOptions): Promise<SPIFlashInfo>;
+
+  /**
+   * Read `length` bytes. Resolves with the Buffer (or `into`), or with
+   * the number of bytes written to `fd`.
+   */
+  read(address: number, length: number, options?: SPIFlashReadOptions & { fd: number }): Promise<number>;
+  read<T extends NodeJS.TypedArray = Buffer>(address: number, length: number,
+    options?: SPIFlashReadOptions & { into?: T }): Promise<T>;
+
+  /** Page program, split at page boundaries. The range must be erased */
+  program(address: number, data: Buffer, options?: SPIQueueOptions): Promise<void>;
+
+  /** Erase, address and length aligned to the smallest erase size */
+  erase(address: number, length: number, options?: SPIQueueOptions): Promise<void>;
+}
+
+/**
+ * Options for `new SPIDisplay()`.
+ */
+export interface SPIDisplayOptions {
+  width: number;
+  height: number;
+
+  /**
+   * Pixel format of the framebuffers given to push(). `rgb565` is 16 bit
+   * values in host order (a Uint16Array), `rgba8888` is canvas ImageData.
+   * @default 'rgb565'
+   */
+  format?: 'rgb565' | 'rgb888' | 'rgba8888';
+
+  /**
+   * The D/C GPIO line, driven through the GPIO character device.
+   * null: 3-wire panel, D/C is sent as the first bit of 9 bit words
+   * (the controller must support 9 bits per word).
+   */
+  dc?: { chip: string; line: number } | null;
+
+  /** Panel RAM column and row of the first pixel, e.g. for 240x240 ST7789 */
+  xOffset?: number;
+  yOffset?: number;
+}
+
+/**
+ * Options for `SPIDisplay.push()`.
+ */
+export interface SPIDisplayPushOptions extends SPIQueueOptions {
+  /** Send the whole frame instead of the dirty rectangles */
+  full?: boolean;
+}
+
+/**
+ * Result of `SPIDisplay.push()`.
+ */
+export interface SPIDisplayPushResult {
+  /** Windows sent, 0 when nothing changed */
+  rects: number;
+  pixels: number;
+}
+
+/**
+ * Framebuffer pipeline for MIPI DCS panels (ILI9341, ST7789, ...).
+ */
+export class SPIDisplay {
+  constructor(device: SPIDevice, options: SPIDisplayOptions);
+
+  /**
+   * Convert the frame to RGB565 and queue the rectangles that differ
+   * from the previous frame. The framebuffer can be reused as soon as
+   * push() returns.
+   */
+  push(frame: NodeJS.TypedArray, options?: SPIDisplayPushOptions): Promise<SPIDisplayPushResult>;
+
+  /** Send a command with optional parameter bytes, e.g. the init sequence */
+  command(cmd: number, params?: Buffer | number[], options?: SPIQueueOptions): Promise<void>;
+
+  /** The next push() sends the whole frame */
+  invalidate(): void;
+}
+
+/**
+ * Frame layout and cache policy of `new SPIRegmap()`.
+ */
+export interface SPIRegmapOptions {
+  /** Bytes of the address word, 1 or 2. Defaults to 1 */
+  addressBytes?: 1 | 2;
+
+  /** Register number shifted left by this many bits in the address word. Defaults to 0 */
+  addressShift?: number;
+
+  /** OR'ed into the address word of reads. Defaults to 0x80 */
+  readFlag?: number;
+
+  /** OR'ed into the address word of writes. Defaults to 0 */
+  writeFlag?: number;
+
+  /** OR'ed in when a write covers several registers, e.g. 0x40 on the ADXL345. Defaults to 0 */
+  burstFlag?: number;
+
+  /** Bytes clocked between the address and the value of a read. Defaults to 0 */
+  dummyBytes?: number;
+
+  /** Register width in bytes (1-4), big endian. Defaults to 1 */
+  valueBytes?: number;
+
+  /** The device auto-increments the address, so adjacent writes are combined. Defaults to true */
+  burst?: boolean;
+
+  /** Highest register. Defaults to the highest address next to the read flag */
+  maxRegister?: number;
+
+  /** Registers that are never cached: numbers and [from, to] ranges */
+  volatile?: Array<number | [number, number]>;
+
+  /** Reset values, cached until the registers are written */
+  defaults?: Record<number, number>;
+}
+
+/**
+ * Register map with a write-back cache.
+ */
+export class SPIRegmap {
+  constructor(device: SPIDevice, options?: SPIRegmapOptions);
+
+  /** From the cache when it holds the register, else from the bus */
+  read(register: number, options?: SPIQueueOptions): Promise<number>;
+
+  /** Cached until sync(); volatile registers are written at once */
+  write(register: number, value: number, options?: SPIQueueOptions): Promise<void>;
+
+  /** Read-modify-write of the bits in `mask`. Resolves with the new value */
+  update(register: number, mask: number, bits: number, options?: SPIQueueOptions): Promise<number>;
+
+  /**
+   * Write the dirty registers, adjacent ones combined into bursts, in one
+   * batch. Resolves with the number of registers written.
+   */
+  sync(options?: SPIQueueOptions): Promise<number>;
+
+  /** Forget the cache (and unsynced writes), e.g. after a reset. The defaults are cached again */
+  invalidate(): void;
+}
+
+/**
+ * A detached device, see {@link SPIDevice.detach}. Can be attached once.
+ */
+export interface SPIDeviceHandle {
+  readonly id: bigint;
+  /** Path the device was opened with */
+  readonly path: string;
 }
 
 /**
  * Represents an SPI device using a Linux SPI interface.
  */
 export default class SPIDevice {
+  /** Bus scheduler, also a named export */
+  static SPIBus: typeof SPIBus;
+
+  /** SPI NOR flash, also a named export */
+  static SPIFlash: typeof SPIFlash;
+
+  /** Display framebuffer pipeline, also a named export */
+  static SPIDisplay: typeof SPIDisplay;
+
+  /** Cached register map, also a named export */
+  static SPIRegmap: typeof SPIRegmap;
+
+  /** Layout of the transferArena() descriptor table */
+  static readonly ARENA: SPIArenaLayout;
+
+  /**
+   * Close a detached device that was never attached, e.g. because the
+   * Worker it was posted to exited. Until attached or released the fd
+   * and its lock stay open for the life of the process.
+   * @returns false when the handle was already attached or released
+   */
+  static release(handle: SPIDeviceHandle): boolean;
+
   /**
    * Create a new SPI device instance.
    *
@@ -82,15 +831,156 @@ export default class SPIDevice {
    */
   constructor(device: string, options?: SPIDeviceOptions);
 
+  /**
+   * Take over a device detached in another thread (worker_threads).
+   * The mode, speed and bits per word are kept unless `options` change them.
+   * @param handle From {@link SPIDevice.detach}, e.g. received with postMessage()
+   * @param options `backend` is ignored, the device keeps its backend
+   */
+  constructor(handle: SPIDeviceHandle, options?: SPIDeviceOptions);
+
   /**
    * Perform a full-duplex SPI transfer.
    * Each element in the array can be a Buffer or a detailed transfer object.
    * @param transfers Buffers or SPITransfer objects
+   * @param options Priority lane and deadline
    * @returns A Promise resolving to an array of Buffers received from the SPI device
+   * (`null` for transmit only transfers)
+   */
+  transfer(transfers: Buffer[], options?: SPIQueueOptions): Promise<Buffer[]>;
+  transfer(transfers: (Buffer | SPITransfer)[], options?: SPIQueueOptions): Promise<(Buffer | null)[]>;
+
+  /**
+   * Perform a full-duplex SPI transfer, receiving into caller owned memory.
+   * No rx memory is allocated, so the same buffers can be reused in a loop.
+   * @param transfers Buffers or SPITransfer objects (without `rx_buf`)
+   * @param rxBuffers One receive buffer per transfer, each at least as long as its `tx_buf`,
+   * or `null` for a transmit only transfer
+   * @param options Priority lane and deadline
+   * @returns A Promise resolving to the `rxBuffers` array itself
+   */
+  transferInto<T extends (Buffer | NodeJS.TypedArray | null)[]>(
+    transfers: (Buffer | SPITransfer)[], rxBuffers: T, options?: SPIQueueOptions): Promise<T>;
+
+  /**
+   * Perform a full-duplex SPI transfer on the calling thread.
+   * Skips the threadpool and Promise round trip, which dominates the cost
+   * of tiny register transfers. Blocks the event loop for the duration
+   * of the transfer, so keep it to a few bytes.
+   * @param transfers Buffers or SPITransfer objects
+   * @returns An array of Buffers (or the given `rx_buf`s) received from the SPI device
+   * (`null` for transmit only transfers)
+   */
+  transferSync(transfers: (Buffer | SPITransfer)[]): (Buffer | NodeJS.TypedArray | null)[];
+
+  /**
+   * Perform a batch of transfers described by a descriptor table of
+   * offsets into one tx and one rx arena. The received data is written
+   * into the rx arena; no object is created per message.
+   * @param table `SPIDevice.ARENA.STRIDE` fields per message, see {@link SPIArenaLayout}
+   * @param tx Memory the messages send from, `null` when all are rx only
+   * @param rx Memory the messages receive into, `null` when all are tx only
+   * @param options Priority lane and deadline
+   * @returns A Promise resolving to `rx`
+   */
+  transferArena<T extends SPIArena | null>(table: Uint32Array, tx: SPIArena | null, rx: T,
+    options?: SPIQueueOptions): Promise<T>;
+
+  /**
+   * transferArena() on the calling thread.
+   * @returns `rx`
+   */
+  transferArenaSync<T extends SPIArena | null>(table: Uint32Array, tx: SPIArena | null, rx: T): T;
+
+  /**
+   * Repeat the transfers on the native side until
+   * `(rx[byteIndex] & mask) === value`, e.g. to wait for a busy flag.
+   * @param transfers Buffers or SPITransfer objects
+   * @param options The condition, poll interval and timeout, and the queue options
+   * @returns A Promise resolving once, with the last received data and the round count
+   */
+  transferUntil(transfers: (Buffer | SPITransfer)[], options: SPIPollOptions): Promise<SPIPollResult>;
+
+  /**
+   * Validate a transfer sequence once and keep it, with its buffers, in
+   * native memory. Running the returned program only issues the ioctl.
+   * The tx data of a transfer with `crc.tx` is copied into its framed
+   * message here: later changes to that `tx_buf` are not seen, patch
+   * the program instead.
+   * @param transfers Buffers or SPITransfer objects
+   */
+  prepare(transfers: (Buffer | SPITransfer)[]): SPIProgram;
+
+  /**
+   * Run a prepared program at a fixed interval on a native thread.
+   * The received bytes of each run are concatenated; `batchSize` samples
+   * are delivered to the callback at once.
+   * @param options Program, interval and batching
+   * @param onBatch Called with each filled batch
+   */
+  startSampling(options: SPISamplingOptions,
+    onBatch: (batch: Buffer, info: SPISampleBatchInfo) => void): void;
+
+  /** Stop sampling. Batches already filled are still delivered */
+  stopSampling(): void;
+
+  /**
+   * Run a prepared program on a native thread for each event on `fd`:
+   * a line event of a GPIO line request (data ready / IRQ line), a count
+   * of an eventfd or a byte in a pipe. The thread reads its own copy of
+   * the fd; an eventfd or GPIO line request is O_NONBLOCK until disarm().
+   * Batches are delivered like with startSampling().
+   */
+  armOnEvent(fd: number, program: SPIProgram,
+    onBatch: (batch: Buffer, info: SPISampleBatchInfo) => void, options?: SPIEventOptions): void;
+
+  /** Stop the event trigger. Batches already filled are still delivered */
+  disarm(): void;
+
+  /**
+   * Record every SPI_IOC_MESSAGE of this device (timestamp, duration,
+   * errno, transfer parameters and the first tx and rx bytes) into a ring
+   * in a memory-mapped file. The file is created or truncated.
+   * @param path Trace file, read by replay.js
+   */
+  startTrace(path: string, options?: SPITraceOptions): void;
+
+  /** Stop tracing. The file keeps the records */
+  stopTrace(): void;
+
+  /**
+   * Zero filled Buffer from the device's pool of page aligned, mlock()ed
+   * memory. Transfers pin pool memory instead of referencing the Buffer;
+   * the block is recycled once the Buffer is collected.
+   * @throws Error with code `ERR_SPI_POOL_EXHAUSTED` beyond `pool_size`
+   */
+  allocBuffer(size: number): Buffer;
+
+  /** Size and usage of the `allocBuffer()` pool */
+  getPoolStats(): SPIPoolStats;
+
+  /**
+   * Snapshot of the performance counters and latency histograms of this device.
+   * Counting is always on.
+   */
+  getStats(): SPIStats;
+
+  /** Reset all counters and histograms to zero */
+  resetStats(): void;
+
+  /**
+   * Hand the open device over to another thread. The returned handle can
+   * be posted to a Worker, where `new SPIDevice(handle)` takes the device
+   * over. Afterwards every transfer on this instance fails with EBADF.
+   * Throws while transfers are pending, sampling or tracing runs or the
+   * device is on an SPIBus. A handle that is never attached keeps the
+   * device open, see {@link SPIDevice.release}.
    */
-  transfer(transfers: (Buffer | SPITransfer)[]): Promise<Buffer[]>;
+  detach(): SPIDeviceHandle;
 
   // --- Configuration Getters and Setters ---
+  // Getters return a cached copy and never issue an ioctl.
+  // Setters are no-ops when the value is unchanged.
 
   /** Set SPI mode (0–3) */
   setMode(mode: 0 | 1 | 2 | 3): void;
@@ -109,4 +999,16 @@ export default class SPIDevice {
 
   /** Get current bits per word */
   getBitsPerWord(): number;
+
+  /**
+   * Set SPI mode after the transfers queued before this call,
+   * without blocking the event loop while a transfer is running.
+   */
+  setModeAsync(mode: 0 | 1 | 2 | 3): Promise<void>;
+
+  /** Like setModeAsync(), for the max SPI speed (Hz) */
+  setMaxSpeedHzAsync(hz: number): Promise<void>;
+
+  /** Like setModeAsync(), for the bits per word */
+  setBitsPerWordAsync(bits: number): Promise<void>;
 }
@@ -1,2 +1,6 @@
 import SPIDevice from './index.cjs';
 export default SPIDevice;
+export const SPIBus = SPIDevice.SPIBus;
+export const SPIFlash = SPIDevice.SPIFlash;
+export const SPIDisplay = SPIDevice.SPIDisplay;
+export const SPIRegmap = SPIDevice.SPIRegmap;
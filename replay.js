@@ -0,0 +1,456 @@
+// @ts-check
+"use strict";
+
+/**
+ * Replays a trace recorded with spi.startTrace() against a device and
+ * compares the timing of every SPI_IOC_MESSAGE with the recording.
+ *
+ * The replay is traced itself, so both sides are measured the same way:
+ * the duration of the ioctl, without JS or queueing overhead. Transfers
+ * send the captured tx bytes; bytes past the capture limit (maxBytes of
+ * startTrace()) are sent as zeros and such records are counted as
+ * truncated. Open the device with the mode and bits per word of the
+ * recording, the clock speed is taken from the trace.
+ *
+ * Run with:
+ * node replay.js --trace=spi.trace
+ *
+ * Optional flags:
+ *
+ * --device, -d Set the device e.g --device=/dev/spidev0.1
+ * The default device is /dev/spidev0.0
+ *
+ * --backend, -B kernel (default) or loopback.
+ *
+ * --pace, -p Keep the recorded gaps between messages, instead of
+ * replaying them back to back.
+ *
+ * --limit, -l Replay at most this many records, oldest first.
+ *
+ * --json, -j Print the results as JSON, with the delta of every record.
+ */
+
+import SPIDevice from '@eeemarv/io-spi';
+import { readFileSync, unlinkSync } from 'node:fs';
+import { endianness } from 'node:os';
+
+const showHelp = () => {
+  console.log(`Usage: node replay.js --trace=<file> [options]
+
+Replays a trace from startTrace() and reports the timing deltas
+
+Options:
+  --trace=<file>, -t=<file>          Trace file to replay. Required.
+  --device=<path>, -d=<path>         Set the SPI device path. Default is /dev/spidev0.0.
+  --backend=<name>, -B=<name>        kernel or loopback (no hardware needed). Default is kernel.
+  --pace, -p                         Keep the recorded gaps between messages.
+  --limit=<number>, -l=<number>      Replay at most this many records.
+  --json, -j                         Print the results as JSON.
+  --help, -h                         Show this help message. `);
+};
+
+const MAGIC = 'SPITRACE';
+const RECORD_PADDING = 1;
+const TRANSFER_TX = 1;
+const TRANSFER_RX = 2;
+
+/**
+ * @typedef {{
+ *   len: number, speedHz: number, captured: number, delayUsecs: number,
+ *   bitsPerWord: number, csChange: number, txNbits: number, rxNbits: number,
+ *   wordDelayUsecs: number, tx: Buffer | null, rx: Buffer | null
+ * }} TraceTransfer
+ *
+ * @typedef {{
+ *   error: number, speedHz: number, startNs: bigint, durationNs: number,
+ *   transfers: TraceTransfer[]
+ * }} TraceRecord
+ */
+
+/**
+ * Reads the records of a trace file, oldest first. See src/spi_trace.h
+ * for the layout.
+ * @param {string} file
+ */
+const readTrace = (file) => {
+  const buf = readFileSync(file);
+  const le = endianness() === 'LE';
+  const view = new DataView(buf.buffer, buf.byteOffset, buf.byteLength);
+
+  if (buf.length < 128 || buf.toString('latin1', 0, 8) !== MAGIC) {
+    throw new Error(`${file} is not an SPI trace`);
+  }
+
+  const version = view.getUint32(8, le);
+
+  if (version !== 1) {
+    throw new Error(`Unsupported trace version ${version}`);
+  }
+
+  const headerSize = view.getUint32(12, le);
+  const capacity = view.getBigUint64(16, le);
+  const head = view.getBigUint64(24, le);
+  const tail = view.getBigUint64(32, le);
+
+  const header = {
+    capacity: Number(capacity),
+    maxBytes: view.getUint32(40, le),
+    records: Number(view.getBigUint64(48, le)),
+    overwritten: Number(view.getBigUint64(56, le)),
+    skipped: Number(view.getBigUint64(64, le))
+  };
+
+  /** @type {TraceRecord[]} */
+  const records = [];
+
+  for (let at = tail; at < head;) {
+    const pos = headerSize + Number(at % capacity);
+    const size = view.getUint32(pos, le);
+    const count = view.getUint16(pos + 4, le);
+    const flags = view.getUint16(pos + 6, le);
+
+    if (size === 0) {
+      throw new Error(`Corrupt trace record at ${at}`);
+    }
+
+    at += BigInt(size);
+
+    if (flags & RECORD_PADDING) {
+      continue;
+    }
+
+    /** @type {TraceTransfer[]} */
+    const transfers = [];
+    let data = pos + 32 + count * 20;
+
+    for (let i = 0; i < count; i++) {
+      const t = pos + 32 + i * 20;
+      const captured = view.getUint32(t + 8, le);
+      const tflags = view.getUint8(t + 19);
+      let tx = null;
+      let rx = null;
+
+      if (tflags & TRANSFER_TX) {
+        tx = buf.subarray(data, data + captured);
+        data += captured;
+      }
+
+      if (tflags & TRANSFER_RX) {
+        rx = buf.subarray(data, data + captured);
+        data += captured;
+      }
+
+      transfers.push({
+        len: view.getUint32(t, le),
+        speedHz: view.getUint32(t + 4, le),
+        captured,
+        delayUsecs: view.getUint16(t + 12, le),
+        bitsPerWord: view.getUint8(t + 14),
+        csChange: view.getUint8(t + 15),
+        txNbits: view.getUint8(t + 16),
+        rxNbits: view.getUint8(t + 17),
+        wordDelayUsecs: view.getUint8(t + 18),
+        tx,
+        rx
+      });
+    }
+
+    records.push({
+      error: view.getInt32(pos + 8, le),
+      speedHz: view.getUint32(pos + 12, le),
+      startNs: view.getBigUint64(pos + 16, le),
+      durationNs: Number(view.getBigUint64(pos + 24, le)),
+      transfers
+    });
+  }
+
+  return { header, records };
+};
+
+/**
+ * The transfer() messages of a record, tx padded with zeros to the full
+ * length. Zero fields are left out: they mean the device setting.
+ * @param {TraceRecord} record
+ */
+const toMessages = (record) => record.transfers.map((t) => {
+  /** @type {import('@eeemarv/io-spi').SPITransfer} */
+  const msg = {
+    tx_buf: null,
+    rx_buf: t.rx ? Buffer.alloc(t.len) : null,
+    speed_hz: t.speedHz || record.speedHz,
+    delay_usecs: t.delayUsecs,
+    cs_change: t.csChange,
+    word_delay_usecs: t.wordDelayUsecs
+  };
+
+  if (t.tx) {
+    msg.tx_buf = Buffer.alloc(t.len);
+    t.tx.copy(msg.tx_buf);
+  }
+
+  if (t.bitsPerWord) {
+    msg.bits_per_word = t.bitsPerWord;
+  }
+
+  if (t.txNbits) {
+    msg.tx_nbits = t.txNbits;
+  }
+
+  if (t.rxNbits) {
+    msg.rx_nbits = t.rxNbits;
+  }
+
+  return msg;
+});
+
+/**
+ * @param {number[]} samples sorted
+ * @param {number} p percentile 0-100
+ */
+const percentile = (samples, p) => {
+  const i = Math.min(samples.length - 1, Math.floor(samples.length * p / 100));
+  return samples[i];
+};
+
+const sleeper = new Int32Array(new SharedArrayBuffer(4));
+
+/**
+ * Waits until process.hrtime.bigint() reaches `until`: sleeps for the
+ * bulk of long gaps and spins for the last millisecond.
+ * @param {bigint} until
+ */
+const waitUntil = (until) => {
+  const left = Number(until - process.hrtime.bigint());
+
+  if (left > 2e6) {
+    Atomics.wait(sleeper, 0, 0, (left - 1e6) / 1e6);
+  }
+
+  while (process.hrtime.bigint() < until) {}
+};
+
+(() => {
+  let trace = '';
+  let device = '/dev/spidev0.0';
+  let backend = 'kernel';
+  let pace = false;
+  let limit = Infinity;
+  let json = false;
+  let skipArg = false;
+
+  const args = process.argv.slice(2);
+
+  try {
+    args.forEach((arg, i) => {
+      let key = undefined;
+      let value = undefined;
+      if (skipArg) {
+        skipArg = false;
+        return;
+      }
+
+      if (arg == '--help' || arg === '-h') {
+        showHelp();
+        process.exit(0);
+      }
+
+      if (arg === '--json' || arg === '-j') {
+        json = true;
+        return;
+      }
+
+      if (arg === '--pace' || arg === '-p') {
+        pace = true;
+        return;
+      }
+
+      if (arg.includes('=')) {
+        [key, value] = arg.split('=');
+      } else {
+        key = arg;
+        value = args[i + 1];
+        skipArg = true;
+      }
+
+      if (key === '--trace' || key === '-t') {
+        if (!value) {
+          throw new Error('Missing value for --trace');
+        }
+        trace = value;
+        return;
+      }
+
+      if (key === '--device' || key === '-d') {
+        if (!value) {
+          throw new Error('Missing value for --device');
+        }
+        device = value;
+        return;
+      }
+
+      if (key === '--backend' || key === '-B') {
+        if (!value || !['kernel', 'loopback'].includes(value)) {
+          throw new Error('Invalid backend. Use kernel or loopback.');
+        }
+        backend = value;
+        return;
+      }
+
+      if (key === '--limit' || key === '-l') {
+        limit = Number(value?.replace(/_/g, ''));
+        if (!Number.isInteger(limit) || limit < 1) {
+          throw new Error('Invalid limit');
+        }
+        return;
+      }
+
+      throw new Error(`Unknown argument: ${arg}`);
+    });
+
+    if (!trace) {
+      throw new Error('Missing --trace');
+    }
+
+  } catch (err) {
+    console.error('\x1b[1;31mError: \x1b[0m', err.message);
+    showHelp();
+    process.exit(1);
+  }
+
+  const recorded = readTrace(trace);
+  const records = recorded.records.slice(0, limit);
+
+  if (records.length === 0) {
+    console.error('\x1b[1;31mError: \x1b[0m', `${trace} holds no records`);
+    process.exit(1);
+  }
+
+  const spi = new SPIDevice(device, {
+    backend: /** @type {'kernel' | 'loopback'} */ (backend)
+  });
+
+  if (!json) {
+    console.log(`SPI device: \x1b[1;33m${device}\x1b[0m (${backend})`);
+    console.log(`Trace: \x1b[1;33m${trace}\x1b[0m, \x1b[1;33m${records.length}\x1b[0m records` +
+      ` (${recorded.header.overwritten} overwritten, ${recorded.header.skipped} too large)`);
+  }
+
+  // Same ring size: every replayed record fits, as the recorded ones did
+  const out = `${trace}.replay`;
+  spi.startTrace(out, { size: recorded.header.capacity, maxBytes: recorded.header.maxBytes });
+
+  const messages = records.map(toMessages);
+  const t0 = process.hrtime.bigint();
+  /** @type {boolean[]} */
+  const issued = [];
+  let failed = 0;
+
+  records.forEach((record, i) => {
+    if (pace) {
+      waitUntil(t0 + record.startNs - records[0].startNs);
+    }
+
+    try {
+      spi.transferSync(messages[i]);
+      issued.push(true);
+    } catch (err) {
+      // A failed ioctl is traced too, a rejected message never got that far
+      issued.push(err.message.startsWith('SPI transfer failed'));
+      failed++;
+    }
+  });
+
+  spi.stopTrace();
+  const traced = readTrace(out).records;
+  unlinkSync(out);
+
+  /** @type {(TraceRecord | null)[]} */
+  const replayed = [];
+  let next = 0;
+
+  for (const ok of issued) {
+    replayed.push(ok ? traced[next++] : null);
+  }
+
+  /** @type {(number | null)[]} */
+  const deltas = [];
+  let truncated = 0;
+  let mismatched = 0;
+
+  records.forEach((record, i) => {
+    const again = replayed[i];
+
+    if (record.transfers.some((t) => t.captured < t.len)) {
+      truncated++;
+    }
+
+    if (!again) {
+      deltas.push(null);
+      return;
+    }
+
+    deltas.push(again.durationNs - record.durationNs);
+
+    if (record.transfers.some((t, j) => t.rx && !t.rx.equals(/** @type {Buffer} */ (again.transfers[j].rx)))) {
+      mismatched++;
+    }
+  });
+
+  const sorted = /** @type {number[]} */ (deltas.filter((d) => d !== null)).sort((a, b) => a - b);
+  const us = (/** @type {number} */ ns) => Math.round(ns / 100) / 10;
+  const summary = {
+    records: records.length,
+    failed,
+    recordedErrors: records.filter((r) => r.error !== 0).length,
+    truncated,
+    rxMismatches: mismatched,
+    meanDeltaUs: us(sorted.reduce((a, b) => a + b, 0) / sorted.length),
+    p50DeltaUs: us(percentile(sorted, 50)),
+    p99DeltaUs: us(percentile(sorted, 99)),
+    minDeltaUs: us(sorted[0]),
+    maxDeltaUs: us(sorted[sorted.length - 1])
+  };
+
+  if (json) {
+    console.log(JSON.stringify({
+      node: process.version,
+      date: new Date().toISOString(),
+      device,
+      backend,
+      trace,
+      pace,
+      ...summary,
+      deltasNs: deltas
+    }, null, 2));
+    return;
+  }
+
+  console.log(`Replayed \x1b[1;33m${summary.records}\x1b[0m records, ${failed} failed` +
+    ` (${summary.recordedErrors} failed when recorded)`);
+  console.log(`${truncated} truncated (tx past the capture limit sent as zeros),` +
+    ` ${mismatched} with different rx data`);
+  console.log(`ioctl time, replay minus recording:` +
+    ` mean ${summary.meanDeltaUs.toFixed(1)} µs` +
+    ` p50 ${summary.p50DeltaUs.toFixed(1)} µs` +
+    ` p99 ${summary.p99DeltaUs.toFixed(1)} µs` +
+    ` min ${summary.minDeltaUs.toFixed(1)} µs` +
+    ` max ${summary.maxDeltaUs.toFixed(1)} µs`);
+
+  const worst = deltas.map((d, i) => ({ d, i }))
+    .filter((e) => e.d !== null)
+    .sort((a, b) => Math.abs(/** @type {number} */ (b.d)) - Math.abs(/** @type {number} */ (a.d)))
+    .slice(0, 5);
+
+  console.log('Largest deltas:');
+  for (const { i } of worst) {
+    const r = records[i];
+    const d = /** @type {number} */ (deltas[i]);
+    const again = /** @type {TraceRecord} */ (replayed[i]);
+    const bytes = r.transfers.reduce((n, t) => n + t.len, 0);
+    console.log(`  #${String(i).padStart(6)} ${String(r.transfers.length).padStart(3)} transfers` +
+      ` ${String(bytes).padStart(7)} bytes` +
+      ` recorded ${us(r.durationNs).toFixed(1).padStart(9)} µs` +
+      ` replayed ${us(again.durationNs).toFixed(1).padStart(9)} µs` +
+      ` delta ${us(d).toFixed(1).padStart(9)} µs`);
+  }
+})();
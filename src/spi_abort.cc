@@ -0,0 +1,118 @@
+#include "spi_device.h"
+#include "spi_bus.h"
+#include <algorithm>
+
+// 'abort' listener, `this` is the signal and the data is the job
+Napi::Value SPIDevice::Job::OnAbort(const Napi::CallbackInfo& info) {
+  auto* job = static_cast<Job*>(info.Data());
+
+  SPIDevice* device = job->device;
+
+  // Completed here when it could be taken off its queue, otherwise by
+  // the executor that already popped it
+  if (job->Abort(info.This().As<Napi::Object>().Get("reason")) &&
+      device->Unlink(info.Env(), job)) {
+    device->CompleteJob(info.Env(), job);
+  }
+
+  return info.Env().Undefined();
+}
+
+void SPIDevice::Job::Watch(Napi::Env env, const std::vector<Napi::Object>& list) {
+  for (const Napi::Object& signal : list) {
+    if (signal.Get("aborted").ToBoolean().Value()) {
+      Abort(signal.Get("reason"));
+      return;
+    }
+  }
+
+  // The listeners are removed again in Complete(), before the job is
+  // deleted, so OnAbort never sees a deleted job.
+  Napi::Function listener = Napi::Function::New(env, OnAbort, "onabort", this);
+  onAbort = Napi::Persistent(listener);
+
+  for (const Napi::Object& signal : list) {
+    signal.Get("addEventListener").As<Napi::Function>()
+      .Call(signal, { Napi::String::New(env, "abort"), listener });
+    signals.push_back(Napi::Persistent(signal));
+  }
+}
+
+void SPIDevice::Job::Unwatch() {
+  if (onAbort.IsEmpty()) {
+    return;
+  }
+
+  Napi::Env env = onAbort.Env();
+
+  for (Napi::ObjectReference& ref : signals) {
+    Napi::Object signal = ref.Value();
+
+    signal.Get("removeEventListener").As<Napi::Function>()
+      .Call(signal, { Napi::String::New(env, "abort"), onAbort.Value() });
+  }
+
+  signals.clear();
+  onAbort.Reset();
+}
+
+// Rejects with the signal's reason, unless the job already started
+bool SPIDevice::Job::Abort(Napi::Value reason) {
+  int expected = QUEUED;
+
+  if (!state.compare_exchange_strong(expected, ABORTED, std::memory_order_acq_rel)) {
+    return false;
+  }
+
+  deferred.Reject(reason);
+  SPIStats::Add(device->stats.aborted, 1);
+  return true;
+}
+
+// Takes an aborted job off its queue (JS thread), so it holds no queue
+// slot and no executor until its turn. Its threadpool worker retires
+// without waiting for the device mutex (realtime jobs: once it gets the
+// mutex, to wake a preempted bulk job). Jobs in the lock-free io_thread ring
+// stay until the I/O thread pops and skips them. Returns false when the
+// job is not queued (anymore).
+bool SPIDevice::Unlink(Napi::Env env, Job* job) {
+  if (bus) {
+    return bus->Unlink(env, this, job);
+  }
+
+  if (ioThread) {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(queueMutex);
+  std::deque<Job*>& queue = queued[job->lane];
+  auto it = std::find(queue.begin(), queue.end(), job);
+
+  if (it == queue.end()) {
+    return false;
+  }
+
+  queue.erase(it);
+
+  if (job->lane == LANE_REALTIME) {
+    realtimeQueued.fetch_sub(1, std::memory_order_release);
+  }
+
+  // The worker keeps the device alive until it has retired
+  retiredWorkers[job->lane]++;
+  Ref();
+  return true;
+}
+
+// One threadpool worker too many after Unlink(): the next one to look
+// for a job leaves instead
+bool SPIDevice::RetireWorker(Lane lane) {
+  std::lock_guard<std::mutex> lock(queueMutex);
+
+  if (retiredWorkers[lane] == 0) {
+    return false;
+  }
+
+  retiredWorkers[lane]--;
+  return true;
+}
@@ -0,0 +1,20 @@
+#ifndef SPI_ADDON_H
+#define SPI_ADDON_H
+
+#include <napi.h>
+
+// Per-environment state, stored with napi_set_instance_data(). The main
+// thread and every worker_threads Worker that loads the addon get their
+// own constructors, freed when that environment shuts down.
+struct SPIAddon {
+  Napi::FunctionReference device;
+  Napi::FunctionReference program;
+  Napi::FunctionReference bus;
+  Napi::FunctionReference flash;
+  Napi::FunctionReference display;
+  Napi::FunctionReference regmap;
+
+  static SPIAddon* Get(Napi::Env env) { return env.GetInstanceData<SPIAddon>(); }
+};
+
+#endif
@@ -0,0 +1,238 @@
+#include "spi_device.h"
+#include <cstring>
+
+// Descriptor table of transferArena(): ARENA_STRIDE Uint32 fields per message
+namespace {
+  enum ArenaField {
+    FIELD_TX_OFFSET,   // byte offset into the tx arena, ARENA_NONE: rx only
+    FIELD_RX_OFFSET,   // byte offset into the rx arena, ARENA_NONE: tx only
+    FIELD_LEN,
+    FIELD_SPEED_HZ,    // 0: device default
+    FIELD_DELAYS,      // delay_usecs | word_delay_usecs << 16
+    FIELD_FLAGS,       // bits_per_word | cs_change << 8 | tx_nbits << 16 | rx_nbits << 24
+    ARENA_STRIDE
+  };
+
+  const uint32_t ARENA_NONE = 0xffffffff;
+
+  // An arena is an ArrayBuffer or any view on one (Buffer, TypedArray,
+  // DataView), which is how a SharedArrayBuffer is passed. null: none.
+  void GetArenaMemory(Napi::Env env, const Napi::Value& val, const char* name,
+      uint8_t*& data, size_t& length) {
+    data = nullptr;
+    length = 0;
+
+    if (val.IsNull() || val.IsUndefined()) {
+      return;
+    }
+
+    void* raw = nullptr;
+    napi_status status;
+
+    if (val.IsArrayBuffer()) {
+      status = napi_get_arraybuffer_info(env, val, &raw, &length);
+    }
+    else if (val.IsTypedArray()) {
+      status = napi_get_typedarray_info(env, val, nullptr, nullptr, &raw, nullptr, nullptr);
+      length = val.As<Napi::TypedArray>().ByteLength();
+    }
+    else if (val.IsDataView()) {
+      status = napi_get_dataview_info(env, val, &length, &raw, nullptr, nullptr);
+    }
+    else {
+      throw Napi::TypeError::New(env, std::string(name) +
+        " arena must be an ArrayBuffer, a TypedArray, a DataView or null");
+    }
+
+    if (status != napi_ok) {
+      throw Napi::Error::New(env, std::string("Failed to access the ") + name + " arena memory");
+    }
+
+    data = static_cast<uint8_t*>(raw);
+  }
+
+  void CheckRange(Napi::Env env, uint32_t offset, uint32_t len, size_t length,
+      const char* name, size_t message) {
+    if (static_cast<uint64_t>(offset) + len > length) {
+      throw Napi::RangeError::New(env, "Message " + std::to_string(message) +
+        " exceeds the " + name + " arena (" + std::to_string(length) + " bytes)");
+    }
+  }
+}
+
+// The messages point straight into the arenas: nothing is copied and
+// no object is created per message.
+void SPIDevice::ParseArena(Napi::Env env, const Napi::Value& table,
+    const Napi::Value& tx, const Napi::Value& rx, std::vector<spi_ioc_transfer>& transfers) {
+
+  if (!table.IsTypedArray() || table.As<Napi::TypedArray>().TypedArrayType() != napi_uint32_array) {
+    throw Napi::TypeError::New(env, "Descriptor table must be a Uint32Array");
+  }
+
+  Napi::Uint32Array fields = table.As<Napi::Uint32Array>();
+
+  if (fields.ElementLength() == 0 || fields.ElementLength() % ARENA_STRIDE != 0) {
+    throw Napi::RangeError::New(env, "Descriptor table length must be a non-zero multiple of " +
+      std::to_string(ARENA_STRIDE));
+  }
+
+  uint8_t* txData;
+  uint8_t* rxData;
+  size_t txLength;
+  size_t rxLength;
+
+  GetArenaMemory(env, tx, "tx", txData, txLength);
+  GetArenaMemory(env, rx, "rx", rxData, rxLength);
+
+  size_t count = fields.ElementLength() / ARENA_STRIDE;
+  const uint32_t* desc = fields.Data();
+
+  transfers.clear();
+  transfers.reserve(count);
+
+  for (size_t i = 0; i < count; i++, desc += ARENA_STRIDE) {
+    spi_ioc_transfer tr = {};
+    uint32_t len = desc[FIELD_LEN];
+    uint32_t flags = desc[FIELD_FLAGS];
+    uint32_t delays = desc[FIELD_DELAYS];
+
+    if (len == 0) {
+      throw Napi::RangeError::New(env, "Message " + std::to_string(i) + " has length 0");
+    }
+
+    if (desc[FIELD_TX_OFFSET] == ARENA_NONE && desc[FIELD_RX_OFFSET] == ARENA_NONE) {
+      throw Napi::Error::New(env, "Message " + std::to_string(i) + " has neither tx nor rx");
+    }
+
+    if (desc[FIELD_TX_OFFSET] != ARENA_NONE) {
+      if (txData == nullptr) {
+        throw Napi::Error::New(env, "Message " + std::to_string(i) + " sends, but there is no tx arena");
+      }
+
+      CheckRange(env, desc[FIELD_TX_OFFSET], len, txLength, "tx", i);
+      tr.tx_buf = (unsigned long)(txData + desc[FIELD_TX_OFFSET]);
+    }
+
+    if (desc[FIELD_RX_OFFSET] != ARENA_NONE) {
+      if (rxData == nullptr) {
+        throw Napi::Error::New(env, "Message " + std::to_string(i) + " receives, but there is no rx arena");
+      }
+
+      CheckRange(env, desc[FIELD_RX_OFFSET], len, rxLength, "rx", i);
+      tr.rx_buf = (unsigned long)(rxData + desc[FIELD_RX_OFFSET]);
+    }
+
+    if ((flags >> 8 & 0xff) > 1) {
+      throw Napi::Error::New(env, "cs_change must be 0 (keep CS active) or 1 (release CS)");
+    }
+
+    if ((flags & 0xff) > 64 || (flags >> 16 & 0xff) > 64 || (flags >> 24) > 64) {
+      throw Napi::Error::New(env, "bits_per_word, tx_nbits and rx_nbits must be between 0 and 64");
+    }
+
+    if ((delays >> 16) > 255) {
+      throw Napi::Error::New(env, "word_delay_usecs cannot exceed 255 µs");
+    }
+
+    tr.len = len;
+    tr.speed_hz = desc[FIELD_SPEED_HZ];
+    tr.delay_usecs = static_cast<uint16_t>(delays & 0xffff);
+    tr.word_delay_usecs = static_cast<uint8_t>(delays >> 16);
+    tr.bits_per_word = static_cast<uint8_t>(flags & 0xff);
+    tr.cs_change = static_cast<uint8_t>(flags >> 8 & 0xff);
+    tr.tx_nbits = static_cast<uint8_t>(flags >> 16 & 0xff);
+    tr.rx_nbits = static_cast<uint8_t>(flags >> 24);
+
+    transfers.push_back(tr);
+  }
+}
+
+Napi::Value SPIDevice::TransferArena(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 3) {
+    Napi::TypeError::New(env, "Descriptor table, tx arena and rx arena expected")
+      .ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  std::vector<spi_ioc_transfer> transfers;
+  JobOptions options;
+
+  try {
+    ParseArena(env, info[0], info[1], info[2], transfers);
+    options = ParseJobOptions(env, info[3]);
+  }
+  catch (const Napi::Error& e) {
+    e.ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  // One reference pins both arenas until the job completes
+  Napi::Array arenas = Napi::Array::New(env, 2);
+  arenas.Set(0u, info[1].IsUndefined() ? env.Null() : info[1]);
+  arenas.Set(1u, info[2].IsUndefined() ? env.Null() : info[2]);
+
+  return QueueJob(env, new ArenaJob(env, std::move(transfers), arenas), options);
+}
+
+Napi::Value SPIDevice::TransferArenaSync(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 3) {
+    Napi::TypeError::New(env, "Descriptor table, tx arena and rx arena expected")
+      .ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  std::vector<spi_ioc_transfer> transfers;
+
+  try {
+    ParseArena(env, info[0], info[1], info[2], transfers);
+  }
+  catch (const Napi::Error& e) {
+    e.ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  int err;
+  {
+    SPI_LOCK_GUARD;
+    err = RunTransfers(transfers);
+  }
+
+  if (err != 0) {
+    Napi::Error::New(env, std::string("SPI transfer failed: ") + std::strerror(err))
+      .ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  return info[2].IsUndefined() ? env.Null() : info[2];
+}
+
+void SPIDevice::ArenaJob::Execute(SPIDevice* device) {
+  int err = Run(device, transfers);
+
+  if (err != 0) {
+    SetTransferError(err);
+  }
+}
+
+// Resolves with the rx arena itself
+Napi::Value SPIDevice::ArenaJob::Result(Napi::Env) {
+  return arenas.Value().Get(1u);
+}
+
+Napi::Value SPIDevice::ArenaConstants(Napi::Env env) {
+  Napi::Object constants = Napi::Object::New(env);
+  constants.Set("STRIDE", Napi::Number::New(env, ARENA_STRIDE));
+  constants.Set("NONE", Napi::Number::New(env, ARENA_NONE));
+  constants.Set("TX_OFFSET", Napi::Number::New(env, FIELD_TX_OFFSET));
+  constants.Set("RX_OFFSET", Napi::Number::New(env, FIELD_RX_OFFSET));
+  constants.Set("LEN", Napi::Number::New(env, FIELD_LEN));
+  constants.Set("SPEED_HZ", Napi::Number::New(env, FIELD_SPEED_HZ));
+  constants.Set("DELAYS", Napi::Number::New(env, FIELD_DELAYS));
+  constants.Set("FLAGS", Napi::Number::New(env, FIELD_FLAGS));
+  constants.Freeze();
+  return constants;
+}
@@ -0,0 +1,177 @@
+#include "spi_backend.h"
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/spi/spidev.h>
+#include <time.h>
+#include <cerrno>
+#include <cstring>
+
+namespace {
+  const uint64_t NS_PER_SEC = 1000000000ull;
+
+  uint64_t NowNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * NS_PER_SEC + ts.tv_nsec;
+  }
+
+  void SleepUntil(uint64_t ns) {
+    timespec ts;
+    ts.tv_sec = static_cast<time_t>(ns / NS_PER_SEC);
+    ts.tv_nsec = static_cast<long>(ns % NS_PER_SEC);
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {}
+  }
+
+  int Fail(int err) {
+    errno = err;
+    return -1;
+  }
+}
+
+SPIKernelBackend::~SPIKernelBackend() {
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+int SPIKernelBackend::Ioctl(unsigned long request, void* arg) {
+  return ioctl(fd, request, arg);
+}
+
+int SPIDetachedBackend::Ioctl(unsigned long, void*) {
+  errno = EBADF;
+  return -1;
+}
+
+int SPILoopbackBackend::Ioctl(unsigned long request, void* arg) {
+  if (_IOC_TYPE(request) == SPI_IOC_MAGIC && _IOC_NR(request) == _IOC_NR(SPI_IOC_MESSAGE(0)) &&
+      _IOC_DIR(request) == _IOC_WRITE) {
+    size_t size = _IOC_SIZE(request);
+
+    if (size == 0 || size % sizeof(struct spi_ioc_transfer) != 0) {
+      return Fail(EINVAL);
+    }
+
+    return Message(static_cast<const struct spi_ioc_transfer*>(arg),
+      size / sizeof(struct spi_ioc_transfer));
+  }
+
+  switch (request) {
+    case SPI_IOC_RD_MODE:
+      *static_cast<uint8_t*>(arg) = static_cast<uint8_t>(mode);
+      return 0;
+
+    case SPI_IOC_WR_MODE:
+      mode = (mode & ~0xffu) | *static_cast<uint8_t*>(arg);
+      return 0;
+
+    case SPI_IOC_RD_MODE32:
+      *static_cast<uint32_t*>(arg) = mode;
+      return 0;
+
+    case SPI_IOC_WR_MODE32:
+      mode = *static_cast<uint32_t*>(arg);
+      return 0;
+
+    case SPI_IOC_RD_LSB_FIRST:
+      *static_cast<uint8_t*>(arg) = (mode & SPI_LSB_FIRST) ? 1 : 0;
+      return 0;
+
+    case SPI_IOC_WR_LSB_FIRST:
+      mode = *static_cast<uint8_t*>(arg) ? (mode | SPI_LSB_FIRST) : (mode & ~SPI_LSB_FIRST);
+      return 0;
+
+    case SPI_IOC_RD_BITS_PER_WORD:
+      *static_cast<uint8_t*>(arg) = bits;
+      return 0;
+
+    case SPI_IOC_WR_BITS_PER_WORD: {
+      uint8_t value = *static_cast<uint8_t*>(arg);
+
+      if (value > 32) {
+        return Fail(EINVAL);
+      }
+
+      bits = value == 0 ? 8 : value;
+      return 0;
+    }
+
+    case SPI_IOC_RD_MAX_SPEED_HZ:
+      *static_cast<uint32_t*>(arg) = speed;
+      return 0;
+
+    case SPI_IOC_WR_MAX_SPEED_HZ:
+      speed = *static_cast<uint32_t*>(arg);
+      return 0;
+
+    default:
+      return Fail(ENOTTY);
+  }
+}
+
+void SPILoopbackBackend::Exchange(const struct spi_ioc_transfer& tr) {
+  if (tr.rx_buf != 0) {
+    void* rx = reinterpret_cast<void*>(tr.rx_buf);
+
+    if (tr.tx_buf != 0) {
+      std::memmove(rx, reinterpret_cast<const void*>(tr.tx_buf), tr.len);
+    }
+    else {
+      std::memset(rx, 0, tr.len);
+    }
+  }
+}
+
+// Copies tx to rx and sleeps until the modeled bus time has passed.
+// Returns the number of bytes, like the spidev SPI_IOC_MESSAGE ioctl.
+int SPILoopbackBackend::Message(const struct spi_ioc_transfer* transfers, size_t count) {
+  uint64_t start = NowNs();
+  uint64_t busNs = 0;
+  size_t total = 0;
+  SPIBufsizUse use;
+
+  for (size_t i = 0; i < count; i++) {
+    total += transfers[i].len;
+    use.Add(transfers[i]);
+  }
+
+  if (!use.Fits(bufsiz)) {
+    return Fail(EMSGSIZE);
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    const spi_ioc_transfer& tr = transfers[i];
+    uint32_t wordBits = tr.bits_per_word ? tr.bits_per_word : bits;
+    uint32_t hz = tr.speed_hz ? tr.speed_hz : speed;
+
+    if (hz == 0) {
+      return Fail(EINVAL);
+    }
+
+    Exchange(tr);
+
+    if (tr.cs_change && i + 1 < count) {
+      Deselect();
+    }
+
+    // Words are stored in 1, 2 or 4 bytes of memory. Dual and quad
+    // transfers move 2 or 4 bits per clock.
+    uint64_t wordBytes = wordBits <= 8 ? 1 : (wordBits <= 16 ? 2 : 4);
+    uint64_t words = tr.len / wordBytes;
+    uint64_t lines = tr.rx_buf ? (tr.rx_nbits > 1 ? tr.rx_nbits : 1) : (tr.tx_nbits > 1 ? tr.tx_nbits : 1);
+
+    busNs += words * wordBits * NS_PER_SEC / (hz * lines);
+    busNs += words * tr.word_delay_usecs * 1000ull;
+    busNs += tr.delay_usecs * 1000ull;
+  }
+
+  // cs_change on the last transfer keeps CS asserted into the next message
+  if (!transfers[count - 1].cs_change) {
+    Deselect();
+  }
+
+  SleepUntil(start + busNs);
+
+  return static_cast<int>(total);
+}
@@ -0,0 +1,151 @@
+#ifndef SPI_BACKEND_H
+#define SPI_BACKEND_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <linux/spi/spidev.h>
+
+// ARCH_DMA_MINALIGN of the kernel, which user space cannot query: the
+// arm64 value, the L1 line of 32 bit ARM and RISC-V boards, and the
+// alignment of unsigned long long on x86. Overestimating it only costs
+// an extra split, underestimating it an EMSGSIZE.
+#if defined(__aarch64__)
+constexpr size_t SPI_DMA_MINALIGN = 128;
+#elif defined(__x86_64__) || defined(__i386__)
+constexpr size_t SPI_DMA_MINALIGN = 8;
+#else
+constexpr size_t SPI_DMA_MINALIGN = 64;
+#endif
+
+// Bounce buffer use of a message the way spidev counts it against its
+// bufsiz: every transfer takes its length rounded up to SPI_DMA_MINALIGN,
+// separately in the tx and in the rx buffer.
+struct SPIBufsizUse {
+  size_t tx = 0;
+  size_t rx = 0;
+
+  static size_t Align(size_t len) {
+    return (len + SPI_DMA_MINALIGN - 1) & ~(SPI_DMA_MINALIGN - 1);
+  }
+
+  void Add(const struct spi_ioc_transfer& tr) {
+    tx += tr.tx_buf ? Align(tr.len) : 0;
+    rx += tr.rx_buf ? Align(tr.len) : 0;
+  }
+
+  void Add(const struct spi_ioc_transfer* transfers, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+      Add(transfers[i]);
+    }
+  }
+
+  bool Fits(size_t bufsiz) const {
+    return tx <= bufsiz && rx <= bufsiz;
+  }
+};
+
+// Where the ioctls of an SPIDevice go. All calls are made with the device
+// mutex held, so implementations need no locking of their own.
+class SPIBackend {
+
+public:
+  virtual ~SPIBackend() = default;
+
+  // Same contract as ioctl(2): returns -1 and sets errno on failure
+  virtual int Ioctl(unsigned long request, void* arg) = 0;
+};
+
+// The spidev character device (default)
+class SPIKernelBackend : public SPIBackend {
+
+public:
+  explicit SPIKernelBackend(int fd) : fd(fd) {}
+  ~SPIKernelBackend() override;
+
+  int Ioctl(unsigned long request, void* arg) override;
+
+private:
+  int fd;
+};
+
+// Left behind by SPIDevice::detach(): every ioctl fails with EBADF
+class SPIDetachedBackend : public SPIBackend {
+
+public:
+  int Ioctl(unsigned long request, void* arg) override;
+};
+
+// In-process loopback emulator (`backend: 'loopback'`): MOSI is wired to
+// MISO, so rx receives the tx bytes (zeros for receive only transfers).
+// Each SPI_IOC_MESSAGE takes the time the bus would need, modeled from
+// speed_hz, bits_per_word, word_delay_usecs and delay_usecs, so queueing
+// and throughput can be measured and regression tested without hardware.
+class SPILoopbackBackend : public SPIBackend {
+
+public:
+  explicit SPILoopbackBackend(size_t bufsiz) : bufsiz(bufsiz) {}
+
+  int Ioctl(unsigned long request, void* arg) override;
+
+protected:
+  // Data of one transfer while CS is asserted, tx to rx by default
+  virtual void Exchange(const struct spi_ioc_transfer& tr);
+
+  // CS deasserted: after a cs_change transfer, or at the end of a message
+  // unless its last transfer has cs_change set
+  virtual void Deselect() {}
+
+private:
+  size_t bufsiz;  // messages over it (SPIBufsizUse) fail with EMSGSIZE, like spidev
+  uint32_t mode = 0;
+  uint8_t bits = 8;
+  uint32_t speed = 500000;
+
+  int Message(const struct spi_ioc_transfer* transfers, size_t count);
+};
+
+// Emulated SPI NOR flash (`backend: 'flash'`) on the loopback bus timing.
+// Answers the JEDEC commands SPIFlash uses: RDID, RDSFDP, RDSR, WREN/WRDI,
+// (fast) reads in 1, 2 and 4 bit variants, page program and sector, block
+// and chip erase, in 3 and 4 byte address variants. Program and erase
+// keep WIP set for a shortened but realistic time, so status polling is
+// exercised. Programming only clears bits, like real NOR cells.
+class SPIFlashBackend : public SPILoopbackBackend {
+
+public:
+  SPIFlashBackend(size_t bufsiz, size_t size);
+
+protected:
+  void Exchange(const struct spi_ioc_transfer& tr) override;
+  void Deselect() override;
+
+private:
+  enum Phase { PHASE_OPCODE, PHASE_HEADER, PHASE_DATA, PHASE_IGNORE };
+
+  static const size_t PAGE_SIZE = 256;
+
+  std::vector<uint8_t> memory;
+  std::vector<uint8_t> sfdp;
+  uint8_t jedecId[3];
+  bool writeEnabled = false;
+  bool address4 = false;      // EN4B: 4 byte addresses for the 3 byte opcodes
+  uint64_t busyUntilNs = 0;   // WIP is set until then
+
+  // Command between select and deselect
+  Phase phase = PHASE_OPCODE;
+  uint8_t opcode = 0;
+  uint8_t header[5];
+  size_t headerLen = 0;
+  size_t headerNeeded = 0;    // address and dummy bytes
+  size_t addressBytes = 0;
+  uint32_t address = 0;
+  size_t dataCount = 0;       // data bytes since the header
+
+  bool Busy() const;
+  void Start(uint8_t op);
+  void Data(const uint8_t* tx, uint8_t* rx, size_t len);
+  void Erase(uint32_t start, size_t size, uint64_t busyNs);
+};
+
+#endif
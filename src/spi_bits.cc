@@ -1,25 +1,34 @@
 #include "spi_device.h"
 #include <sys/ioctl.h>
 #include <linux/spi/spidev.h>  // For SPI_IOC_WR_MODE etc
+#include <cerrno>
 
-void SPIDevice::SetBitsPerWordInternal(uint8_t bits) {
-  uint8_t read_bits = 0;
-  IoctlOrThrow(SPI_IOC_RD_BITS_PER_WORD, &read_bits, "SPI_IOC_RD_BITS_PER_WORD");
+// Caller holds the mutex. No ioctl when the shadow already has the bits.
+int SPIDevice::WriteBitsPerWord(uint8_t bits) {
+  if (bits == shadowBits.load(std::memory_order_relaxed)) {
+    return 0;
+  }
+
+  if (backend->Ioctl(SPI_IOC_WR_BITS_PER_WORD, &bits) == -1) {
+    return errno;
+  }
 
-  if (Env().IsExceptionPending()){
-    return;
-  }// stop on error
+  shadowBits.store(bits, std::memory_order_relaxed);
+  return 0;
+}
+
+void SPIDevice::SetBitsPerWordInternal(uint8_t bits) {
+  int err = WriteBitsPerWord(bits);
 
-  if (read_bits != bits) {
-    IoctlOrThrow(SPI_IOC_WR_BITS_PER_WORD, &bits, "SPI_IOC_WR_BITS_PER_WORD");
+  if (err != 0) {
+    Napi::Error::New(Env(), std::string("SPI_IOC_WR_BITS_PER_WORD failed: ") + strerror(err))
+      .ThrowAsJavaScriptException();
   }
 }
 
 Napi::Value SPIDevice::SetBitsPerWord(const Napi::CallbackInfo& info) {
   Napi::Env env = info.Env();
 
-  SPI_LOCK_GUARD;
-
   if (info.Length() < 1 || !info[0].IsNumber()) {
     Napi::TypeError::New(env, "Bits per word (usually 8) expected")
       .ThrowAsJavaScriptException();
@@ -30,22 +39,22 @@ Napi::Value SPIDevice::SetBitsPerWord(const Napi::CallbackInfo& info) {
 
   ValidateBitsPerWord(env, bits);
 
-  SetBitsPerWordInternal(static_cast<uint8_t>(bits));
-
-  return env.IsExceptionPending() ? env.Null() : env.Undefined();
-}
+  if (env.IsExceptionPending()) {
+    return env.Null();
+  }
 
-Napi::Value SPIDevice::GetBitsPerWord(const Napi::CallbackInfo& info) {
-  Napi::Env env = info.Env();
+  // Unchanged: no need to wait for the mutex
+  if (bits == shadowBits.load(std::memory_order_relaxed)) {
+    return env.Undefined();
+  }
 
   SPI_LOCK_GUARD;
 
-  uint8_t bits;
-  IoctlOrThrow(SPI_IOC_RD_BITS_PER_WORD, &bits, "SPI_IOC_RD_BITS_PER_WORD");
+  SetBitsPerWordInternal(static_cast<uint8_t>(bits));
 
-  if (env.IsExceptionPending()){
-    return env.Null();
-  }
+  return env.IsExceptionPending() ? env.Null() : env.Undefined();
+}
 
-  return Napi::Number::New(env, bits);
-}
\ No newline at end of file
+Napi::Value SPIDevice::GetBitsPerWord(const Napi::CallbackInfo& info) {
+  return Napi::Number::New(info.Env(), shadowBits.load(std::memory_order_relaxed));
+}
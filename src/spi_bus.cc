@@ -0,0 +1,506 @@
+#include "spi_bus.h"
+#include "spi_addon.h"
+#include <algorithm>
+#include <chrono>
+
+Napi::Object SPIBus::Init(Napi::Env env, Napi::Object exports) {
+  Napi::Function func = DefineClass(env, "SPIBus", {
+    InstanceMethod("add", &SPIBus::Add),
+    InstanceMethod("remove", &SPIBus::Remove)
+  });
+
+  SPIAddon::Get(env)->bus = Napi::Persistent(func);
+
+  exports.Set("SPIBus", func);
+  return exports;
+}
+
+SPIBus::SPIBus(const Napi::CallbackInfo& info)
+  : Napi::ObjectWrap<SPIBus>(info) {
+
+  Napi::Env env = info.Env();
+  SPIIoThread::Options threadOptions;
+
+  if (info.Length() >= 1 && info[0].IsObject()) {
+    Napi::Object options = info[0].As<Napi::Object>();
+
+    if (options.Has("policy")) {
+      Napi::Value val = options.Get("policy");
+      std::string name = val.IsString() ? val.As<Napi::String>().Utf8Value() : "";
+
+      if (name != "fair" && name != "priority") {
+        throw Napi::TypeError::New(env, "'policy' must be 'fair' or 'priority'");
+      }
+
+      policy = name == "priority" ? PRIORITY : FAIR;
+    }
+
+    if (options.Has("thread")) {
+      threadOptions = SPIIoThread::ParseOptions(options.Get("thread"), "thread");
+    }
+  }
+
+  completions = CompletionTsfn::New(env, "SPIBus", 0, 1, this);
+  completions.Unref(env);  // only keep the event loop alive while jobs are pending
+
+  thread = std::thread(&SPIBus::Run, this);
+
+  std::string err = SPIIoThread::ApplyOptions(thread, threadOptions, "bus thread");
+
+  if (!err.empty()) {
+    Stop();
+    throw Napi::Error::New(env, err);
+  }
+}
+
+SPIBus::~SPIBus() {
+  Stop();
+
+  // Devices that outlive the bus go back to their own queue
+  for (std::unique_ptr<Member>& member : members) {
+    member->device->bus = nullptr;
+    member->device->busRef.Reset();
+  }
+}
+
+void SPIBus::Stop() {
+  if (!thread.joinable()) {
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+
+  ready.notify_one();
+  thread.join();
+
+  completions.Release();
+}
+
+// bus.add(device, { weight, priority, bandwidth })
+Napi::Value SPIBus::Add(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1 || !info[0].IsObject()) {
+    Napi::TypeError::New(env, "SPIDevice expected")
+      .ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  Napi::Object deviceObj = info[0].As<Napi::Object>();
+  SPIDevice* device;
+
+  try {
+    device = SPIDevice::Unwrap(deviceObj);
+  }
+  catch (const Napi::Error&) {
+    throw Napi::TypeError::New(env, "SPIDevice expected");
+  }
+
+  if (device == nullptr) {
+    throw Napi::TypeError::New(env, "SPIDevice expected");
+  }
+
+  if (device->bus != nullptr) {
+    throw Napi::Error::New(env, "SPIDevice is already on a bus");
+  }
+
+  if (device->ioThread) {
+    throw Napi::Error::New(env, "SPIDevice with an io_thread can not be added to a bus");
+  }
+
+  // Threadpool jobs share the device's preempt hook with the bus thread
+  if (device->pendingJobs > 0) {
+    throw Napi::Error::New(env, "SPIDevice has pending transfers, add it to the bus after they settle");
+  }
+
+  std::unique_ptr<Member> member(new Member());
+  member->device = device;
+  device->realtimeUsed = device->realtimeUsed || realtimeUsed;
+
+  if (info.Length() >= 2 && info[1].IsObject()) {
+    Napi::Object options = info[1].As<Napi::Object>();
+
+    if (options.Has("weight")) {
+      if (!options.Get("weight").IsNumber()) {
+        throw Napi::TypeError::New(env, "'weight' must be a number");
+      }
+
+      int64_t weight = options.Get("weight").As<Napi::Number>().Int64Value();
+
+      if (weight < 1 || weight > UINT32_MAX) {
+        throw Napi::RangeError::New(env, "'weight' must be a positive integer");
+      }
+
+      member->weight = static_cast<uint32_t>(weight);
+    }
+
+    if (options.Has("priority")) {
+      if (!options.Get("priority").IsNumber()) {
+        throw Napi::TypeError::New(env, "'priority' must be a number");
+      }
+
+      member->priority = options.Get("priority").As<Napi::Number>().Int32Value();
+    }
+
+    if (options.Has("bandwidth")) {
+      if (!options.Get("bandwidth").IsNumber()) {
+        throw Napi::TypeError::New(env, "'bandwidth' must be a number");
+      }
+
+      double bandwidth = options.Get("bandwidth").As<Napi::Number>().DoubleValue();
+
+      if (!(bandwidth >= 0)) {
+        throw Napi::RangeError::New(env, "'bandwidth' must be 0 (no budget) or bytes per second");
+      }
+
+      // Allow a burst of 100 ms, but at least one full ioctl
+      member->bandwidth = bandwidth;
+      member->burst = std::max(bandwidth / 10, static_cast<double>(device->bufsiz));
+      member->tokens = member->burst;
+      member->refilledNs = SPIStats::Now();
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    member->finish = virtualTime;
+    members.push_back(std::move(member));
+  }
+
+  device->bus = this;
+  device->busRef = Napi::Persistent(Value());
+
+  return env.Undefined();
+}
+
+Napi::Value SPIBus::Remove(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1 || !info[0].IsObject()) {
+    Napi::TypeError::New(env, "SPIDevice expected")
+      .ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  SPIDevice* device = nullptr;
+
+  try {
+    device = SPIDevice::Unwrap(info[0].As<Napi::Object>());
+  }
+  catch (const Napi::Error&) {
+    throw Napi::TypeError::New(env, "SPIDevice expected");
+  }
+
+  Member* member = device != nullptr && device->bus == this ? Find(device) : nullptr;
+
+  if (member == nullptr) {
+    throw Napi::Error::New(env, "SPIDevice is not on this bus");
+  }
+
+  if (member->pending > 0) {
+    throw Napi::Error::New(env, "SPIDevice has pending transfers on the bus");
+  }
+
+  Detach(device);
+  device->bus = nullptr;
+  device->busRef.Reset();
+
+  return env.Undefined();
+}
+
+SPIBus::Member* SPIBus::Find(SPIDevice* device) {
+  for (std::unique_ptr<Member>& member : members) {
+    if (member->device == device) {
+      return member.get();
+    }
+  }
+
+  return nullptr;
+}
+
+void SPIBus::Detach(SPIDevice* device) {
+  std::lock_guard<std::mutex> lock(mutex);
+
+  members.erase(std::remove_if(members.begin(), members.end(),
+    [device](const std::unique_ptr<Member>& member) { return member->device == device; }),
+    members.end());
+}
+
+size_t SPIBus::Cost(SPIDevice::Job* job) {
+  size_t cost = JOB_COST;
+  std::vector<spi_ioc_transfer>* transfers = job->Transfers();
+
+  if (transfers != nullptr) {
+    for (const spi_ioc_transfer& tr : *transfers) {
+      cost += tr.len;
+    }
+  }
+
+  return cost;
+}
+
+void SPIBus::Refill(Member& member, uint64_t now) {
+  double elapsed = static_cast<double>(now - member.refilledNs) / 1e9;
+  member.tokens = std::min(member.burst, member.tokens + elapsed * member.bandwidth);
+  member.refilledNs = now;
+}
+
+void SPIBus::Submit(Napi::Env env, SPIDevice* device, SPIDevice::Job* job) {
+  Member* member;
+  size_t cost = Cost(job);
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    member = Find(device);
+
+    // Start-time fair queuing: a device that was idle starts at the
+    // current virtual time, a busy one after its previous job.
+    Entry entry = { job, std::max(virtualTime, member->finish), cost };
+    member->finish = entry.start + static_cast<double>(cost) / member->weight;
+    member->queue[job->lane].push_back(entry);
+
+    // Bulk jobs on any CS yield to realtime jobs from now on
+    if (job->lane == SPIDevice::LANE_REALTIME) {
+      realtimeQueued.fetch_add(1, std::memory_order_release);
+
+      if (!realtimeUsed) {
+        realtimeUsed = true;
+
+        for (std::unique_ptr<Member>& other : members) {
+          other->device->realtimeUsed = true;
+        }
+      }
+    }
+  }
+
+  ready.notify_one();
+
+  member->pending++;
+
+  if (pending++ == 0) {
+    completions.Ref(env);
+  }
+}
+
+// Caller holds the mutex. Returns the member to serve next in the lane,
+// or nullptr with waitNs set when its queued work is over budget.
+SPIBus::Member* SPIBus::Pick(SPIDevice::Lane lane, uint64_t now, uint64_t& waitNs) {
+  Member* best = nullptr;
+
+  for (std::unique_ptr<Member>& member : members) {
+    std::deque<Entry>& queue = member->queue[lane];
+
+    if (queue.empty()) {
+      continue;
+    }
+
+    if (member->bandwidth > 0) {
+      Refill(*member, now);
+
+      if (member->tokens <= 0) {
+        uint64_t ns = static_cast<uint64_t>(-member->tokens / member->bandwidth * 1e9) + 1;
+        waitNs = waitNs == 0 ? ns : std::min(waitNs, ns);
+        continue;
+      }
+    }
+
+    if (best == nullptr ||
+        (policy == PRIORITY && member->priority > best->priority) ||
+        ((policy == FAIR || member->priority == best->priority) &&
+          queue.front().start < best->queue[lane].front().start)) {
+      best = member.get();
+    }
+  }
+
+  return best;
+}
+
+void SPIBus::Run() {
+  std::unique_lock<std::mutex> lock(mutex);
+
+  for (;;) {
+    if (stopping) {
+      return;
+    }
+
+    uint64_t now = SPIStats::Now();
+    uint64_t waitNs = 0;
+    SPIDevice::Lane lane = SPIDevice::LANE_REALTIME;
+    Member* member = Pick(lane, now, waitNs);
+
+    if (member == nullptr) {
+      lane = SPIDevice::LANE_BULK;
+      member = Pick(lane, now, waitNs);
+    }
+
+    if (member == nullptr) {
+      if (waitNs > 0) {
+        ready.wait_for(lock, std::chrono::nanoseconds(waitNs));
+      }
+      else {
+        ready.wait(lock);
+      }
+      continue;
+    }
+
+    Entry entry = Take(*member, lane);
+
+    // The device stays alive, it is referenced while the job is pending
+    SPIDevice* device = member->device;
+    lock.unlock();
+
+    {
+      std::unique_lock<std::mutex> deviceLock(device->mutex);
+      SPIDevice::ExecutorScope scope(device, deviceLock);
+
+      // Called from YieldToRealtime() where the bulk job released CS
+      if (lane == SPIDevice::LANE_BULK) {
+        device->preempt = [this, device] { RunRealtime(device); };
+      }
+
+      device->ExecuteJob(entry.job);
+      device->preempt = nullptr;
+    }
+
+    completions.BlockingCall(entry.job);
+
+    lock.lock();
+  }
+}
+
+// Caller holds the mutex. Dequeues the next job of the member and
+// charges it to the fair queuing clock and the bandwidth budget.
+SPIBus::Entry SPIBus::Take(Member& member, SPIDevice::Lane lane) {
+  Entry entry = member.queue[lane].front();
+  member.queue[lane].pop_front();
+
+  if (lane == SPIDevice::LANE_REALTIME) {
+    realtimeQueued.fetch_sub(1, std::memory_order_release);
+    member.device->realtimeQueued.fetch_sub(1, std::memory_order_release);
+  }
+
+  if (entry.job->Aborted()) {
+    // Aborted after Unlink() missed it: never reaches the bus
+    Refund(member, entry);
+    return entry;
+  }
+
+  virtualTime = entry.start;
+
+  if (member.bandwidth > 0) {
+    member.tokens -= static_cast<double>(entry.cost);
+  }
+
+  return entry;
+}
+
+// Caller holds the mutex. Gives the share of a job that never reaches
+// the bus back to the later jobs of the member.
+void SPIBus::Refund(Member& member, const Entry& entry) {
+  double share = static_cast<double>(entry.cost) / member.weight;
+
+  for (std::deque<Entry>& queue : member.queue) {
+    for (Entry& later : queue) {
+      if (later.start > entry.start) {
+        later.start = std::max(virtualTime, later.start - share);
+      }
+    }
+  }
+
+  member.finish = std::max(virtualTime, member.finish - share);
+}
+
+// JS thread. Takes an aborted job off its member's queue, false when
+// the bus thread has taken it already.
+bool SPIBus::Unlink(Napi::Env env, SPIDevice* device, SPIDevice::Job* job) {
+  Member* member;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    member = Find(device);
+
+    if (member == nullptr) {
+      return false;
+    }
+
+    std::deque<Entry>& queue = member->queue[job->lane];
+    auto it = std::find_if(queue.begin(), queue.end(),
+      [job](const Entry& entry) { return entry.job == job; });
+
+    if (it == queue.end()) {
+      return false;
+    }
+
+    Entry entry = *it;
+    queue.erase(it);
+
+    if (job->lane == SPIDevice::LANE_REALTIME) {
+      realtimeQueued.fetch_sub(1, std::memory_order_release);
+      device->realtimeQueued.fetch_sub(1, std::memory_order_release);
+    }
+
+    Refund(*member, entry);
+  }
+
+  member->pending--;
+
+  if (--pending == 0) {
+    completions.Unref(env);
+  }
+
+  return true;
+}
+
+// Runs the waiting realtime jobs of all devices from inside a bulk job
+// of `current`, whose mutex is held and whose CS is released.
+void SPIBus::RunRealtime(SPIDevice* current) {
+  std::unique_lock<std::mutex> lock(mutex);
+  uint64_t waitNs = 0;
+  Member* member;
+
+  // Over budget realtime jobs wait for the next regular pick
+  while ((member = Pick(SPIDevice::LANE_REALTIME, SPIStats::Now(), waitNs)) != nullptr) {
+    Entry entry = Take(*member, SPIDevice::LANE_REALTIME);
+    SPIDevice* device = member->device;
+    lock.unlock();
+
+    if (device == current) {
+      device->ExecuteJob(entry.job);
+    }
+    else {
+      std::unique_lock<std::mutex> deviceLock(device->mutex);
+      SPIDevice::ExecutorScope scope(device, deviceLock);
+      device->ExecuteJob(entry.job);
+    }
+
+    completions.BlockingCall(entry.job);
+
+    lock.lock();
+  }
+}
+
+void SPIBus::CallJs(Napi::Env env, Napi::Function,
+    SPIBus* context, SPIDevice::Job* job) {
+
+  if (env == nullptr) {
+    // Environment is shutting down
+    delete job;
+    return;
+  }
+
+  SPIDevice* device = job->device;
+  Member* member = context->Find(device);
+
+  if (member != nullptr) {
+    member->pending--;
+  }
+
+  if (--context->pending == 0) {
+    context->completions.Unref(env);
+  }
+
+  device->CompleteJob(env, job);
+}
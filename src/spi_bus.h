@@ -0,0 +1,95 @@
+#ifndef SPI_BUS_H
+#define SPI_BUS_H
+
+#include "spi_device.h"
+#include "spi_io_thread.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// Schedules the transfers of several SPIDevices (chip selects) that share
+// one controller on a single thread, instead of letting them race for the
+// bus from separate threadpool threads.
+//
+// Jobs are ordered by start-time fair queuing: each device gets a share of
+// the bus in proportion to its weight, measured in bytes. With the
+// 'priority' policy a device with a higher priority always goes first,
+// fair queuing only breaks ties. A device can be capped to a bandwidth
+// budget (token bucket); the bus keeps serving the other devices meanwhile.
+// Realtime jobs of any device go before all bulk jobs, and run inside a
+// bulk job of another device wherever it releases CS (see
+// SPIDevice::YieldToRealtime()).
+class SPIBus : public Napi::ObjectWrap<SPIBus> {
+  friend class SPIDevice;
+
+public:
+  static Napi::Object Init(Napi::Env env, Napi::Object exports);
+  SPIBus(const Napi::CallbackInfo& info);
+  ~SPIBus();
+
+  Napi::Value Add(const Napi::CallbackInfo& info);
+  Napi::Value Remove(const Napi::CallbackInfo& info);
+
+private:
+  enum Policy { FAIR, PRIORITY };
+
+  // Bytes charged per job on top of the transferred bytes
+  static const size_t JOB_COST = 32;
+
+  struct Entry {
+    SPIDevice::Job* job;
+    double start;  // virtual start tag
+    size_t cost;
+  };
+
+  struct Member {
+    SPIDevice* device;
+    uint32_t weight = 1;
+    int32_t priority = 0;
+    double bandwidth = 0;  // bytes per second, 0 for no budget
+    double burst = 0;      // token bucket size in bytes
+    double tokens = 0;
+    uint64_t refilledNs = 0;
+    double finish = 0;     // virtual finish tag of the last queued job
+    std::deque<Entry> queue[SPIDevice::LANE_COUNT];
+    size_t pending = 0;    // queued or completing, JS thread only
+  };
+
+  static void CallJs(Napi::Env env, Napi::Function callback,
+    SPIBus* context, SPIDevice::Job* job);
+
+  using CompletionTsfn = Napi::TypedThreadSafeFunction<SPIBus, SPIDevice::Job, CallJs>;
+
+  Policy policy = FAIR;
+  CompletionTsfn completions;
+  std::vector<std::unique_ptr<Member>> members;  // guarded by mutex
+  std::mutex mutex;
+  std::condition_variable ready;
+  double virtualTime = 0;  // start tag of the job in service
+  bool stopping = false;   // guarded by mutex
+  size_t pending = 0;      // JS thread only
+  bool realtimeUsed = false;  // JS thread, bulk jobs of all members are split from then on
+  std::atomic<size_t> realtimeQueued{0};  // realtime jobs waiting, all members
+  std::thread thread;
+
+  Member* Find(SPIDevice* device);
+  Member* Pick(SPIDevice::Lane lane, uint64_t now, uint64_t& waitNs);
+  Entry Take(Member& member, SPIDevice::Lane lane);
+  void Refund(Member& member, const Entry& entry);
+  static size_t Cost(SPIDevice::Job* job);
+  static void Refill(Member& member, uint64_t now);
+
+  // JS thread
+  void Submit(Napi::Env env, SPIDevice* device, SPIDevice::Job* job);
+  bool Unlink(Napi::Env env, SPIDevice* device, SPIDevice::Job* job);
+  void Detach(SPIDevice* device);
+
+  void Run();
+  void RunRealtime(SPIDevice* current);
+  void Stop();
+};
+
+#endif
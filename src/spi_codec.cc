@@ -0,0 +1,500 @@
+#include "spi_codec.h"
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define SPI_CODEC_SSE2 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define SPI_CODEC_NEON 1
+#endif
+
+namespace {
+  uint32_t LoadWord(const uint8_t* p, unsigned bytes, bool bigEndian) {
+    uint32_t word = 0;
+
+    if (bigEndian) {
+      for (unsigned i = 0; i < bytes; i++) {
+        word = word << 8 | p[i];
+      }
+    }
+    else {
+      for (unsigned i = bytes; i-- > 0;) {
+        word = word << 8 | p[i];
+      }
+    }
+
+    return word;
+  }
+
+  void StoreWord(uint8_t* p, uint32_t word, unsigned bytes, bool bigEndian) {
+    if (bigEndian) {
+      for (unsigned i = bytes; i-- > 0;) {
+        p[i] = static_cast<uint8_t>(word);
+        word >>= 8;
+      }
+    }
+    else {
+      for (unsigned i = 0; i < bytes; i++) {
+        p[i] = static_cast<uint8_t>(word);
+        word >>= 8;
+      }
+    }
+  }
+
+  uint32_t SampleMask(unsigned bits) {
+    return bits >= 32 ? 0xffffffffu : (1u << bits) - 1;
+  }
+
+  int64_t Extract(uint32_t word, const SPIWordFormat& f) {
+    uint32_t sample = (word >> f.shift) & SampleMask(f.bits);
+
+    if (f.isSigned) {
+      unsigned pad = 32 - f.bits;
+      return static_cast<int32_t>(sample << pad) >> pad;
+    }
+
+    return sample;
+  }
+
+  uint32_t Insert(int64_t sample, const SPIWordFormat& f) {
+    return (static_cast<uint32_t>(sample) & SampleMask(f.bits)) << f.shift;
+  }
+
+  // Float samples are scaled back, rounded to nearest and saturated
+  // to the sample range. NaN encodes as 0.
+  int64_t Quantize(float value, const SPIWordFormat& f) {
+    double x = value / f.scale;  // divided in float, like the vector path
+
+    if (std::isnan(x)) {
+      return 0;
+    }
+
+    double lo = f.isSigned ? -std::ldexp(1.0, f.bits - 1) : 0.0;
+    double hi = f.isSigned ? std::ldexp(1.0, f.bits - 1) - 1 : std::ldexp(1.0, f.bits) - 1;
+
+    return static_cast<int64_t>(std::nearbyint(x < lo ? lo : x > hi ? hi : x));
+  }
+
+  template <typename T>
+  void DecodeScalar(const uint8_t* src, T* dst, size_t i, size_t count, const SPIWordFormat& f) {
+    for (; i < count; i++) {
+      int64_t sample = Extract(LoadWord(src + i * f.bytes, f.bytes, f.bigEndian), f);
+      dst[i] = static_cast<T>(sample);
+    }
+  }
+
+  template <>
+  void DecodeScalar(const uint8_t* src, float* dst, size_t i, size_t count, const SPIWordFormat& f) {
+    for (; i < count; i++) {
+      int64_t sample = Extract(LoadWord(src + i * f.bytes, f.bytes, f.bigEndian), f);
+      dst[i] = static_cast<float>(sample) * f.scale;
+    }
+  }
+
+  template <typename T>
+  void EncodeScalar(const T* src, uint8_t* dst, size_t i, size_t count, const SPIWordFormat& f) {
+    for (; i < count; i++) {
+      StoreWord(dst + i * f.bytes, Insert(src[i], f), f.bytes, f.bigEndian);
+    }
+  }
+
+  template <>
+  void EncodeScalar(const float* src, uint8_t* dst, size_t i, size_t count, const SPIWordFormat& f) {
+    for (; i < count; i++) {
+      StoreWord(dst + i * f.bytes, Insert(Quantize(src[i], f), f), f.bytes, f.bigEndian);
+    }
+  }
+
+  // Float range of the samples, exact for up to 24 bit samples
+  float SampleMin(const SPIWordFormat& f) {
+    return f.isSigned ? -std::ldexp(1.0f, f.bits - 1) : 0.0f;
+  }
+
+  float SampleMax(const SPIWordFormat& f) {
+    return f.isSigned ? std::ldexp(1.0f, f.bits - 1) - 1 : std::ldexp(1.0f, f.bits) - 1;
+  }
+
+#if SPI_CODEC_SSE2
+  __m128i Swap16(__m128i x) {
+    return _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+  }
+
+  __m128i Swap32(__m128i x) {
+    const __m128i mid = _mm_set1_epi32(0x0000ff00);
+    __m128i outer = _mm_or_si128(_mm_slli_epi32(x, 24), _mm_srli_epi32(x, 24));
+    __m128i inner = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(x, mid), 8),
+      _mm_and_si128(_mm_srli_epi32(x, 8), mid));
+    return _mm_or_si128(outer, inner);
+  }
+
+  __m128i Quantize4(__m128 x, const SPIWordFormat& f) {
+    x = _mm_div_ps(x, _mm_set1_ps(f.scale));
+    x = _mm_and_ps(x, _mm_cmpord_ps(x, x));  // NaN to 0
+    x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(SampleMin(f))), _mm_set1_ps(SampleMax(f)));
+    return _mm_cvtps_epi32(x);  // round to nearest even
+  }
+
+  // 2 byte words, 8 per iteration. Returns the number converted.
+  size_t Decode16(const uint8_t* src, void* dst, size_t count, const SPIWordFormat& f) {
+    const __m128i up = _mm_cvtsi32_si128(16 - f.bits - f.shift);
+    const __m128i down = _mm_cvtsi32_si128(16 - f.bits);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 scale = _mm_set1_ps(f.scale);
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+      __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 2));
+
+      if (f.bigEndian) {
+        x = Swap16(x);
+      }
+
+      // Sample to the top of the lane, then back down with sign extension
+      x = _mm_sll_epi16(x, up);
+      x = f.isSigned ? _mm_sra_epi16(x, down) : _mm_srl_epi16(x, down);
+
+      if (f.type == SPIWordFormat::INT16) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(static_cast<int16_t*>(dst) + i), x);
+        continue;
+      }
+
+      __m128i lo = f.isSigned ? _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16) : _mm_unpacklo_epi16(x, zero);
+      __m128i hi = f.isSigned ? _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16) : _mm_unpackhi_epi16(x, zero);
+
+      if (f.type == SPIWordFormat::INT32) {
+        int32_t* out = static_cast<int32_t*>(dst) + i;
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), lo);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 4), hi);
+      }
+      else {
+        float* out = static_cast<float*>(dst) + i;
+        _mm_storeu_ps(out, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+        _mm_storeu_ps(out + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+      }
+    }
+
+    return i;
+  }
+
+  // 4 byte words into Int32Array or Float32Array, 4 per iteration
+  size_t Decode32(const uint8_t* src, void* dst, size_t count, const SPIWordFormat& f) {
+    const __m128i up = _mm_cvtsi32_si128(32 - f.bits - f.shift);
+    const __m128i down = _mm_cvtsi32_si128(32 - f.bits);
+    const __m128 scale = _mm_set1_ps(f.scale);
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+      __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 4));
+
+      if (f.bigEndian) {
+        x = Swap32(x);
+      }
+
+      x = _mm_sll_epi32(x, up);
+      x = f.isSigned ? _mm_sra_epi32(x, down) : _mm_srl_epi32(x, down);
+
+      if (f.type == SPIWordFormat::INT32) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(static_cast<int32_t*>(dst) + i), x);
+      }
+      else {
+        _mm_storeu_ps(static_cast<float*>(dst) + i, _mm_mul_ps(_mm_cvtepi32_ps(x), scale));
+      }
+    }
+
+    return i;
+  }
+
+  size_t Encode16(const void* src, uint8_t* dst, size_t count, const SPIWordFormat& f) {
+    const __m128i mask = _mm_set1_epi16(static_cast<int16_t>(SampleMask(f.bits)));
+    const __m128i shift = _mm_cvtsi32_si128(f.shift);
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+      __m128i x;
+
+      if (f.type == SPIWordFormat::INT16) {
+        x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(static_cast<const int16_t*>(src) + i));
+      }
+      else {
+        __m128i lo, hi;
+
+        if (f.type == SPIWordFormat::INT32) {
+          const int32_t* in = static_cast<const int32_t*>(src) + i;
+          lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+          hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 4));
+        }
+        else {
+          const float* in = static_cast<const float*>(src) + i;
+          lo = Quantize4(_mm_loadu_ps(in), f);
+          hi = Quantize4(_mm_loadu_ps(in + 4), f);
+        }
+
+        // Keep the low 16 bits: sign extend them so the saturating pack is exact
+        lo = _mm_srai_epi32(_mm_slli_epi32(lo, 16), 16);
+        hi = _mm_srai_epi32(_mm_slli_epi32(hi, 16), 16);
+        x = _mm_packs_epi32(lo, hi);
+      }
+
+      x = _mm_sll_epi16(_mm_and_si128(x, mask), shift);
+
+      if (f.bigEndian) {
+        x = Swap16(x);
+      }
+
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 2), x);
+    }
+
+    return i;
+  }
+
+  size_t Encode32(const void* src, uint8_t* dst, size_t count, const SPIWordFormat& f) {
+    const __m128i mask = _mm_set1_epi32(static_cast<int32_t>(SampleMask(f.bits)));
+    const __m128i shift = _mm_cvtsi32_si128(f.shift);
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+      __m128i x;
+
+      if (f.type == SPIWordFormat::INT16) {
+        x = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(static_cast<const int16_t*>(src) + i));
+        x = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+      }
+      else if (f.type == SPIWordFormat::INT32) {
+        x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(static_cast<const int32_t*>(src) + i));
+      }
+      else {
+        x = Quantize4(_mm_loadu_ps(static_cast<const float*>(src) + i), f);
+      }
+
+      x = _mm_sll_epi32(_mm_and_si128(x, mask), shift);
+
+      if (f.bigEndian) {
+        x = Swap32(x);
+      }
+
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4), x);
+    }
+
+    return i;
+  }
+#endif
+
+#if SPI_CODEC_NEON
+  int32x4_t Widen(int16x4_t x, bool isSigned) {
+    return isSigned
+      ? vmovl_s16(x)
+      : vreinterpretq_s32_u32(vmovl_u16(vreinterpret_u16_s16(x)));
+  }
+
+  size_t Decode16(const uint8_t* src, void* dst, size_t count, const SPIWordFormat& f) {
+    const int16x8_t up = vdupq_n_s16(static_cast<int16_t>(16 - f.bits - f.shift));
+    const int16x8_t down = vdupq_n_s16(static_cast<int16_t>(f.bits - 16));  // negative: right shift
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+      uint8x16_t bytes = vld1q_u8(src + i * 2);
+
+      if (f.bigEndian) {
+        bytes = vrev16q_u8(bytes);
+      }
+
+      uint16x8_t u = vshlq_u16(vreinterpretq_u16_u8(bytes), up);
+      int16x8_t x = f.isSigned
+        ? vshlq_s16(vreinterpretq_s16_u16(u), down)
+        : vreinterpretq_s16_u16(vshlq_u16(u, down));
+
+      if (f.type == SPIWordFormat::INT16) {
+        vst1q_s16(static_cast<int16_t*>(dst) + i, x);
+        continue;
+      }
+
+      int32x4_t lo = Widen(vget_low_s16(x), f.isSigned);
+      int32x4_t hi = Widen(vget_high_s16(x), f.isSigned);
+
+      if (f.type == SPIWordFormat::INT32) {
+        int32_t* out = static_cast<int32_t*>(dst) + i;
+        vst1q_s32(out, lo);
+        vst1q_s32(out + 4, hi);
+      }
+      else {
+        float* out = static_cast<float*>(dst) + i;
+        vst1q_f32(out, vmulq_n_f32(vcvtq_f32_s32(lo), f.scale));
+        vst1q_f32(out + 4, vmulq_n_f32(vcvtq_f32_s32(hi), f.scale));
+      }
+    }
+
+    return i;
+  }
+
+  size_t Decode32(const uint8_t* src, void* dst, size_t count, const SPIWordFormat& f) {
+    const int32x4_t up = vdupq_n_s32(32 - f.bits - f.shift);
+    const int32x4_t down = vdupq_n_s32(f.bits - 32);
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+      uint8x16_t bytes = vld1q_u8(src + i * 4);
+
+      if (f.bigEndian) {
+        bytes = vrev32q_u8(bytes);
+      }
+
+      uint32x4_t u = vshlq_u32(vreinterpretq_u32_u8(bytes), up);
+      int32x4_t x = f.isSigned
+        ? vshlq_s32(vreinterpretq_s32_u32(u), down)
+        : vreinterpretq_s32_u32(vshlq_u32(u, down));
+
+      if (f.type == SPIWordFormat::INT32) {
+        vst1q_s32(static_cast<int32_t*>(dst) + i, x);
+      }
+      else {
+        vst1q_f32(static_cast<float*>(dst) + i, vmulq_n_f32(vcvtq_f32_s32(x), f.scale));
+      }
+    }
+
+    return i;
+  }
+
+#if defined(__aarch64__)
+  int32x4_t Quantize4(float32x4_t x, const SPIWordFormat& f) {
+    x = vdivq_f32(x, vdupq_n_f32(f.scale));
+    x = vminq_f32(vmaxq_f32(x, vdupq_n_f32(SampleMin(f))), vdupq_n_f32(SampleMax(f)));
+    return vcvtnq_s32_f32(x);  // round to nearest even, NaN to 0
+  }
+#endif
+
+  size_t Encode16(const void* src, uint8_t* dst, size_t count, const SPIWordFormat& f) {
+    const uint16x8_t mask = vdupq_n_u16(static_cast<uint16_t>(SampleMask(f.bits)));
+    const int16x8_t shift = vdupq_n_s16(f.shift);
+    size_t i = 0;
+
+#if !defined(__aarch64__)
+    if (f.type == SPIWordFormat::FLOAT32) {
+      return 0;  // no round to nearest conversion on 32 bit ARM
+    }
+#endif
+
+    for (; i + 8 <= count; i += 8) {
+      int16x8_t x = vdupq_n_s16(0);
+
+      if (f.type == SPIWordFormat::INT16) {
+        x = vld1q_s16(static_cast<const int16_t*>(src) + i);
+      }
+      else if (f.type == SPIWordFormat::INT32) {
+        const int32_t* in = static_cast<const int32_t*>(src) + i;
+        x = vcombine_s16(vmovn_s32(vld1q_s32(in)), vmovn_s32(vld1q_s32(in + 4)));
+      }
+      else {
+#if defined(__aarch64__)
+        const float* in = static_cast<const float*>(src) + i;
+        x = vcombine_s16(vmovn_s32(Quantize4(vld1q_f32(in), f)),
+          vmovn_s32(Quantize4(vld1q_f32(in + 4), f)));
+#endif
+      }
+
+      uint16x8_t u = vshlq_u16(vandq_u16(vreinterpretq_u16_s16(x), mask), shift);
+      uint8x16_t bytes = vreinterpretq_u8_u16(u);
+
+      if (f.bigEndian) {
+        bytes = vrev16q_u8(bytes);
+      }
+
+      vst1q_u8(dst + i * 2, bytes);
+    }
+
+    return i;
+  }
+
+  size_t Encode32(const void* src, uint8_t* dst, size_t count, const SPIWordFormat& f) {
+    const uint32x4_t mask = vdupq_n_u32(SampleMask(f.bits));
+    const int32x4_t shift = vdupq_n_s32(f.shift);
+    size_t i = 0;
+
+#if !defined(__aarch64__)
+    if (f.type == SPIWordFormat::FLOAT32) {
+      return 0;
+    }
+#endif
+
+    for (; i + 4 <= count; i += 4) {
+      int32x4_t x = vdupq_n_s32(0);
+
+      if (f.type == SPIWordFormat::INT16) {
+        x = vmovl_s16(vld1_s16(static_cast<const int16_t*>(src) + i));
+      }
+      else if (f.type == SPIWordFormat::INT32) {
+        x = vld1q_s32(static_cast<const int32_t*>(src) + i);
+      }
+      else {
+#if defined(__aarch64__)
+        x = Quantize4(vld1q_f32(static_cast<const float*>(src) + i), f);
+#endif
+      }
+
+      uint32x4_t u = vshlq_u32(vandq_u32(vreinterpretq_u32_s32(x), mask), shift);
+      uint8x16_t bytes = vreinterpretq_u8_u32(u);
+
+      if (f.bigEndian) {
+        bytes = vrev32q_u8(bytes);
+      }
+
+      vst1q_u8(dst + i * 4, bytes);
+    }
+
+    return i;
+  }
+#endif
+}
+
+void SPICodec::Decode(const uint8_t* src, void* dst, size_t count, const SPIWordFormat& f) {
+  size_t i = 0;
+
+#if SPI_CODEC_SSE2 || SPI_CODEC_NEON
+  if (f.bytes == 2) {
+    i = Decode16(src, dst, count, f);
+  }
+  else if (f.bytes == 4 && f.type != SPIWordFormat::INT16 &&
+      !(f.type == SPIWordFormat::FLOAT32 && !f.isSigned && f.bits == 32)) {
+    // Unsigned 32 bit samples do not fit the signed int to float conversion
+    i = Decode32(src, dst, count, f);
+  }
+#endif
+
+  switch (f.type) {
+    case SPIWordFormat::INT16:
+      DecodeScalar(src, static_cast<int16_t*>(dst), i, count, f);
+      break;
+    case SPIWordFormat::INT32:
+      DecodeScalar(src, static_cast<int32_t*>(dst), i, count, f);
+      break;
+    case SPIWordFormat::FLOAT32:
+      DecodeScalar(src, static_cast<float*>(dst), i, count, f);
+      break;
+  }
+}
+
+void SPICodec::Encode(const void* src, uint8_t* dst, size_t count, const SPIWordFormat& f) {
+  size_t i = 0;
+
+#if SPI_CODEC_SSE2 || SPI_CODEC_NEON
+  if (f.bytes == 2) {
+    i = Encode16(src, dst, count, f);
+  }
+  else if (f.bytes == 4 && !(f.type == SPIWordFormat::FLOAT32 && f.bits > 24)) {
+    // Wider samples are not exact in float, they are quantized in double
+    i = Encode32(src, dst, count, f);
+  }
+#endif
+
+  switch (f.type) {
+    case SPIWordFormat::INT16:
+      EncodeScalar(static_cast<const int16_t*>(src), dst, i, count, f);
+      break;
+    case SPIWordFormat::INT32:
+      EncodeScalar(static_cast<const int32_t*>(src), dst, i, count, f);
+      break;
+    case SPIWordFormat::FLOAT32:
+      EncodeScalar(static_cast<const float*>(src), dst, i, count, f);
+      break;
+  }
+}
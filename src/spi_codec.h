@@ -0,0 +1,40 @@
+#ifndef SPI_CODEC_H
+#define SPI_CODEC_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Conversion between the SPI byte stream and caller typed arrays.
+// A word is `bytes` bytes on the wire (1-4), in big or little endian
+// order; the sample is `bits` wide and sits `shift` bits above the least
+// significant bit of the word. 16 and 32 bit words are converted with
+// SSE2 or NEON when the target has them, everything else and the tails
+// of the vector loops take the scalar path.
+struct SPIWordFormat {
+  enum Type { INT16, INT32, FLOAT32 };  // element type of the typed array
+
+  Type type = INT16;
+  uint8_t bytes = 2;
+  uint8_t bits = 16;
+  uint8_t shift = 0;
+  bool bigEndian = true;  // SPI shifts the most significant bit first
+  bool isSigned = true;
+  float scale = 1.0f;     // Float32Array: decoded value = sample * scale
+};
+
+// One conversion of a transfer: rx words into `data` (decode),
+// or `data` into the tx words (encode) before the ioctl.
+struct SPIWordOp {
+  size_t index;       // message in the batch
+  bool encode;
+  SPIWordFormat format;
+  void* data;         // typed array memory, pinned by the batch
+  size_t count;       // typed array length
+};
+
+namespace SPICodec {
+  void Decode(const uint8_t* src, void* dst, size_t count, const SPIWordFormat& format);
+  void Encode(const void* src, uint8_t* dst, size_t count, const SPIWordFormat& format);
+}
+
+#endif
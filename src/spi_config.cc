@@ -0,0 +1,93 @@
+#include "spi_device.h"
+#include <linux/spi/spidev.h>
+#include <cstring>
+
+// The set*Async() setters are queued like transfers, so they apply
+// after the transfers queued before them and before the ones queued
+// after them, and never wait for the mutex on the JS thread. The
+// validators either throw or leave a pending exception, both stop the
+// setter before a ConfigJob is queued.
+
+void SPIDevice::ConfigJob::Execute(SPIDevice* device) {
+  int err = 0;
+  const char* action = "";
+
+  switch (setting) {
+    case MODE:
+      err = device->WriteMode(static_cast<uint8_t>(value));
+      action = "SPI_IOC_WR_MODE";
+      break;
+    case MAX_SPEED_HZ:
+      err = device->WriteMaxSpeedHz(value);
+      action = "SPI_IOC_WR_MAX_SPEED_HZ";
+      break;
+    case BITS_PER_WORD:
+      err = device->WriteBitsPerWord(static_cast<uint8_t>(value));
+      action = "SPI_IOC_WR_BITS_PER_WORD";
+      break;
+  }
+
+  if (err != 0) {
+    error = std::string(action) + " failed: " + std::strerror(err);
+  }
+}
+
+Napi::Value SPIDevice::SetModeAsync(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1 || !info[0].IsNumber()) {
+    Napi::TypeError::New(env, "Mode number (0-3) expected")
+      .ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  uint32_t mode = info[0].As<Napi::Number>().Uint32Value();
+
+  ValidateMode(env, mode);
+
+  if (env.IsExceptionPending()) {
+    return env.Null();
+  }
+
+  return QueueJob(env, new ConfigJob(env, ConfigJob::MODE, mode));
+}
+
+Napi::Value SPIDevice::SetMaxSpeedHzAsync(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1 || !info[0].IsNumber()) {
+    Napi::TypeError::New(env, "Speed in Hz expected")
+      .ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  uint32_t speed = info[0].As<Napi::Number>().Uint32Value();
+
+  ValidateMaxSpeedHz(env, speed);
+
+  if (env.IsExceptionPending()) {
+    return env.Null();
+  }
+
+  return QueueJob(env, new ConfigJob(env, ConfigJob::MAX_SPEED_HZ, speed));
+}
+
+Napi::Value SPIDevice::SetBitsPerWordAsync(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1 || !info[0].IsNumber()) {
+    Napi::TypeError::New(env, "Bits per word (usually 8) expected")
+      .ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  uint32_t bits = info[0].As<Napi::Number>().Uint32Value();
+
+  ValidateBitsPerWord(env, bits);
+
+  if (env.IsExceptionPending()) {
+    return env.Null();
+  }
+
+  return QueueJob(env, new ConfigJob(env, ConfigJob::BITS_PER_WORD, bits));
+}
@@ -0,0 +1,170 @@
+#include "spi_crc.h"
+
+namespace {
+  uint32_t Reflect(uint32_t value, int bits) {
+    uint32_t out = 0;
+
+    for (int i = 0; i < bits; i++) {
+      out = (out << 1) | ((value >> i) & 1);
+    }
+
+    return out;
+  }
+
+  // Narrow CRCs run left aligned in an 8 bit register, so one table
+  // lookup per byte works for every width.
+  int RegisterBits(const SPICrcAlgorithm& a) {
+    return a.width < 8 ? 8 : a.width;
+  }
+
+  uint32_t Mask(int bits) {
+    return bits == 32 ? 0xffffffffu : (1u << bits) - 1;
+  }
+
+  void BuildTable(SPICrcAlgorithm& a) {
+    int bits = RegisterBits(a);
+    uint32_t mask = Mask(bits);
+
+    if (a.reflect) {
+      uint32_t poly = Reflect(a.poly, a.width);
+
+      for (uint32_t i = 0; i < 256; i++) {
+        uint32_t r = i;
+
+        for (int k = 0; k < 8; k++) {
+          r = (r & 1) ? (r >> 1) ^ poly : r >> 1;
+        }
+
+        a.table[i] = r;
+      }
+
+      return;
+    }
+
+    uint32_t poly = a.poly << (bits - a.width);
+    uint32_t top = 1u << (bits - 1);
+
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t r = i << (bits - 8);
+
+      for (int k = 0; k < 8; k++) {
+        r = (r & top) ? (r << 1) ^ poly : r << 1;
+      }
+
+      a.table[i] = r & mask;
+    }
+  }
+
+  struct Catalogue {
+    SPICrcAlgorithm algorithms[8] = {
+      { "crc7",           7,  0x09,       0x00,       false, 0x00,       {} },  // CRC-7/MMC, SD commands
+      { "crc8",           8,  0x07,       0x00,       false, 0x00,       {} },  // CRC-8/SMBUS
+      { "crc8-maxim",     8,  0x31,       0x00,       true,  0x00,       {} },  // Dallas / Maxim 1-Wire
+      { "crc8-sensirion", 8,  0x31,       0xff,       false, 0x00,       {} },  // Sensirion, CRC-8/NRSC-5
+      { "crc16-ccitt",    16, 0x1021,     0xffff,     false, 0x0000,     {} },  // CRC-16/IBM-3740
+      { "crc16-xmodem",   16, 0x1021,     0x0000,     false, 0x0000,     {} },  // SD data blocks
+      { "crc16-modbus",   16, 0x8005,     0xffff,     true,  0x0000,     {} },
+      { "crc32",          32, 0x04c11db7, 0xffffffff, true,  0xffffffff, {} }   // CRC-32/ISO-HDLC
+    };
+
+    Catalogue() {
+      for (SPICrcAlgorithm& a : algorithms) {
+        BuildTable(a);
+      }
+    }
+  };
+
+  const Catalogue& GetCatalogue() {
+    static const Catalogue catalogue;
+    return catalogue;
+  }
+
+  void Store(const SPICrcAlgorithm& a, uint32_t crc, uint8_t* out) {
+    if (a.width == 7) {
+      out[0] = static_cast<uint8_t>(crc << 1 | 1);
+      return;
+    }
+
+    size_t n = a.width / 8;
+
+    for (size_t i = 0; i < n; i++) {
+      size_t shift = a.reflect ? i * 8 : (n - 1 - i) * 8;
+      out[i] = static_cast<uint8_t>(crc >> shift);
+    }
+  }
+}
+
+const SPICrcAlgorithm* SPICrc::Find(const std::string& name) {
+  for (const SPICrcAlgorithm& a : GetCatalogue().algorithms) {
+    if (name == a.name) {
+      return &a;
+    }
+  }
+
+  return nullptr;
+}
+
+std::string SPICrc::Names() {
+  std::string names;
+
+  for (const SPICrcAlgorithm& a : GetCatalogue().algorithms) {
+    names += (names.empty() ? "'" : ", '") + std::string(a.name) + "'";
+  }
+
+  return names;
+}
+
+size_t SPICrc::Bytes(const SPICrcAlgorithm& a) {
+  return a.width == 7 ? 1 : a.width / 8;
+}
+
+uint32_t SPICrc::Compute(const SPICrcAlgorithm& a, const uint8_t* data, size_t len) {
+  const uint32_t* table = a.table;
+
+  if (a.reflect) {
+    uint32_t crc = Reflect(a.init, a.width);
+
+    for (size_t i = 0; i < len; i++) {
+      crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+
+    return crc ^ a.xorOut;
+  }
+
+  int bits = RegisterBits(a);
+  uint32_t mask = Mask(bits);
+  uint32_t crc = a.init << (bits - a.width);
+
+  for (size_t i = 0; i < len; i++) {
+    crc = (table[((crc >> (bits - 8)) ^ data[i]) & 0xff] ^ (crc << 8)) & mask;
+  }
+
+  return (crc >> (bits - a.width)) ^ a.xorOut;
+}
+
+void SPICrc::Seal(const SPICrcAlgorithm& a, uint8_t* frames, size_t len, size_t chunk) {
+  size_t n = Bytes(a);
+  size_t frame = chunk ? chunk + n : len;
+
+  for (size_t at = 0; at + frame <= len; at += frame) {
+    Store(a, Compute(a, frames + at, frame - n), frames + at + frame - n);
+  }
+}
+
+bool SPICrc::Verify(const SPICrcAlgorithm& a, const uint8_t* frames, size_t len, size_t chunk) {
+  size_t n = Bytes(a);
+  size_t frame = chunk ? chunk + n : len;
+  uint8_t expected[4];
+
+  for (size_t at = 0; at + frame <= len; at += frame) {
+    Store(a, Compute(a, frames + at, frame - n), expected);
+
+    for (size_t i = 0; i < n; i++) {
+      if (frames[at + frame - n + i] != expected[i]) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
@@ -0,0 +1,47 @@
+#ifndef SPI_CRC_H
+#define SPI_CRC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Checksums of transfer() messages, computed on the executor thread
+// right before and after the ioctl. The algorithms are given in the
+// Rocksoft model and run byte-wise from a 256 entry table. The CRC is
+// stored after its data: reflected algorithms little endian, the others
+// big endian, CRC-7 as SD cards expect it, (crc << 1) | 1.
+struct SPICrcAlgorithm {
+  const char* name;
+  uint8_t width;      // 7, 8, 16 or 32 bits
+  uint32_t poly;
+  uint32_t init;
+  bool reflect;       // refin and refout
+  uint32_t xorOut;
+  uint32_t table[256];
+};
+
+// The CRCs of one message. The wire data (after `skip` rx bytes) is a
+// series of frames: `chunk` data bytes and their CRC, or one frame of
+// all the data and a CRC when chunk is 0.
+struct SPICrcOp {
+  size_t index;       // message in the batch
+  const SPICrcAlgorithm* algorithm;
+  bool tx;            // fill in the CRCs of the tx frames before the ioctl
+  bool rx;            // verify the CRCs of the rx frames after it
+  size_t skip;        // rx bytes before the first frame
+  size_t chunk;
+};
+
+namespace SPICrc {
+  const SPICrcAlgorithm* Find(const std::string& name);  // nullptr if unknown
+  std::string Names();  // 'crc7', 'crc8', ... for error messages
+  size_t Bytes(const SPICrcAlgorithm& algorithm);  // CRC bytes on the wire
+
+  uint32_t Compute(const SPICrcAlgorithm& algorithm, const uint8_t* data, size_t len);
+
+  // Frames of `len` bytes in total, see SPICrcOp
+  void Seal(const SPICrcAlgorithm& algorithm, uint8_t* frames, size_t len, size_t chunk);
+  bool Verify(const SPICrcAlgorithm& algorithm, const uint8_t* frames, size_t len, size_t chunk);
+}
+
+#endif
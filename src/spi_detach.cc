@@ -0,0 +1,134 @@
+#include "spi_device.h"
+#include "spi_io_thread.h"
+#include <map>
+
+// Devices between detach() in one environment and new SPIDevice(handle)
+// in another. Process wide on purpose: this is how an open device moves
+// between the main thread and worker_threads Workers.
+namespace {
+  struct DetachedDevice {
+    std::unique_ptr<SPIBackend> backend;
+    size_t bufsiz;
+    std::string path;
+  };
+
+  std::mutex registryMutex;
+  std::map<uint64_t, DetachedDevice> registry;
+  uint64_t nextHandle = 1;
+}
+
+// Hands the open device over to another environment. Returns a handle,
+// a plain { id, path } object that can be posted to a Worker, where
+// new SPIDevice(handle) takes the device over. This instance stays,
+// every transfer on it fails with EBADF.
+Napi::Value SPIDevice::Detach(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  if (detached) {
+    throw Napi::Error::New(env, "Device is already detached");
+  }
+
+  if (pendingJobs > 0) {
+    throw Napi::Error::New(env, "Device has pending transfers, detach it after they settle");
+  }
+
+  if (sampler) {
+    throw Napi::Error::New(env, "Stop sampling before detaching the device");
+  }
+
+  if (bus) {
+    throw Napi::Error::New(env, "Remove the device from its SPIBus before detaching it");
+  }
+
+  if (trace) {
+    throw Napi::Error::New(env, "Stop tracing before detaching the device");
+  }
+
+  // Nothing is queued, join the I/O thread before the backend moves
+  ioThread.reset();
+
+  DetachedDevice entry;
+  entry.bufsiz = bufsiz;
+  entry.path = path;
+
+  {
+    SPI_LOCK_GUARD;
+    entry.backend = std::move(backend);
+    backend.reset(new SPIDetachedBackend());
+  }
+
+  detached = true;
+  uint64_t id;
+
+  {
+    std::lock_guard<std::mutex> lock(registryMutex);
+    id = nextHandle++;
+    registry.emplace(id, std::move(entry));
+  }
+
+  Napi::Object handle = Napi::Object::New(env);
+  handle.Set("id", Napi::BigInt::New(env, id));
+  handle.Set("path", Napi::String::New(env, path));
+  return handle;
+}
+
+// SPIDevice.release(handle): closes a detached device that will never
+// be attached, e.g. when the Worker it was posted to exited first. The
+// registry entry holds the open fd and its lock until attached or
+// released. Returns false when the handle was already attached or released.
+Napi::Value SPIDevice::Release(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1 || !info[0].IsObject() ||
+      !info[0].As<Napi::Object>().Get("id").IsBigInt()) {
+    Napi::TypeError::New(env, "Device handle from detach() expected")
+      .ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  bool lossless;
+  uint64_t id = info[0].As<Napi::Object>().Get("id").As<Napi::BigInt>().Uint64Value(&lossless);
+  std::unique_ptr<SPIBackend> backend;
+
+  {
+    std::lock_guard<std::mutex> lock(registryMutex);
+    auto it = registry.find(id);
+
+    if (!lossless || it == registry.end()) {
+      return Napi::Boolean::New(env, false);
+    }
+
+    backend = std::move(it->second.backend);
+    registry.erase(it);
+  }
+
+  // Closes the fd, which drops the flock
+  backend.reset();
+
+  return Napi::Boolean::New(env, true);
+}
+
+std::unique_ptr<SPIBackend> SPIDevice::TakeDetached(Napi::Env env, const Napi::Object& handle,
+    size_t& bufsiz, std::string& path) {
+
+  if (!handle.Get("id").IsBigInt()) {
+    throw Napi::TypeError::New(env, "Device handle from detach() expected");
+  }
+
+  bool lossless;
+  uint64_t id = handle.Get("id").As<Napi::BigInt>().Uint64Value(&lossless);
+
+  std::lock_guard<std::mutex> lock(registryMutex);
+  auto it = registry.find(id);
+
+  if (!lossless || it == registry.end()) {
+    throw Napi::Error::New(env, "Device handle is unknown or already attached");
+  }
+
+  std::unique_ptr<SPIBackend> backend = std::move(it->second.backend);
+  bufsiz = it->second.bufsiz;
+  path = it->second.path;
+  registry.erase(it);
+
+  return backend;
+}
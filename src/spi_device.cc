@@ -1,10 +1,30 @@
 #include "spi_device.h"
+#include "spi_bus.h"
+#include "spi_io_thread.h"
+#include "spi_pool.h"
+#include "spi_sampler.h"
+#include "spi_trace.h"
 #include <sys/file.h>  // for flock()
 #include <unistd.h>    // for close()
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/ioctl.h>  // For ioctl()
 #include <linux/spi/spidev.h>  // For SPI_IOC_WR_MODE etc
+#include <fstream>
+
+namespace {
+  // spidev bounces every message through a buffer of this size
+  size_t ReadSpidevBufsiz() {
+    std::ifstream file("/sys/module/spidev/parameters/bufsiz");
+    size_t bufsiz = 0;
+
+    if (file >> bufsiz && bufsiz > 0) {
+      return bufsiz;
+    }
+
+    return 4096;  // spidev default
+  }
+}
 
 SPIDevice::SPIDevice(const Napi::CallbackInfo& info)
   : Napi::ObjectWrap<SPIDevice>(info) {
@@ -13,51 +33,186 @@ SPIDevice::SPIDevice(const Napi::CallbackInfo& info)
 
   SPI_LOCK_GUARD;
 
-  if (info.Length() < 1 || !info[0].IsString()) {
-    Napi::TypeError::New(env, "Device path string expected")
-      .ThrowAsJavaScriptException();
-    return;
-  }
-
-  std::string device = info[0].As<Napi::String>().Utf8Value();
-  this->fd = open(device.c_str(), O_RDWR);
-
-  if (this->fd < 0) {
-    Napi::Error::New(env, "Failed to open SPI device")
-      .ThrowAsJavaScriptException();
-  }
+  // A handle from detach() takes over a device opened in another environment
+  bool attach = info.Length() >= 1 && info[0].IsObject();
 
-  if (flock(this->fd, LOCK_EX | LOCK_NB) < 0) {
-    close(this->fd);
-    this->fd = -1;  // Prevent dangling fd usage
-    Napi::Error::New(env, "SPI device is already locked by another process")
+  if (info.Length() < 1 || !(info[0].IsString() || attach)) {
+    Napi::TypeError::New(env, "Device path string or detached device handle expected")
       .ThrowAsJavaScriptException();
     return;
   }
 
+  std::string device = attach ? "" : info[0].As<Napi::String>().Utf8Value();
+
   // --- Defaults
   uint32_t mode = 0;
   uint32_t bits = 8;
   uint32_t speed = 1000000;
+  size_t bufsiz = 0;  // 0: the spidev module parameter
+  bool loopback = false;
+  bool flash = false;
+  size_t flashSize = 16 << 20;
+  bool useIoThread = false;
+  SPIIoThread::Options ioThreadOptions;
+  bool hasMode = false;
+  bool hasBits = false;
+  bool hasSpeed = false;
 
   // --- Optional second argument: options object
   if (info.Length() >= 2 && info[1].IsObject()) {
     Napi::Object options = info[1].As<Napi::Object>();
 
+    if (options.Has("backend")) {
+      Napi::Value val = options.Get("backend");
+      std::string name = val.IsString() ? val.As<Napi::String>().Utf8Value() : "";
+
+      if (name != "kernel" && name != "loopback" && name != "flash") {
+        throw Napi::TypeError::New(env, "'backend' must be 'kernel', 'loopback' or 'flash'");
+      }
+
+      loopback = name != "kernel";
+      flash = name == "flash";
+    }
+
+    if (options.Has("flash_size")) {
+      Napi::Value val = options.Get("flash_size");
+      int64_t value = val.IsNumber() ? val.As<Napi::Number>().Int64Value() : 0;
+
+      // Emulated in memory: 64 KiB up to 256 MiB
+      if (value < (1 << 16) || value > (1 << 28) || (value & (value - 1)) != 0) {
+        throw Napi::RangeError::New(env, "'flash_size' must be a power of 2 from 64 KiB to 256 MiB");
+      }
+
+      flashSize = static_cast<size_t>(value);
+    }
+
     if (options.Has("mode")) {
       mode = ParseMode(options.Get("mode"));
+      hasMode = true;
     }
 
     if (options.Has("bits_per_word")) {
       bits = ParseBitsPerWord(options.Get("bits_per_word"));
+      hasBits = true;
     }
 
     if (options.Has("max_speed_hz")) {
       speed = ParseMaxSpeedHz(options.Get("max_speed_hz"));
+      hasSpeed = true;
+    }
+
+    if (options.Has("bufsiz")) {
+      Napi::Value val = options.Get("bufsiz");
+
+      if (!val.IsNumber()) {
+        throw Napi::TypeError::New(env, "'bufsiz' must be a number");
+      }
+
+      int64_t value = val.As<Napi::Number>().Int64Value();
+
+      if (value < static_cast<int64_t>(SPI_DMA_MINALIGN)) {
+        throw Napi::RangeError::New(env, "'bufsiz' must be at least " +
+          std::to_string(SPI_DMA_MINALIGN) + " bytes");
+      }
+
+      bufsiz = static_cast<size_t>(value);
+    }
+
+    if (options.Has("pool_size")) {
+      Napi::Value val = options.Get("pool_size");
+
+      if (!val.IsNumber()) {
+        throw Napi::TypeError::New(env, "'pool_size' must be a number");
+      }
+
+      int64_t value = val.As<Napi::Number>().Int64Value();
+
+      if (value < static_cast<int64_t>(SPIBufferPool::MIN_LIMIT)) {
+        throw Napi::RangeError::New(env, "'pool_size' must be at least 64 KiB");
+      }
+
+      this->poolLimit = static_cast<size_t>(value);
+    }
+
+    if (options.Has("io_thread")) {
+      Napi::Value val = options.Get("io_thread");
+      ioThreadOptions = SPIIoThread::ParseOptions(val);
+      useIoThread = !val.IsBoolean() || val.As<Napi::Boolean>().Value();
+    }
+
+    if (options.Has("coalesce")) {
+      if (!options.Get("coalesce").IsBoolean()) {
+        throw Napi::TypeError::New(env, "'coalesce' must be a boolean");
+      }
+
+      // Coalescing is done by the I/O thread
+      ioThreadOptions.coalesce = options.Get("coalesce").As<Napi::Boolean>().Value();
+      useIoThread = useIoThread || ioThreadOptions.coalesce;
+    }
+  }
+
+  // --- Open the device
+  if (attach) {
+    this->backend = TakeDetached(env, info[0].As<Napi::Object>(), this->bufsiz, device);
+
+    if (bufsiz) {
+      this->bufsiz = bufsiz;
+    }
+  }
+  else if (loopback) {
+    // Fixed default, so benchmarks do not depend on the host
+    this->bufsiz = bufsiz ? bufsiz : 4096;
+    this->backend.reset(flash
+      ? new SPIFlashBackend(this->bufsiz, flashSize)
+      : new SPILoopbackBackend(this->bufsiz));
+  }
+  else {
+    int fd = open(device.c_str(), O_RDWR);
+
+    if (fd < 0) {
+      Napi::Error::New(env, "Failed to open SPI device")
+        .ThrowAsJavaScriptException();
+      return;
+    }
+
+    if (flock(fd, LOCK_EX | LOCK_NB) < 0) {
+      close(fd);
+      Napi::Error::New(env, "SPI device is already locked by another process")
+        .ThrowAsJavaScriptException();
+      return;
     }
+
+    this->bufsiz = bufsiz ? bufsiz : ReadSpidevBufsiz();
+    this->backend.reset(new SPIKernelBackend(fd));
+  }
+
+  // --- Shadow the current settings, getters never issue an ioctl
+  uint8_t currentMode = 0;
+  uint8_t currentBits = 0;
+  uint32_t currentSpeed = 0;
+
+  IoctlOrThrow(SPI_IOC_RD_MODE, &currentMode, "SPI_IOC_RD_MODE");
+  IoctlOrThrow(SPI_IOC_RD_BITS_PER_WORD, &currentBits, "SPI_IOC_RD_BITS_PER_WORD");
+  IoctlOrThrow(SPI_IOC_RD_MAX_SPEED_HZ, &currentSpeed, "SPI_IOC_RD_MAX_SPEED_HZ");
+  if (env.IsExceptionPending()) {
+    return;
+  }
+
+  shadowMode.store(currentMode);
+  shadowBits.store(currentBits ? currentBits : 8);  // 0 means 8 to spidev
+  shadowSpeed.store(currentSpeed);
+
+  // An attached device keeps its settings, unless the options change them
+  if (attach) {
+    mode = hasMode ? mode : currentMode;
+    bits = hasBits ? bits : shadowBits.load();
+    speed = hasSpeed ? speed : currentSpeed;
   }
 
-  // --- Set options
+  this->path = device;
+
+  // --- Set options, only changed settings are written
+
   SetModeInternal(static_cast<uint8_t>(mode));
   if (env.IsExceptionPending()) {
     return;
@@ -72,11 +227,20 @@ SPIDevice::SPIDevice(const Napi::CallbackInfo& info)
   if (env.IsExceptionPending()){
     return;
   }
+
+  if (useIoThread) {
+    this->ioThread.reset(new SPIIoThread(env, this, ioThreadOptions));
+  }
 }
 
 SPIDevice::~SPIDevice() {
-  if (this->fd >= 0) {
-    close(this->fd);
-    this->fd = -1;  // Prevent reuse
+  // Join the sampling and I/O threads before the fd goes away
+  this->sampler.reset();
+  this->ioThread.reset();
+
+  if (this->bus) {
+    this->bus->Detach(this);
   }
+
+  this->backend.reset();
 }
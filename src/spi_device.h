@@ -2,13 +2,42 @@
 #define SPI_DEVICE_H
 
 #include <napi.h>
+#include "spi_backend.h"
+#include "spi_codec.h"
+#include "spi_crc.h"
+#include "spi_stats.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
 #include <vector>
 #include <linux/spi/spidev.h>
 
 #define SPI_LOCK_GUARD std::lock_guard<std::mutex> lock(this->mutex)
 #define SPI_DEVICE_LOCK_GUARD std::lock_guard<std::mutex> lock(device->mutex)
 
+class SPIBufferPool;
+class SPIBus;
+class SPIDisplay;
+class SPIFlash;
+class SPIIoThread;
+class SPIProgram;
+class SPIRegmap;
+class SPISampler;
+class SPITrace;
+struct SPIPoolBlock;
+
 class SPIDevice : public Napi::ObjectWrap<SPIDevice> {
+  friend class SPIBus;
+  friend class SPIDisplay;
+  friend class SPIFlash;
+  friend class SPIIoThread;
+  friend class SPIProgram;
+  friend class SPIRegmap;
+  friend class SPISampler;
 
 public:
   static Napi::Object Init(Napi::Env env, Napi::Object exports);
@@ -21,16 +50,97 @@ public:
   Napi::Value GetBitsPerWord(const Napi::CallbackInfo& info);
   Napi::Value SetMaxSpeedHz(const Napi::CallbackInfo& info);
   Napi::Value GetMaxSpeedHz(const Napi::CallbackInfo& info);
+  Napi::Value SetModeAsync(const Napi::CallbackInfo& info);
+  Napi::Value SetBitsPerWordAsync(const Napi::CallbackInfo& info);
+  Napi::Value SetMaxSpeedHzAsync(const Napi::CallbackInfo& info);
   Napi::Value Transfer(const Napi::CallbackInfo& info);
+  Napi::Value TransferInto(const Napi::CallbackInfo& info);
+  Napi::Value TransferSync(const Napi::CallbackInfo& info);
+  Napi::Value TransferArena(const Napi::CallbackInfo& info);
+  Napi::Value TransferArenaSync(const Napi::CallbackInfo& info);
+  Napi::Value TransferUntil(const Napi::CallbackInfo& info);
+  Napi::Value Prepare(const Napi::CallbackInfo& info);
+  Napi::Value StartSampling(const Napi::CallbackInfo& info);
+  Napi::Value StopSampling(const Napi::CallbackInfo& info);
+  Napi::Value ArmOnEvent(const Napi::CallbackInfo& info);
+  Napi::Value Disarm(const Napi::CallbackInfo& info);
+  Napi::Value StartTrace(const Napi::CallbackInfo& info);
+  Napi::Value StopTrace(const Napi::CallbackInfo& info);
+  Napi::Value AllocBuffer(const Napi::CallbackInfo& info);
+  Napi::Value GetPoolStats(const Napi::CallbackInfo& info);
+  Napi::Value GetStats(const Napi::CallbackInfo& info);
+  Napi::Value ResetStats(const Napi::CallbackInfo& info);
+  Napi::Value Detach(const Napi::CallbackInfo& info);
+  static Napi::Value Release(const Napi::CallbackInfo& info);
 
 private:
-  int fd = -1;
+  std::unique_ptr<SPIBackend> backend;  // spidev, or the loopback emulator
+  std::string path;
+  bool detached = false;   // backend handed to another environment, see Detach()
+  size_t pendingJobs = 0;  // queued and running jobs, JS thread only
   std::mutex mutex;
+  std::unique_ptr<SPIIoThread> ioThread;  // opt-in dedicated I/O thread
+  std::unique_ptr<SPISampler> sampler;    // running startSampling() or armOnEvent()
+  std::unique_ptr<SPITrace> trace;        // startTrace(), set and read with the mutex held
+  std::shared_ptr<SPIBufferPool> pool;    // allocBuffer(), created on first use, JS thread only
+  size_t poolLimit = 4 << 20;             // pool_size option
+  SPIBus* bus = nullptr;                  // scheduling bus, see SPIBus::Add()
+  Napi::ObjectReference busRef;
+  size_t bufsiz = 4096;  // spidev limit on the bytes in one SPI_IOC_MESSAGE
+  std::vector<spi_ioc_transfer> chunks;  // scratch for split messages, guarded by mutex
+  SPIStats stats;
+
+  // Shadow of the kernel settings: written with the mutex held after a
+  // successful ioctl, read lock-free by the getters.
+  std::atomic<uint8_t> shadowMode{0};
+  std::atomic<uint8_t> shadowBits{8};
+  std::atomic<uint32_t> shadowSpeed{0};
+
+  // Realtime jobs run before bulk jobs, and between the CS-released
+  // segments of a running bulk job (see RunPreemptible()).
+  enum Lane { LANE_REALTIME, LANE_BULK, LANE_COUNT };
+
+  class Job;
+
+  // Threadpool queue, used without io_thread or bus. A worker pops the
+  // best job once it holds the mutex, so jobs run in lane and call order.
+  std::mutex queueMutex;  // never held during an ioctl
+  std::deque<Job*> queued[LANE_COUNT];
+  size_t retiredWorkers[LANE_COUNT] = {};  // workers left by unlinked jobs, guarded by queueMutex
+  bool bulkSuspended = false;  // a bulk job is preempted, guarded by mutex
+  bool jobSleeping = false;    // the running job sleeps without the mutex, guarded by mutex
+  std::unique_lock<std::mutex>* executorLock = nullptr;  // held by the thread running a job, guarded by mutex
+
+  // Publishes the lock an executor holds the mutex with while it runs
+  // jobs, see SleepUnlocked(). Nested realtime jobs restore the outer one.
+  class ExecutorScope {
+    public:
+      ExecutorScope(SPIDevice* device, std::unique_lock<std::mutex>& lock)
+        : device(device), outer(device->executorLock) { device->executorLock = &lock; }
+      ~ExecutorScope() { device->executorLock = outer; }
+
+    private:
+      SPIDevice* device;
+      std::unique_lock<std::mutex>* outer;
+  };
+  std::condition_variable turn;
+
+  std::atomic<size_t> realtimeQueued{0};  // realtime jobs waiting, any executor
+  bool realtimeUsed = false;              // JS thread, bulk jobs are split from then on
+  std::function<void()> preempt;          // runs waiting realtime jobs, set by the executor
+  std::vector<spi_ioc_transfer> segment;  // scratch for RunPreemptible(), guarded by mutex
+
+  // Largest N for SPI_IOC_MESSAGE(N), bound by the ioctl size field
+  static constexpr size_t MAX_MESSAGES =
+    ((1 << _IOC_SIZEBITS) - 1) / sizeof(struct spi_ioc_transfer);
 
   void IoctlOrThrow(unsigned long request, void* arg, const char* action);
   void SetModeInternal(uint8_t mode);
   void SetMaxSpeedHzInternal(uint32_t speed);
   void SetBitsPerWordInternal(uint8_t bits);
+  int WriteMode(uint8_t mode);
+  int WriteMaxSpeedHz(uint32_t speed);
+  int WriteBitsPerWord(uint8_t bits);
 
   static void ValidateMode(Napi::Env env, uint32_t mode);
   static void ValidateBitsPerWord(Napi::Env env, uint32_t bits);
@@ -38,20 +148,200 @@ private:
   static uint32_t ParseBitsPerWord(const Napi::Value& val);
   static uint32_t ParseMaxSpeedHz(const Napi::Value& val);
   static uint32_t ParseMode(const Napi::Value& val);
+  static std::unique_ptr<SPIBackend> TakeDetached(Napi::Env env, const Napi::Object& handle,
+    size_t& bufsiz, std::string& path);
+
+  // Parsed messages with persistent references that keep the tx and rx
+  // memory alive until the ioctl completes. allocBuffer() memory is
+  // pinned in the pool instead, with an empty reference in its place.
+  struct TransferBatch {
+    TransferBatch() = default;
+    TransferBatch(TransferBatch&&) = default;
+    TransferBatch& operator=(TransferBatch&&) = default;
+    ~TransferBatch();
+
+    void Pin(SPIPoolBlock* block);
+
+    std::vector<spi_ioc_transfer> transfers;
+    std::vector<Napi::ObjectReference> txRefs;
+    std::vector<Napi::ObjectReference> rxRefs;
+    std::vector<SPIWordOp> words;  // decode / encode typed array conversions
+    std::vector<SPICrcOp> crcs;    // tx CRCs to fill in, rx CRCs to verify
+    std::vector<Napi::ObjectReference> wordRefs;
+    Napi::ObjectReference result;  // caller supplied result array (optional)
+    std::shared_ptr<SPIBufferPool> pool;  // the device pool when it exists, set before parsing
+    std::vector<SPIPoolBlock*> pinned;
+  };
+
+  static void ParseTransfers(Napi::Env env, const Napi::Array& msgArray,
+    const Napi::Array* rxArray, TransferBatch& batch);
+  static Napi::Value BatchResult(Napi::Env env, TransferBatch& batch);
+  static void EncodeWords(TransferBatch& batch);
+  static void DecodeWords(TransferBatch& batch);
+  static void SealCrcs(TransferBatch& batch);
+  static int CheckCrcs(const TransferBatch& batch);
+  static std::string CrcMismatch(const TransferBatch& batch, int index);
+  static Napi::Error CrcError(Napi::Env env, const TransferBatch& batch, int index);
+  static constexpr const char* CRC_MISMATCH = "ERR_SPI_CRC_MISMATCH";  // error.code
+  static void ParseArena(Napi::Env env, const Napi::Value& table,
+    const Napi::Value& tx, const Napi::Value& rx, std::vector<spi_ioc_transfer>& transfers);
+  static Napi::Value ArenaConstants(Napi::Env env);
+  int RunTransfers(std::vector<spi_ioc_transfer>& transfers);
+  int RunChunked(const std::vector<spi_ioc_transfer>& transfers);
+  int RunPreemptible(std::vector<spi_ioc_transfer>& transfers);
+  void YieldToRealtime();
+  void SleepUnlocked(uint64_t ns);
+
+  // Unit of queued work on the device. Execute() runs off the JS thread
+  // with the device mutex held, Complete() settles the Promise on the JS thread.
+  class Job {
+    public:
+      explicit Job(Napi::Env env)
+        : deferred(Napi::Promise::Deferred::New(env)) {}
+      virtual ~Job() = default;
+
+      virtual void Execute(SPIDevice* device) = 0;
+      virtual Napi::Value Result(Napi::Env env) = 0;
+
+      // Messages of a plain transfer job, which can be coalesced
+      // with other queued transfer jobs. nullptr for other jobs.
+      virtual std::vector<spi_ioc_transfer>* Transfers() { return nullptr; }
+
+      void Complete(Napi::Env env);
+      void SetTransferError(int err);
+      void SetCrcError(const TransferBatch& batch, int index);
+      int Run(SPIDevice* device, std::vector<spi_ioc_transfer>& transfers);
+      void Reject(Napi::Value error) { deferred.Reject(error); }
+      Napi::Promise Promise() const { return deferred.Promise(); }
+
+      // AbortSignal support (JS thread). An aborted job is rejected at
+      // once and unlinked from its queue (see SPIDevice::Unlink()); the
+      // executor skips it when it was popped already.
+      void Watch(Napi::Env env, const std::vector<Napi::Object>& signals);
+      void Unwatch();
+      bool Abort(Napi::Value reason);
+      bool Aborted() const { return state.load(std::memory_order_acquire) == ABORTED; }
+
+      // Claims the job for execution, false when it was aborted first
+      bool Start() {
+        int expected = QUEUED;
+        return state.compare_exchange_strong(expected, RUNNING, std::memory_order_acq_rel);
+      }
+
+      std::string error;  // set by Execute() on failure
+      std::string code;   // error.code, for errors JS code should tell apart
+      SPIDevice* device = nullptr;  // set by QueueJob()
+      Lane lane = LANE_BULK;
+      uint64_t deadlineNs = 0;  // latest start, 0 for none
+      uint64_t queuedNs = 0;    // SPIStats::Now() timestamps
+      uint64_t executedNs = 0;
+
+    protected:
+      Napi::Promise::Deferred deferred;
+
+    private:
+      enum State { QUEUED, RUNNING, ABORTED };
+      static Napi::Value OnAbort(const Napi::CallbackInfo& info);
+      std::atomic<int> state{QUEUED};
+      std::vector<Napi::ObjectReference> signals;
+      Napi::FunctionReference onAbort;
+  };
+
+  class TransferJob : public Job {
+    public:
+      TransferJob(Napi::Env env, TransferBatch&& batch)
+        : Job(env), batch(std::move(batch)) {}
+
+      void Execute(SPIDevice* device) override;
+      Napi::Value Result(Napi::Env env) override;
+      std::vector<spi_ioc_transfer>* Transfers() override {
+        return batch.words.empty() && batch.crcs.empty() ? &batch.transfers : nullptr;
+      }
+
+    private:
+      TransferBatch batch;
+  };
+
+  // transferArena(): messages described by a table of offsets into one
+  // tx and one rx arena. A single reference pins both arenas.
+  class ArenaJob : public Job {
+    public:
+      ArenaJob(Napi::Env env, std::vector<spi_ioc_transfer>&& transfers, Napi::Array arenas)
+        : Job(env), transfers(std::move(transfers)), arenas(Napi::Persistent(arenas)) {}
+
+      void Execute(SPIDevice* device) override;
+      Napi::Value Result(Napi::Env env) override;
+      std::vector<spi_ioc_transfer>* Transfers() override { return &transfers; }
+
+    private:
+      std::vector<spi_ioc_transfer> transfers;
+      Napi::Reference<Napi::Array> arenas;  // [tx, rx]
+  };
+
+  // transferUntil(): the messages are repeated until a masked rx byte
+  // matches, all on the executor thread. The device stays claimed for
+  // the whole poll; realtime jobs run between the polls of a bulk one.
+  class PollJob : public Job {
+    public:
+      PollJob(Napi::Env env, TransferBatch&& batch)
+        : Job(env), batch(std::move(batch)) {}
+
+      void Execute(SPIDevice* device) override;
+      Napi::Value Result(Napi::Env env) override;
+
+      size_t message = 0;  // rx byte to test: transfers[message].rx_buf[offset]
+      size_t offset = 0;
+      uint8_t mask = 0xff;
+      uint8_t value = 0;
+      uint64_t intervalNs = 0;
+      uint64_t timeoutAtNs = 0;  // SPIStats::Now() timestamp
 
+    private:
+      TransferBatch batch;
+      uint64_t iterations = 0;
+  };
+
+  // Setting change queued behind the pending transfers (set*Async)
+  class ConfigJob : public Job {
+    public:
+      enum Setting { MODE, MAX_SPEED_HZ, BITS_PER_WORD };
+
+      ConfigJob(Napi::Env env, Setting setting, uint32_t value)
+        : Job(env), setting(setting), value(value) {}
+
+      void Execute(SPIDevice* device) override;
+      Napi::Value Result(Napi::Env env) override { return env.Undefined(); }
+
+    private:
+      Setting setting;
+      uint32_t value;
+  };
+
+  // { priority, deadline, signal, timeoutMs } of transfer(), transferInto() and program runs
+  struct JobOptions {
+    Lane lane = LANE_BULK;
+    uint64_t deadlineNs = 0;
+    std::vector<Napi::Object> signals;  // signal, and AbortSignal.timeout(timeoutMs)
+  };
+
+  static JobOptions ParseJobOptions(Napi::Env env, const Napi::Value& val);
+
+  Napi::Value QueueJob(Napi::Env env, Job* job, const JobOptions& options);
+  Napi::Value QueueJob(Napi::Env env, Job* job) { return QueueJob(env, job, JobOptions()); }
+  Job* PopQueued();
+  bool RetireWorker(Lane lane);
+  bool Unlink(Napi::Env env, Job* job);
+  bool DropExpired(Job* job, uint64_t now);
+  void ExecuteJob(Job* job);
+  void CompleteJob(Napi::Env env, Job* job);
+
+  // Runs one queued Job on the libuv threadpool (default, without
+  // io_thread). The job is picked from the queue in Execute().
   class TransferWorker : public Napi::AsyncWorker {
     public:
-      TransferWorker(Napi::Env env, SPIDevice* device,
-          std::vector<spi_ioc_transfer>&& transfers,
-          std::vector<Napi::Reference<Napi::Buffer<uint8_t>>>&& txRefs,
-          std::vector<Napi::Reference<Napi::Buffer<uint8_t>>>&& rxRefs,
-          Napi::Promise::Deferred deferred)
+      TransferWorker(Napi::Env env, SPIDevice* device)
         : Napi::AsyncWorker(env),
-        device(device),
-        transfers(std::move(transfers)),
-        txRefs(std::move(txRefs)),
-        rxRefs(std::move(rxRefs)),
-        deferred(deferred) {}
+        device(device) {}
 
       void Execute() override;
       void OnOK() override;
@@ -59,10 +349,7 @@ private:
 
     private:
       SPIDevice* device;
-      std::vector<spi_ioc_transfer> transfers;
-      std::vector<Napi::Reference<Napi::Buffer<uint8_t>>> txRefs;
-      std::vector<Napi::Reference<Napi::Buffer<uint8_t>>> rxRefs;
-      Napi::Promise::Deferred deferred;
+      Job* job = nullptr;
   };
 };
 
@@ -0,0 +1,526 @@
+#include "spi_display.h"
+#include "spi_addon.h"
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <linux/gpio.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+namespace {
+  const uint8_t CMD_CASET = 0x2a;
+  const uint8_t CMD_RASET = 0x2b;
+  const uint8_t CMD_RAMWR = 0x2c;
+
+  // Bytes the bus could send in the time one more window costs: the
+  // commands of a window are separate ioctls with a GPIO write each with
+  // a D/C pin, a few extra words in 3-wire mode. Dirty rows are merged
+  // into one rectangle while that wastes fewer bytes.
+  const size_t WINDOW_COST_DC = 512;
+  const size_t WINDOW_COST_3WIRE = 32;
+
+  uint32_t ParseDimension(Napi::Env env, const Napi::Object& options, const char* name,
+      uint32_t min, uint32_t fallback) {
+    if (!options.Has(name) || options.Get(name).IsUndefined()) {
+      if (min > 0) {
+        throw Napi::TypeError::New(env, std::string("'") + name + "' is required");
+      }
+
+      return fallback;
+    }
+
+    Napi::Value val = options.Get(name);
+    double value = val.IsNumber() ? val.As<Napi::Number>().DoubleValue() : -1;
+
+    if (!(value >= min && value <= 65535) || value != static_cast<uint32_t>(value)) {
+      throw Napi::RangeError::New(env, std::string("'") + name + "' must be an integer between " +
+        std::to_string(min) + " and 65535");
+    }
+
+    return static_cast<uint32_t>(value);
+  }
+
+  // The D/C line as an output through the GPIO character device
+  int RequestLine(const std::string& chip, uint32_t line) {
+    int chipFd = open(chip.c_str(), O_RDWR | O_CLOEXEC);
+
+    if (chipFd < 0) {
+      return -1;
+    }
+
+    gpio_v2_line_request request = {};
+    request.offsets[0] = line;
+    request.num_lines = 1;
+    request.config.flags = GPIO_V2_LINE_FLAG_OUTPUT;
+    std::strncpy(request.consumer, "io-spi d/c", sizeof(request.consumer) - 1);
+
+    int result = ioctl(chipFd, GPIO_V2_GET_LINE_IOCTL, &request);
+    int err = errno;
+    close(chipFd);
+
+    if (result == -1) {
+      errno = err;
+      return -1;
+    }
+
+    return request.fd;
+  }
+
+  spi_ioc_transfer TxTransfer(const void* data, size_t len, uint8_t bits) {
+    spi_ioc_transfer tr = {};
+    tr.tx_buf = (unsigned long)data;
+    tr.len = static_cast<uint32_t>(len);
+    tr.bits_per_word = bits;
+    return tr;
+  }
+}
+
+Napi::Object SPIDisplay::Init(Napi::Env env, Napi::Object exports) {
+  Napi::Function func = DefineClass(env, "SPIDisplay", {
+    InstanceMethod("push", &SPIDisplay::Push),
+    InstanceMethod("command", &SPIDisplay::Command),
+    InstanceMethod("invalidate", &SPIDisplay::Invalidate)
+  });
+
+  SPIAddon::Get(env)->display = Napi::Persistent(func);
+
+  exports.Set("SPIDisplay", func);
+  return exports;
+}
+
+// new SPIDisplay(device, { width, height, format, dc: { chip, line }, xOffset, yOffset })
+SPIDisplay::SPIDisplay(const Napi::CallbackInfo& info)
+  : Napi::ObjectWrap<SPIDisplay>(info) {
+
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1 || !info[0].IsObject()) {
+    throw Napi::TypeError::New(env, "SPIDevice expected");
+  }
+
+  Napi::Object deviceObj = info[0].As<Napi::Object>();
+
+  try {
+    device = SPIDevice::Unwrap(deviceObj);
+  }
+  catch (const Napi::Error&) {
+    throw Napi::TypeError::New(env, "SPIDevice expected");
+  }
+
+  if (info.Length() < 2 || !info[1].IsObject()) {
+    throw Napi::TypeError::New(env, "Display options with width and height expected");
+  }
+
+  Napi::Object options = info[1].As<Napi::Object>();
+
+  width = ParseDimension(env, options, "width", 1, 0);
+  height = ParseDimension(env, options, "height", 1, 0);
+  xOffset = ParseDimension(env, options, "xOffset", 0, 0);
+  yOffset = ParseDimension(env, options, "yOffset", 0, 0);
+
+  if (xOffset + width > 65536 || yOffset + height > 65536) {
+    throw Napi::RangeError::New(env, "Display window exceeds the 16 bit panel address range");
+  }
+
+  if (options.Has("format")) {
+    Napi::Value val = options.Get("format");
+    std::string name = val.IsString() ? val.As<Napi::String>().Utf8Value() : "";
+
+    if (name != "rgb565" && name != "rgb888" && name != "rgba8888") {
+      throw Napi::TypeError::New(env, "'format' must be 'rgb565', 'rgb888' or 'rgba8888'");
+    }
+
+    format = name == "rgba8888" ? SPIPixel::RGBA8888
+      : name == "rgb888" ? SPIPixel::RGB888 : SPIPixel::RGB565;
+  }
+
+  // Without a D/C pin, the panel takes 9 bit words with D/C as the first bit
+  if (options.Has("dc") && !options.Get("dc").IsNull() && !options.Get("dc").IsUndefined()) {
+    Napi::Value val = options.Get("dc");
+
+    if (!val.IsObject() || !val.As<Napi::Object>().Get("chip").IsString() ||
+        !val.As<Napi::Object>().Get("line").IsNumber()) {
+      throw Napi::TypeError::New(env, "'dc' must be { chip: '/dev/gpiochipN', line: number } or null");
+    }
+
+    Napi::Object dc = val.As<Napi::Object>();
+    std::string chip = dc.Get("chip").As<Napi::String>().Utf8Value();
+    int64_t line = dc.Get("line").As<Napi::Number>().Int64Value();
+
+    if (line < 0 || line > UINT32_MAX) {
+      throw Napi::RangeError::New(env, "'dc.line' must be a GPIO line offset");
+    }
+
+    dcFd = RequestLine(chip, static_cast<uint32_t>(line));
+
+    if (dcFd < 0) {
+      throw Napi::Error::New(env, "Failed to request D/C line " + std::to_string(line) +
+        " of " + chip + ": " + std::strerror(errno));
+    }
+  }
+
+  deviceRef = Napi::Persistent(deviceObj);
+}
+
+SPIDisplay::~SPIDisplay() {
+  if (dcFd >= 0) {
+    close(dcFd);
+  }
+}
+
+// push(frame[, { full, ...queue options }])
+Napi::Value SPIDisplay::Push(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1 || !info[0].IsTypedArray()) {
+    throw Napi::TypeError::New(env, "Framebuffer must be a Buffer or TypedArray");
+  }
+
+  Napi::TypedArray frame = info[0].As<Napi::TypedArray>();
+  size_t pixelCount = static_cast<size_t>(width) * height;
+
+  if (frame.ByteLength() < pixelCount * SPIPixel::BytesPerPixel(format)) {
+    throw Napi::RangeError::New(env, "Framebuffer must hold " + std::to_string(pixelCount) +
+      " pixels of " + std::to_string(SPIPixel::BytesPerPixel(format)) + " bytes");
+  }
+
+  bool full = false;
+
+  if (info[1].IsObject() && info[1].As<Napi::Object>().Has("full")) {
+    full = info[1].As<Napi::Object>().Get("full").ToBoolean().Value();
+  }
+
+  SPIDevice::JobOptions options = SPIDevice::ParseJobOptions(env, info[1]);
+
+  void* raw = nullptr;
+  napi_get_typedarray_info(env, frame, nullptr, nullptr, &raw, nullptr, nullptr);
+
+  // Double buffering: the staging buffer of a finished push comes back
+  // here, while the executor sends from the other one.
+  std::vector<uint8_t> staged;
+
+  if (!spare.empty()) {
+    staged = std::move(spare.back());
+    spare.pop_back();
+  }
+
+  staged.resize(pixelCount * 2);
+  SPIPixel::ToWire(static_cast<const uint8_t*>(raw), staged.data(), pixelCount, format);
+
+  full = full || invalidated;
+  invalidated = false;
+
+  return device->QueueJob(env, new PushJob(env, this, std::move(staged), full), options);
+}
+
+// command(cmd[, params][, options]): a DCS command, e.g. for the init sequence
+Napi::Value SPIDisplay::Command(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1 || !info[0].IsNumber()) {
+    throw Napi::TypeError::New(env, "Command byte expected");
+  }
+
+  int64_t cmd = info[0].As<Napi::Number>().Int64Value();
+
+  if (cmd < 0 || cmd > 255) {
+    throw Napi::RangeError::New(env, "Command must be between 0 and 255");
+  }
+
+  std::vector<uint8_t> params;
+  Napi::Value options = info[1];
+
+  if (info[1].IsBuffer()) {
+    Napi::Buffer<uint8_t> buf = info[1].As<Napi::Buffer<uint8_t>>();
+    params.assign(buf.Data(), buf.Data() + buf.Length());
+    options = info[2];
+  }
+  else if (info[1].IsArray()) {
+    Napi::Array array = info[1].As<Napi::Array>();
+
+    for (uint32_t i = 0; i < array.Length(); i++) {
+      Napi::Value byte = array.Get(i);
+
+      if (!byte.IsNumber() || byte.As<Napi::Number>().Int64Value() < 0 ||
+          byte.As<Napi::Number>().Int64Value() > 255) {
+        throw Napi::RangeError::New(env, "Command parameters must be bytes");
+      }
+
+      params.push_back(static_cast<uint8_t>(byte.As<Napi::Number>().Uint32Value()));
+    }
+
+    options = info[2];
+  }
+
+  SPIDevice::JobOptions queueOptions = SPIDevice::ParseJobOptions(env, options);
+  return device->QueueJob(env,
+    new CommandJob(env, this, static_cast<uint8_t>(cmd), std::move(params)), queueOptions);
+}
+
+// The next push() sends the whole frame, e.g. after the panel was reset
+Napi::Value SPIDisplay::Invalidate(const Napi::CallbackInfo& info) {
+  invalidated = true;
+  return info.Env().Undefined();
+}
+
+int SPIDisplay::SetDc(int level) {
+  if (dcLevel == level) {
+    return 0;
+  }
+
+  gpio_v2_line_values values = {};
+  values.bits = static_cast<uint64_t>(level);
+  values.mask = 1;
+
+  if (ioctl(dcFd, GPIO_V2_LINE_SET_VALUES_IOCTL, &values) == -1) {
+    dcLevel = -1;
+    return errno;
+  }
+
+  dcLevel = level;
+  return 0;
+}
+
+// With a D/C pin the command byte and the parameters are separate ioctls.
+// In 3-wire mode they are appended to the word stream, see FlushWords().
+int SPIDisplay::SendCommand(uint8_t cmd, const uint8_t* params, size_t len) {
+  if (dcFd < 0) {
+    words.push_back(cmd);
+
+    for (size_t i = 0; i < len; i++) {
+      words.push_back(0x100 | params[i]);
+    }
+
+    return 0;
+  }
+
+  int err = SetDc(0);
+
+  if (err == 0) {
+    message.assign(1, TxTransfer(&cmd, 1, 8));
+    err = device->RunTransfers(message);
+  }
+
+  if (err == 0 && len > 0) {
+    err = SetDc(1);
+
+    if (err == 0) {
+      message.assign(1, TxTransfer(params, len, 8));
+      err = device->RunTransfers(message);
+    }
+  }
+
+  return err;
+}
+
+// The 3-wire stream in as few ioctls as the bufsiz allows
+int SPIDisplay::FlushWords() {
+  if (words.empty()) {
+    return 0;
+  }
+
+  message.assign(1, TxTransfer(words.data(), words.size() * 2, 9));
+  int err = device->RunTransfers(message);
+  words.clear();
+  return err;
+}
+
+// CASET and RASET, skipped when the panel already has them
+int SPIDisplay::SendWindow(const Rect& rect) {
+  int err = 0;
+
+  if (!windowValid || rect.x0 != window.x0 || rect.x1 != window.x1) {
+    uint32_t x0 = rect.x0 + xOffset;
+    uint32_t x1 = rect.x1 + xOffset;
+    uint8_t columns[4] = {
+      static_cast<uint8_t>(x0 >> 8), static_cast<uint8_t>(x0),
+      static_cast<uint8_t>(x1 >> 8), static_cast<uint8_t>(x1)
+    };
+    err = SendCommand(CMD_CASET, columns, sizeof(columns));
+  }
+
+  if (err == 0 && (!windowValid || rect.y0 != window.y0 || rect.y1 != window.y1)) {
+    uint32_t y0 = rect.y0 + yOffset;
+    uint32_t y1 = rect.y1 + yOffset;
+    uint8_t rows[4] = {
+      static_cast<uint8_t>(y0 >> 8), static_cast<uint8_t>(y0),
+      static_cast<uint8_t>(y1 >> 8), static_cast<uint8_t>(y1)
+    };
+    err = SendCommand(CMD_RASET, rows, sizeof(rows));
+  }
+
+  window = rect;
+  windowValid = err == 0;
+  return err;
+}
+
+// Dirty span of each row, then rows merged greedily into rectangles:
+// a row (and the clean rows before it) joins the open rectangle while
+// the extra pixels cost less than starting a new window.
+void SPIDisplay::FindDirty(const std::vector<uint8_t>& frame, bool full) {
+  rects.clear();
+
+  if (full || !frontValid || front.size() != frame.size()) {
+    rects.push_back({ 0, 0, width - 1, height - 1 });
+    return;
+  }
+
+  size_t rowBytes = static_cast<size_t>(width) * 2;
+  size_t cost = (dcFd >= 0 ? WINDOW_COST_DC : WINDOW_COST_3WIRE) / 2;
+  Rect band = {};
+  bool isOpen = false;
+
+  for (uint32_t y = 0; y < height; y++) {
+    size_t first;
+    size_t last;
+
+    if (!SPIPixel::DiffSpan(frame.data() + y * rowBytes, front.data() + y * rowBytes,
+        rowBytes, first, last)) {
+      continue;
+    }
+
+    uint32_t x0 = static_cast<uint32_t>(first / 2);
+    uint32_t x1 = static_cast<uint32_t>(last / 2);
+
+    if (isOpen) {
+      size_t mergedX0 = std::min(band.x0, x0);
+      size_t mergedX1 = std::max(band.x1, x1);
+      size_t merged = mergedX1 - mergedX0 + 1;
+      size_t rows = band.y1 - band.y0 + 1;
+      size_t gap = y - band.y1 - 1;
+      size_t waste = (merged - (band.x1 - band.x0 + 1)) * rows + (merged - (x1 - x0 + 1)) + gap * merged;
+
+      if (waste <= cost) {
+        band.x0 = static_cast<uint32_t>(mergedX0);
+        band.x1 = static_cast<uint32_t>(mergedX1);
+        band.y1 = y;
+        continue;
+      }
+
+      rects.push_back(band);
+    }
+
+    band = { x0, y, x1, y };
+    isOpen = true;
+  }
+
+  if (isOpen) {
+    rects.push_back(band);
+  }
+}
+
+// Window commands and pixels of every rectangle. The pixels are sent
+// straight from the frame: a full width rectangle is one transfer, a
+// narrower one a transfer per row, packed into ioctls by RunTransfers().
+int SPIDisplay::SendRects(const std::vector<uint8_t>& frame) {
+  size_t rowBytes = static_cast<size_t>(width) * 2;
+
+  for (const Rect& rect : rects) {
+    int err = SendWindow(rect);
+
+    if (err == 0) {
+      err = SendCommand(CMD_RAMWR, nullptr, 0);
+    }
+
+    if (err != 0) {
+      return err;
+    }
+
+    const uint8_t* start = frame.data() + rect.y0 * rowBytes + rect.x0 * 2;
+    size_t spanBytes = (rect.x1 - rect.x0 + 1) * 2;
+    size_t rows = rect.y1 - rect.y0 + 1;
+
+    if (dcFd < 0) {
+      for (size_t y = 0; y < rows; y++) {
+        const uint8_t* row = start + y * rowBytes;
+
+        for (size_t i = 0; i < spanBytes; i++) {
+          words.push_back(0x100 | row[i]);
+        }
+      }
+
+      continue;
+    }
+
+    err = SetDc(1);
+
+    if (err != 0) {
+      return err;
+    }
+
+    message.clear();
+
+    if (spanBytes == rowBytes) {
+      message.push_back(TxTransfer(start, rows * rowBytes, 8));
+    }
+    else {
+      for (size_t y = 0; y < rows; y++) {
+        message.push_back(TxTransfer(start + y * rowBytes, spanBytes, 8));
+      }
+    }
+
+    err = device->RunTransfers(message);
+
+    if (err != 0) {
+      return err;
+    }
+
+    device->YieldToRealtime();
+  }
+
+  return FlushWords();
+}
+
+void SPIDisplay::PushJob::Execute(SPIDevice*) {
+  display->FindDirty(frame, full);
+  display->words.clear();
+
+  int err = display->SendRects(frame);
+
+  if (err != 0) {
+    // Unknown what the panel got, the next push sends everything
+    display->frontValid = false;
+    display->windowValid = false;
+    SetTransferError(err);
+    return;
+  }
+
+  rectCount = display->rects.size();
+
+  for (const Rect& rect : display->rects) {
+    pixels += static_cast<size_t>(rect.x1 - rect.x0 + 1) * (rect.y1 - rect.y0 + 1);
+  }
+
+  std::swap(display->front, frame);
+  display->frontValid = true;
+}
+
+// Resolves with { rects, pixels } sent, and returns the staging buffer
+Napi::Value SPIDisplay::PushJob::Result(Napi::Env env) {
+  if (display->spare.size() < 2) {
+    display->spare.push_back(std::move(frame));
+  }
+
+  Napi::Object result = Napi::Object::New(env);
+  result.Set("rects", Napi::Number::New(env, static_cast<double>(rectCount)));
+  result.Set("pixels", Napi::Number::New(env, static_cast<double>(pixels)));
+  return result;
+}
+
+void SPIDisplay::CommandJob::Execute(SPIDevice*) {
+  display->words.clear();
+
+  int err = display->SendCommand(cmd, params.data(), params.size());
+
+  if (err == 0) {
+    err = display->FlushWords();
+  }
+
+  // The command may have moved the window (or be CASET / RASET itself)
+  display->windowValid = false;
+
+  if (err != 0) {
+    SetTransferError(err);
+  }
+}
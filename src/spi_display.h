@@ -0,0 +1,100 @@
+#ifndef SPI_DISPLAY_H
+#define SPI_DISPLAY_H
+
+#include "spi_device.h"
+#include "spi_pixel.h"
+
+// Framebuffer pipeline for MIPI DCS panels (ILI9341, ST7789, ...) on an
+// SPIDevice. push() converts the frame to RGB565 on the calling thread
+// into a staging buffer and queues it; the executor diffs it against the
+// frame on the panel and sends only the dirty rectangles. The caller's
+// framebuffer is free again when push() returns, so the next frame is
+// rendered while this one is on the bus.
+class SPIDisplay : public Napi::ObjectWrap<SPIDisplay> {
+
+public:
+  static Napi::Object Init(Napi::Env env, Napi::Object exports);
+  SPIDisplay(const Napi::CallbackInfo& info);
+  ~SPIDisplay();
+
+  Napi::Value Push(const Napi::CallbackInfo& info);
+  Napi::Value Command(const Napi::CallbackInfo& info);
+  Napi::Value Invalidate(const Napi::CallbackInfo& info);
+
+private:
+  struct Rect {
+    uint32_t x0, y0, x1, y1;  // inclusive
+  };
+
+  SPIDevice* device = nullptr;
+  Napi::ObjectReference deviceRef;
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint32_t xOffset = 0;  // panel RAM position of the first column and row
+  uint32_t yOffset = 0;
+  SPIPixel::Format format = SPIPixel::RGB565;
+  int dcFd = -1;  // GPIO line request of the D/C pin, -1: 3-wire with 9 bit words
+
+  // JS thread
+  std::vector<std::vector<uint8_t>> spare;  // staging buffers back from the executor
+  bool invalidated = true;
+
+  // Executor, the device mutex is held
+  std::vector<uint8_t> front;  // what the panel shows, RGB565 wire order
+  bool frontValid = false;
+  Rect window = {};            // last CASET / RASET
+  bool windowValid = false;
+  int dcLevel = -1;
+  std::vector<Rect> rects;
+  std::vector<spi_ioc_transfer> message;
+  std::vector<uint16_t> words;  // 3-wire stream
+
+  int SetDc(int level);
+  int SendCommand(uint8_t cmd, const uint8_t* params, size_t len);
+  int FlushWords();
+  void FindDirty(const std::vector<uint8_t>& frame, bool full);
+  int SendRects(const std::vector<uint8_t>& frame);
+  int SendWindow(const Rect& rect);
+
+  class DisplayJob : public SPIDevice::Job {
+    public:
+      DisplayJob(Napi::Env env, SPIDisplay* display)
+        : SPIDevice::Job(env),
+        display(display),
+        displayRef(Napi::Persistent(display->Value())) {}
+
+    protected:
+      SPIDisplay* display;
+      Napi::ObjectReference displayRef;  // keeps the display alive while queued
+  };
+
+  class PushJob : public DisplayJob {
+    public:
+      PushJob(Napi::Env env, SPIDisplay* display, std::vector<uint8_t>&& frame, bool full)
+        : DisplayJob(env, display), frame(std::move(frame)), full(full) {}
+
+      void Execute(SPIDevice* device) override;
+      Napi::Value Result(Napi::Env env) override;
+
+    private:
+      std::vector<uint8_t> frame;  // staged, the previous front after Execute()
+      bool full;
+      size_t rectCount = 0;
+      size_t pixels = 0;
+  };
+
+  class CommandJob : public DisplayJob {
+    public:
+      CommandJob(Napi::Env env, SPIDisplay* display, uint8_t cmd, std::vector<uint8_t>&& params)
+        : DisplayJob(env, display), cmd(cmd), params(std::move(params)) {}
+
+      void Execute(SPIDevice* device) override;
+      Napi::Value Result(Napi::Env env) override { return env.Undefined(); }
+
+    private:
+      uint8_t cmd;
+      std::vector<uint8_t> params;
+  };
+};
+
+#endif
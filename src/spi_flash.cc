@@ -0,0 +1,631 @@
+#include "spi_flash.h"
+#include "spi_addon.h"
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+namespace {
+  const uint8_t CMD_WREN = 0x06;
+  const uint8_t CMD_RDSR = 0x05;
+  const uint8_t CMD_RDID = 0x9f;
+  const uint8_t CMD_RDSFDP = 0x5a;
+  const uint8_t STATUS_WIP = 0x01;
+
+  // Datasheet maxima are a few ms per page and a few s per 64 KiB block
+  const uint64_t PROGRAM_TIMEOUT_NS = 50000000;
+  const uint64_t PROGRAM_POLL_NS = 20000;
+  const uint64_t ERASE_TIMEOUT_NS = 500000000;
+  const uint64_t ERASE_TIMEOUT_NS_PER_KIB = 50000000;
+  const uint64_t ERASE_POLL_NS = 500000;
+
+  uint64_t NowNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+  }
+
+  // 3 byte opcodes and their 4 byte address counterparts
+  uint8_t ReadOpcode(uint8_t nbits, size_t addressBytes) {
+    if (addressBytes == 4) {
+      return nbits == 4 ? 0x6c : nbits == 2 ? 0x3c : 0x0c;
+    }
+
+    return nbits == 4 ? 0x6b : nbits == 2 ? 0x3b : 0x0b;
+  }
+
+  uint8_t EraseOpcode4(uint8_t opcode) {
+    switch (opcode) {
+      case 0x20: return 0x21;
+      case 0x52: return 0x5c;
+      case 0xd8: return 0xdc;
+      default: return opcode;
+    }
+  }
+
+  uint32_t Dword(const std::vector<uint8_t>& table, size_t index) {
+    if (table.size() < (index + 1) * 4) {
+      return 0;
+    }
+
+    const uint8_t* p = table.data() + index * 4;
+    return p[0] | p[1] << 8 | p[2] << 16 | static_cast<uint32_t>(p[3]) << 24;
+  }
+
+  uint32_t ParseAddress(Napi::Env env, const Napi::Value& val) {
+    if (!val.IsNumber()) {
+      throw Napi::TypeError::New(env, "Flash address must be a number");
+    }
+
+    double address = val.As<Napi::Number>().DoubleValue();
+
+    if (!(address >= 0 && address <= UINT32_MAX) || address != static_cast<uint32_t>(address)) {
+      throw Napi::RangeError::New(env, "Flash address must be an integer between 0 and 2^32 - 1");
+    }
+
+    return static_cast<uint32_t>(address);
+  }
+}
+
+Napi::Object SPIFlash::Init(Napi::Env env, Napi::Object exports) {
+  Napi::Function func = DefineClass(env, "SPIFlash", {
+    InstanceMethod("probe", &SPIFlash::Probe),
+    InstanceMethod("read", &SPIFlash::Read),
+    InstanceMethod("program", &SPIFlash::Program),
+    InstanceMethod("erase", &SPIFlash::Erase),
+    InstanceAccessor("size", &SPIFlash::GetSize, nullptr)
+  });
+
+  SPIAddon::Get(env)->flash = Napi::Persistent(func);
+
+  exports.Set("SPIFlash", func);
+  return exports;
+}
+
+// new SPIFlash(device, { size, pageSize, addressBytes })
+SPIFlash::SPIFlash(const Napi::CallbackInfo& info)
+  : Napi::ObjectWrap<SPIFlash>(info) {
+
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1 || !info[0].IsObject()) {
+    throw Napi::TypeError::New(env, "SPIDevice expected");
+  }
+
+  Napi::Object deviceObj = info[0].As<Napi::Object>();
+
+  try {
+    device = SPIDevice::Unwrap(deviceObj);
+  }
+  catch (const Napi::Error&) {
+    throw Napi::TypeError::New(env, "SPIDevice expected");
+  }
+
+  deviceRef = Napi::Persistent(deviceObj);
+
+  // Defaults of most parts, probe() reads the real ones from SFDP
+  geometry.eraseTypes = { { 65536, 0xd8 }, { 32768, 0x52 }, { 4096, 0x20 } };
+
+  if (info.Length() < 2 || !info[1].IsObject()) {
+    return;
+  }
+
+  Napi::Object options = info[1].As<Napi::Object>();
+
+  if (options.Has("size")) {
+    if (!options.Get("size").IsNumber() || options.Get("size").As<Napi::Number>().DoubleValue() < 1) {
+      throw Napi::TypeError::New(env, "'size' must be a positive number of bytes");
+    }
+
+    geometry.size = static_cast<size_t>(options.Get("size").As<Napi::Number>().Int64Value());
+    geometry.addressBytes = geometry.size > (1u << 24) ? 4 : 3;
+  }
+
+  if (options.Has("pageSize")) {
+    int64_t pageSize = options.Get("pageSize").IsNumber()
+      ? options.Get("pageSize").As<Napi::Number>().Int64Value() : 0;
+
+    if (pageSize < 1 || (pageSize & (pageSize - 1)) != 0) {
+      throw Napi::RangeError::New(env, "'pageSize' must be a power of 2");
+    }
+
+    geometry.pageSize = static_cast<size_t>(pageSize);
+  }
+
+  if (options.Has("addressBytes")) {
+    int64_t bytes = options.Get("addressBytes").IsNumber()
+      ? options.Get("addressBytes").As<Napi::Number>().Int64Value() : 0;
+
+    if (bytes != 3 && bytes != 4) {
+      throw Napi::RangeError::New(env, "'addressBytes' must be 3 or 4");
+    }
+
+    geometry.addressBytes = static_cast<size_t>(bytes);
+    fixedAddressBytes = true;
+  }
+}
+
+Napi::Value SPIFlash::GetSize(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  return geometry.size ? Napi::Number::New(env, static_cast<double>(geometry.size)) : env.Null();
+}
+
+void SPIFlash::CheckRange(Napi::Env env, double address, double length) {
+  // Addresses are 32 bit, also when the size is not known
+  if (address + length > 4294967296.0) {
+    throw Napi::RangeError::New(env, "Range exceeds the 32 bit address space");
+  }
+
+  if (geometry.size != 0 && address + length > geometry.size) {
+    throw Napi::RangeError::New(env, "Range exceeds the flash size (" +
+      std::to_string(geometry.size) + " bytes)");
+  }
+}
+
+// One command frame: opcode, address, dummy bytes, then the data phase
+// on `nbits` lines. The caller holds the device mutex.
+int SPIFlash::Command(SPIDevice* device, const Geometry& geometry, uint8_t opcode,
+    const uint32_t* address, size_t dummy, const uint8_t* tx, uint8_t* rx, size_t len, uint8_t nbits) {
+
+  uint8_t header[1 + 4 + 1] = { opcode };
+  size_t headerLen = 1;
+
+  if (address != nullptr) {
+    for (size_t i = geometry.addressBytes; i-- > 0;) {
+      header[headerLen++] = static_cast<uint8_t>(*address >> (8 * i));
+    }
+  }
+
+  for (size_t i = 0; i < dummy; i++) {
+    header[headerLen++] = 0;
+  }
+
+  spi_ioc_transfer transfers[2] = {};
+  transfers[0].tx_buf = (unsigned long)header;
+  transfers[0].len = static_cast<uint32_t>(headerLen);
+
+  if (len > 0) {
+    transfers[1].tx_buf = (unsigned long)tx;
+    transfers[1].rx_buf = (unsigned long)rx;
+    transfers[1].len = static_cast<uint32_t>(len);
+    transfers[1].tx_nbits = tx ? nbits : 0;
+    transfers[1].rx_nbits = rx ? nbits : 0;
+  }
+
+  std::vector<spi_ioc_transfer> message(transfers, transfers + (len > 0 ? 2 : 1));
+  return device->RunTransfers(message);
+}
+
+// WREN, then opcode, address and data, in one ioctl: CS is released
+// after WREN so the write enable latch is set when the command starts.
+int SPIFlash::WriteCommand(SPIDevice* device, const Geometry& geometry, uint8_t opcode,
+    uint32_t address, const uint8_t* data, size_t len) {
+
+  uint8_t header[1 + 4] = { opcode };
+  size_t headerLen = 1;
+  uint8_t wren = CMD_WREN;
+
+  for (size_t i = geometry.addressBytes; i-- > 0;) {
+    header[headerLen++] = static_cast<uint8_t>(address >> (8 * i));
+  }
+
+  std::vector<spi_ioc_transfer> message(len > 0 ? 3 : 2);
+  message[0] = {};
+  message[0].tx_buf = (unsigned long)&wren;
+  message[0].len = 1;
+  message[0].cs_change = 1;
+
+  message[1] = {};
+  message[1].tx_buf = (unsigned long)header;
+  message[1].len = static_cast<uint32_t>(headerLen);
+
+  if (len > 0) {
+    message[2] = {};
+    message[2].tx_buf = (unsigned long)data;
+    message[2].len = static_cast<uint32_t>(len);
+  }
+
+  return device->RunTransfers(message);
+}
+
+// Polls the status register until the write in progress bit clears,
+// without a round trip to JS. Returns 0, an errno value, or ETIMEDOUT.
+// Sleeps between polls with the device mutex released, like transferUntil().
+int SPIFlash::WaitReady(SPIDevice* device, uint64_t timeoutNs, uint64_t pollNs) {
+  uint64_t deadline = NowNs() + timeoutNs;
+  uint8_t status = 0;
+
+  for (;;) {
+    int err = Command(device, Geometry(), CMD_RDSR, nullptr, 0, nullptr, &status, 1, 1);
+
+    if (err != 0) {
+      return err;
+    }
+
+    if (!(status & STATUS_WIP)) {
+      return 0;
+    }
+
+    if (NowNs() > deadline) {
+      return ETIMEDOUT;
+    }
+
+    device->SleepUnlocked(pollNs);
+  }
+}
+
+// Dual and quad reads need SPI_RX_DUAL / SPI_RX_QUAD in the 32 bit mode,
+// the low byte (the mode of setMode()) is left alone.
+int SPIFlash::EnableLines(SPIDevice* device, uint8_t nbits) {
+  if (nbits < 2) {
+    return 0;
+  }
+
+  uint32_t mode = 0;
+  uint32_t bit = nbits == 4 ? SPI_RX_QUAD : SPI_RX_DUAL;
+
+  if (device->backend->Ioctl(SPI_IOC_RD_MODE32, &mode) == -1) {
+    return errno;
+  }
+
+  if (mode & bit) {
+    return 0;
+  }
+
+  mode |= bit;
+
+  if (device->backend->Ioctl(SPI_IOC_WR_MODE32, &mode) == -1) {
+    return errno;
+  }
+
+  return 0;
+}
+
+void SPIFlash::FlashJob::SetFlashError(int err) {
+  if (err == ETIMEDOUT) {
+    error = "SPI flash is still busy (WIP) after the timeout";
+    code = "ERR_SPI_FLASH_TIMEOUT";
+    return;
+  }
+
+  SetTransferError(err);
+}
+
+Napi::Value SPIFlash::Probe(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  SPIDevice::JobOptions options = SPIDevice::ParseJobOptions(env, info[0]);
+  return device->QueueJob(env, new ProbeJob(env, this), options);
+}
+
+// JEDEC ID, then the SFDP header and the basic flash parameter table
+void SPIFlash::ProbeJob::Execute(SPIDevice* device) {
+  int err = Command(device, geometry, CMD_RDID, nullptr, 0, nullptr, id, sizeof(id), 1);
+
+  if (err == 0) {
+    uint32_t at = 0;
+    Geometry sfdp;
+    sfdp.addressBytes = 3;  // RDSFDP always takes 3 address bytes
+    err = Command(device, sfdp, CMD_RDSFDP, &at, 1, nullptr, header, sizeof(header), 1);
+
+    if (err == 0 && std::memcmp(header, "SFDP", 4) == 0) {
+      size_t dwords = std::min<size_t>(header[11], 16);
+      at = header[12] | header[13] << 8 | header[14] << 16;
+      basic.resize(dwords * 4);
+
+      if (dwords > 0) {
+        err = Command(device, sfdp, CMD_RDSFDP, &at, 1, nullptr, basic.data(), basic.size(), 1);
+      }
+    }
+  }
+
+  if (err != 0) {
+    SetFlashError(err);
+  }
+}
+
+Napi::Value SPIFlash::ProbeJob::Result(Napi::Env env) {
+  Napi::Object result = Napi::Object::New(env);
+  result.Set("jedecId", Napi::Buffer<uint8_t>::Copy(env, id, sizeof(id)));
+  result.Set("manufacturer", Napi::Number::New(env, id[0]));
+  result.Set("memoryType", Napi::Number::New(env, id[1]));
+  result.Set("capacity", Napi::Number::New(env, id[2]));
+
+  Geometry& g = flash->geometry;
+  bool sfdp = !basic.empty();
+  bool dual = false;
+  bool quad = false;
+
+  if (sfdp) {
+    uint32_t params = Dword(basic, 0);
+    uint32_t density = Dword(basic, 1);
+
+    // Density in bits: n + 1, or 2^n with the top bit set
+    uint64_t bits = (density & 0x80000000u)
+      ? (1ull << std::min<uint32_t>(density & 0x7fffffff, 63))
+      : static_cast<uint64_t>(density) + 1;
+
+    g.size = static_cast<size_t>(bits / 8);
+    dual = params & (1u << 16);
+    quad = params & (1u << 22);
+
+    std::vector<EraseType> types;
+
+    for (size_t i = 0; i < 4; i++) {
+      uint32_t dword = Dword(basic, 7 + i / 2);
+      uint8_t exponent = static_cast<uint8_t>(dword >> (16 * (i % 2)));
+      uint8_t opcode = static_cast<uint8_t>(dword >> (16 * (i % 2) + 8));
+
+      if (exponent != 0 && exponent < 32) {
+        types.push_back({ static_cast<size_t>(1) << exponent, opcode });
+      }
+    }
+
+    if (!types.empty()) {
+      std::sort(types.begin(), types.end(),
+        [](const EraseType& a, const EraseType& b) { return a.size > b.size; });
+      g.eraseTypes = types;
+    }
+  }
+  else if (id[2] >= 0x10 && id[2] <= 0x20) {
+    g.size = static_cast<size_t>(1) << id[2];  // common: capacity byte is log2 of the size
+  }
+
+  if (!flash->fixedAddressBytes && g.size != 0) {
+    g.addressBytes = g.size > (1u << 24) ? 4 : 3;
+  }
+
+  Napi::Array eraseSizes = Napi::Array::New(env, g.eraseTypes.size());
+
+  for (size_t i = 0; i < g.eraseTypes.size(); i++) {
+    eraseSizes.Set(i, Napi::Number::New(env, static_cast<double>(g.eraseTypes[i].size)));
+  }
+
+  result.Set("size", g.size ? Napi::Number::New(env, static_cast<double>(g.size)) : env.Null());
+  result.Set("sfdp", Napi::Boolean::New(env, sfdp));
+  result.Set("dual", Napi::Boolean::New(env, dual));
+  result.Set("quad", Napi::Boolean::New(env, quad));
+  result.Set("addressBytes", Napi::Number::New(env, static_cast<double>(g.addressBytes)));
+  result.Set("eraseSizes", eraseSizes);
+
+  return result;
+}
+
+// read(address, length[, { mode, into, fd, fdOffset, ...queue options }])
+Napi::Value SPIFlash::Read(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  uint32_t address = ParseAddress(env, info[0]);
+
+  if (!info[1].IsNumber() || info[1].As<Napi::Number>().DoubleValue() < 1) {
+    throw Napi::TypeError::New(env, "Length must be a positive number of bytes");
+  }
+
+  size_t length = static_cast<size_t>(info[1].As<Napi::Number>().Int64Value());
+  CheckRange(env, address, static_cast<double>(length));
+
+  uint8_t nbits = 1;
+  Napi::Object options = info[2].IsObject() ? info[2].As<Napi::Object>() : Napi::Object::New(env);
+
+  if (options.Has("mode")) {
+    Napi::Value mode = options.Get("mode");
+    std::string name = mode.IsString() ? mode.As<Napi::String>().Utf8Value() : "";
+
+    if (name != "single" && name != "dual" && name != "quad") {
+      throw Napi::TypeError::New(env, "'mode' must be 'single', 'dual' or 'quad'");
+    }
+
+    nbits = name == "quad" ? 4 : name == "dual" ? 2 : 1;
+  }
+
+  SPIDevice::JobOptions queueOptions = SPIDevice::ParseJobOptions(env, info[2]);
+  ReadJob* job = new ReadJob(env, this, address, length, nbits);
+
+  try {
+    if (options.Has("fd") && !options.Get("fd").IsUndefined()) {
+      if (!options.Get("fd").IsNumber() || options.Get("fd").As<Napi::Number>().Int32Value() < 0) {
+        throw Napi::TypeError::New(env, "'fd' must be a file descriptor");
+      }
+
+      job->fd = options.Get("fd").As<Napi::Number>().Int32Value();
+
+      if (options.Has("fdOffset")) {
+        if (!options.Get("fdOffset").IsNumber() || options.Get("fdOffset").As<Napi::Number>().Int64Value() < 0) {
+          throw Napi::TypeError::New(env, "'fdOffset' must be a positive number");
+        }
+
+        job->fdOffset = options.Get("fdOffset").As<Napi::Number>().Int64Value();
+      }
+    }
+    else {
+      Napi::Object into;
+
+      if (options.Has("into") && !options.Get("into").IsUndefined()) {
+        Napi::Value val = options.Get("into");
+
+        if (!val.IsTypedArray()) {
+          throw Napi::TypeError::New(env, "'into' must be a Buffer or TypedArray");
+        }
+
+        Napi::TypedArray array = val.As<Napi::TypedArray>();
+
+        if (array.ByteLength() < length) {
+          throw Napi::RangeError::New(env, "'into' is smaller than the read length");
+        }
+
+        void* raw = nullptr;
+        napi_get_typedarray_info(env, array, nullptr, nullptr, &raw, nullptr, nullptr);
+        job->into = static_cast<uint8_t*>(raw);
+        into = array;
+      }
+      else {
+        Napi::Buffer<uint8_t> buffer = Napi::Buffer<uint8_t>::New(env, length);
+        job->into = buffer.Data();
+        into = buffer;
+      }
+
+      job->intoRef = Napi::Persistent(into);
+    }
+  }
+  catch (...) {
+    delete job;
+    throw;
+  }
+
+  return device->QueueJob(env, job, queueOptions);
+}
+
+// Fast read in chunks of the spidev bufsiz, each its own command, straight
+// into the destination memory, or through a scratch buffer into the fd.
+void SPIFlash::ReadJob::Execute(SPIDevice* device) {
+  // The header goes out of the tx buffer, the data fills the rx buffer
+  size_t chunk = std::max(device->bufsiz - device->bufsiz % SPI_DMA_MINALIGN, SPI_DMA_MINALIGN);
+  uint8_t opcode = ReadOpcode(nbits, geometry.addressBytes);
+  std::vector<uint8_t> scratch(into ? 0 : std::min(chunk, length));
+
+  int err = EnableLines(device, nbits);
+
+  for (size_t done = 0; err == 0 && done < length;) {
+    size_t n = std::min(chunk, length - done);
+    uint32_t at = address + static_cast<uint32_t>(done);
+    uint8_t* dst = into ? into + done : scratch.data();
+
+    err = Command(device, geometry, opcode, &at, 1, nullptr, dst, n, nbits);
+
+    if (err != 0) {
+      break;
+    }
+
+    for (size_t written = 0; fd >= 0 && written < n;) {
+      ssize_t w = fdOffset >= 0
+        ? pwrite(fd, dst + written, n - written, fdOffset + done + written)
+        : write(fd, dst + written, n - written);
+
+      if (w < 0 && errno == EINTR) {
+        continue;
+      }
+
+      if (w <= 0) {
+        error = std::string("Failed to write flash data: ") + std::strerror(w < 0 ? errno : EIO);
+        return;
+      }
+
+      written += static_cast<size_t>(w);
+    }
+
+    done += n;
+    device->YieldToRealtime();
+  }
+
+  if (err != 0) {
+    SetFlashError(err);
+  }
+}
+
+Napi::Value SPIFlash::ReadJob::Result(Napi::Env env) {
+  if (fd >= 0) {
+    return Napi::Number::New(env, static_cast<double>(length));
+  }
+
+  return intoRef.Value();
+}
+
+// program(address, data): page program, split at page boundaries
+Napi::Value SPIFlash::Program(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  uint32_t address = ParseAddress(env, info[0]);
+
+  if (!info[1].IsBuffer() || info[1].As<Napi::Buffer<uint8_t>>().Length() == 0) {
+    throw Napi::TypeError::New(env, "Non-empty data Buffer expected");
+  }
+
+  Napi::Buffer<uint8_t> data = info[1].As<Napi::Buffer<uint8_t>>();
+  CheckRange(env, address, static_cast<double>(data.Length()));
+
+  SPIDevice::JobOptions options = SPIDevice::ParseJobOptions(env, info[2]);
+  return device->QueueJob(env, new ProgramJob(env, this, address, data), options);
+}
+
+// Each page: WREN and PAGE PROGRAM in one ioctl, then native WIP polling
+void SPIFlash::ProgramJob::Execute(SPIDevice* device) {
+  uint8_t opcode = geometry.addressBytes == 4 ? 0x12 : 0x02;
+  size_t overhead = SPIBufsizUse::Align(1) + SPIBufsizUse::Align(1 + geometry.addressBytes);
+  size_t room = device->bufsiz > overhead ? device->bufsiz - overhead : 0;
+  size_t limit = std::max<size_t>(room - room % SPI_DMA_MINALIGN, 1);
+
+  for (size_t done = 0; done < length;) {
+    uint32_t at = address + static_cast<uint32_t>(done);
+    size_t pageLeft = geometry.pageSize - (at & (geometry.pageSize - 1));
+    size_t n = std::min({ pageLeft, length - done, limit });
+
+    int err = WriteCommand(device, geometry, opcode, at, data + done, n);
+
+    if (err == 0) {
+      err = WaitReady(device, PROGRAM_TIMEOUT_NS, PROGRAM_POLL_NS);
+    }
+
+    if (err != 0) {
+      SetFlashError(err);
+      return;
+    }
+
+    done += n;
+    device->YieldToRealtime();
+  }
+}
+
+// erase(address, length): both aligned to the smallest erase size
+Napi::Value SPIFlash::Erase(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  uint32_t address = ParseAddress(env, info[0]);
+
+  if (!info[1].IsNumber() || info[1].As<Napi::Number>().DoubleValue() < 1) {
+    throw Napi::TypeError::New(env, "Length must be a positive number of bytes");
+  }
+
+  size_t length = static_cast<size_t>(info[1].As<Napi::Number>().Int64Value());
+  size_t unit = geometry.eraseTypes.back().size;
+
+  if (address % unit != 0 || length % unit != 0) {
+    throw Napi::RangeError::New(env, "Erase address and length must be multiples of " +
+      std::to_string(unit) + " bytes");
+  }
+
+  CheckRange(env, address, static_cast<double>(length));
+
+  SPIDevice::JobOptions options = SPIDevice::ParseJobOptions(env, info[2]);
+  return device->QueueJob(env, new EraseJob(env, this, address, length), options);
+}
+
+// Largest aligned erase type first, e.g. 64 KiB blocks with 4 KiB sectors at the edges
+void SPIFlash::EraseJob::Execute(SPIDevice* device) {
+  for (size_t done = 0; done < length;) {
+    uint32_t at = address + static_cast<uint32_t>(done);
+    const EraseType* type = &geometry.eraseTypes.back();
+
+    for (const EraseType& candidate : geometry.eraseTypes) {
+      if (at % candidate.size == 0 && length - done >= candidate.size) {
+        type = &candidate;
+        break;
+      }
+    }
+
+    uint8_t opcode = geometry.addressBytes == 4 ? EraseOpcode4(type->opcode) : type->opcode;
+    int err = WriteCommand(device, geometry, opcode, at, nullptr, 0);
+
+    if (err == 0) {
+      err = WaitReady(device, ERASE_TIMEOUT_NS + ERASE_TIMEOUT_NS_PER_KIB * (type->size / 1024),
+        ERASE_POLL_NS);
+    }
+
+    if (err != 0) {
+      SetFlashError(err);
+      return;
+    }
+
+    done += type->size;
+    device->YieldToRealtime();
+  }
+}
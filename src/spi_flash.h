@@ -0,0 +1,128 @@
+#ifndef SPI_FLASH_H
+#define SPI_FLASH_H
+
+#include "spi_device.h"
+
+// SPI NOR flash commands on top of an SPIDevice. Every operation is a
+// queued job of the device, so it runs in order with the other transfers,
+// and the JEDEC command sequences, chunking and status polling run
+// natively on the executor thread: a read of many megabytes or a long
+// program is one call and one Promise.
+class SPIFlash : public Napi::ObjectWrap<SPIFlash> {
+
+public:
+  static Napi::Object Init(Napi::Env env, Napi::Object exports);
+  SPIFlash(const Napi::CallbackInfo& info);
+
+  Napi::Value Probe(const Napi::CallbackInfo& info);
+  Napi::Value Read(const Napi::CallbackInfo& info);
+  Napi::Value Program(const Napi::CallbackInfo& info);
+  Napi::Value Erase(const Napi::CallbackInfo& info);
+  Napi::Value GetSize(const Napi::CallbackInfo& info);
+
+private:
+  struct EraseType {
+    size_t size;
+    uint8_t opcode;
+  };
+
+  // Copied into each job on the JS thread, updated by probe()
+  struct Geometry {
+    size_t size = 0;  // bytes, 0 while unknown
+    size_t pageSize = 256;
+    size_t addressBytes = 3;
+    std::vector<EraseType> eraseTypes;  // largest first
+  };
+
+  SPIDevice* device = nullptr;
+  Napi::ObjectReference deviceRef;
+  Geometry geometry;
+  bool fixedAddressBytes = false;  // given as an option, probe() keeps it
+
+  static int Command(SPIDevice* device, const Geometry& geometry, uint8_t opcode,
+    const uint32_t* address, size_t dummy, const uint8_t* tx, uint8_t* rx, size_t len, uint8_t nbits);
+  static int WriteCommand(SPIDevice* device, const Geometry& geometry, uint8_t opcode,
+    uint32_t address, const uint8_t* data, size_t len);
+  static int WaitReady(SPIDevice* device, uint64_t timeoutNs, uint64_t pollNs);
+  static int EnableLines(SPIDevice* device, uint8_t nbits);
+  void CheckRange(Napi::Env env, double address, double length);
+
+  class FlashJob : public SPIDevice::Job {
+    public:
+      FlashJob(Napi::Env env, SPIFlash* flash)
+        : SPIDevice::Job(env),
+        flash(flash),
+        flashRef(Napi::Persistent(flash->Value())),
+        geometry(flash->geometry) {}
+
+    protected:
+      void SetFlashError(int err);
+
+      SPIFlash* flash;
+      Napi::ObjectReference flashRef;  // keeps the flash alive while queued
+      Geometry geometry;
+  };
+
+  class ProbeJob : public FlashJob {
+    public:
+      using FlashJob::FlashJob;
+
+      void Execute(SPIDevice* device) override;
+      Napi::Value Result(Napi::Env env) override;
+
+    private:
+      uint8_t id[3] = {};
+      uint8_t header[16] = {};
+      std::vector<uint8_t> basic;  // basic flash parameter table
+  };
+
+  class ReadJob : public FlashJob {
+    public:
+      ReadJob(Napi::Env env, SPIFlash* flash, uint32_t address, size_t length, uint8_t nbits)
+        : FlashJob(env, flash), address(address), length(length), nbits(nbits) {}
+
+      void Execute(SPIDevice* device) override;
+      Napi::Value Result(Napi::Env env) override;
+
+      uint8_t* into = nullptr;  // destination memory, or
+      int fd = -1;              // a file descriptor
+      int64_t fdOffset = -1;    // pwrite() offset, -1: write() at the file position
+      Napi::ObjectReference intoRef;
+
+    private:
+      uint32_t address;
+      size_t length;
+      uint8_t nbits;
+  };
+
+  class ProgramJob : public FlashJob {
+    public:
+      ProgramJob(Napi::Env env, SPIFlash* flash, uint32_t address, Napi::Buffer<uint8_t> data)
+        : FlashJob(env, flash), address(address), data(data.Data()), length(data.Length()),
+        dataRef(Napi::Persistent(static_cast<Napi::Object>(data))) {}
+
+      void Execute(SPIDevice* device) override;
+      Napi::Value Result(Napi::Env env) override { return env.Undefined(); }
+
+    private:
+      uint32_t address;
+      const uint8_t* data;
+      size_t length;
+      Napi::ObjectReference dataRef;
+  };
+
+  class EraseJob : public FlashJob {
+    public:
+      EraseJob(Napi::Env env, SPIFlash* flash, uint32_t address, size_t length)
+        : FlashJob(env, flash), address(address), length(length) {}
+
+      void Execute(SPIDevice* device) override;
+      Napi::Value Result(Napi::Env env) override { return env.Undefined(); }
+
+    private:
+      uint32_t address;
+      size_t length;
+  };
+};
+
+#endif
@@ -0,0 +1,331 @@
+#include "spi_backend.h"
+#include <time.h>
+#include <algorithm>
+#include <cstring>
+
+namespace {
+  // Shortened from typical datasheet values, long enough to be polled
+  const uint64_t PAGE_PROGRAM_NS = 300000;
+  const uint64_t SECTOR_ERASE_NS = 2000000;
+  const uint64_t BLOCK_ERASE_NS = 5000000;
+  const uint64_t CHIP_ERASE_NS = 20000000;
+
+  const uint8_t STATUS_WIP = 0x01;
+  const uint8_t STATUS_WEL = 0x02;
+
+  // Offset of the basic flash parameter table in the SFDP space
+  const size_t SFDP_BASIC_TABLE = 0x80;
+  const size_t SFDP_BASIC_DWORDS = 9;
+
+  uint64_t NowNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+  }
+
+  void PutDword(std::vector<uint8_t>& table, size_t offset, uint32_t value) {
+    for (size_t i = 0; i < 4; i++) {
+      table[offset + i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+  }
+}
+
+SPIFlashBackend::SPIFlashBackend(size_t bufsiz, size_t size)
+  : SPILoopbackBackend(bufsiz),
+    memory(size, 0xff),
+    sfdp(SFDP_BASIC_TABLE + SFDP_BASIC_DWORDS * 4, 0xff) {
+
+  uint8_t log2 = 0;
+
+  while ((static_cast<size_t>(1) << log2) < size) {
+    log2++;
+  }
+
+  // Winbond manufacturer and memory type, capacity as 2^n bytes
+  jedecId[0] = 0xef;
+  jedecId[1] = 0x40;
+  jedecId[2] = log2;
+
+  // SFDP header and one parameter header (JESD216), little endian
+  const uint8_t head[16] = {
+    'S', 'F', 'D', 'P', 0x06, 0x01, 0x00, 0xff,
+    0x00, 0x06, 0x01, SFDP_BASIC_DWORDS, SFDP_BASIC_TABLE, 0x00, 0x00, 0xff
+  };
+  std::copy(head, head + sizeof(head), sfdp.begin());
+
+  bool over16M = size > (1u << 24);
+
+  // 1: 4 KiB erase 0x20, 1-1-2 and 1-1-4 fast read, 3 or 4 byte addresses
+  PutDword(sfdp, SFDP_BASIC_TABLE, 0x01 | 0x04 | 0x20 << 8 | 1u << 16 |
+    (over16M ? 1u : 0u) << 17 | 1u << 22);
+  // 2: density in bits - 1
+  PutDword(sfdp, SFDP_BASIC_TABLE + 4, static_cast<uint32_t>(size * 8 - 1));
+  // 3: 1-1-4 fast read 0x6B with 8 dummy clocks
+  PutDword(sfdp, SFDP_BASIC_TABLE + 8, (8u | 0x6bu << 8) << 16);
+  // 4: 1-1-2 fast read 0x3B with 8 dummy clocks
+  PutDword(sfdp, SFDP_BASIC_TABLE + 12, 8u | 0x3bu << 8);
+  PutDword(sfdp, SFDP_BASIC_TABLE + 16, 0);
+  PutDword(sfdp, SFDP_BASIC_TABLE + 20, 0);
+  PutDword(sfdp, SFDP_BASIC_TABLE + 24, 0);
+  // 8, 9: erase types 4 KiB 0x20, 32 KiB 0x52, 64 KiB 0xD8
+  PutDword(sfdp, SFDP_BASIC_TABLE + 28, 12u | 0x20u << 8 | 15u << 16 | 0x52u << 24);
+  PutDword(sfdp, SFDP_BASIC_TABLE + 32, 16u | 0xd8u << 8);
+}
+
+bool SPIFlashBackend::Busy() const {
+  return NowNs() < busyUntilNs;
+}
+
+void SPIFlashBackend::Start(uint8_t op) {
+  opcode = op;
+  headerLen = 0;
+  dataCount = 0;
+  phase = PHASE_IGNORE;
+
+  size_t a3 = address4 ? 4 : 3;
+
+  // Only the status register answers while a program or erase runs
+  if (Busy() && op != 0x05) {
+    return;
+  }
+
+  switch (op) {
+    case 0x06:  // WREN
+      writeEnabled = true;
+      return;
+
+    case 0x04:  // WRDI
+      writeEnabled = false;
+      return;
+
+    case 0xb7:  // EN4B
+    case 0xe9:  // EX4B
+      address4 = op == 0xb7;
+      return;
+
+    case 0x05:  // RDSR
+    case 0x9f:  // RDID
+      phase = PHASE_DATA;
+      return;
+
+    case 0x5a:  // RDSFDP
+      addressBytes = 3;
+      headerNeeded = 4;
+      break;
+
+    case 0x03:  // READ
+      addressBytes = a3;
+      headerNeeded = a3;
+      break;
+
+    case 0x0b:  // FAST_READ, dual and quad output
+    case 0x3b:
+    case 0x6b:
+      addressBytes = a3;
+      headerNeeded = a3 + 1;
+      break;
+
+    case 0x13:  // 4 byte address variants
+      addressBytes = 4;
+      headerNeeded = 4;
+      break;
+
+    case 0x0c:
+    case 0x3c:
+    case 0x6c:
+      addressBytes = 4;
+      headerNeeded = 5;
+      break;
+
+    case 0x02:  // PP
+    case 0x20:  // SE 4 KiB
+    case 0x52:  // BE 32 KiB
+    case 0xd8:  // BE 64 KiB
+    case 0x12:
+    case 0x21:
+    case 0x5c:
+    case 0xdc:
+      if (!writeEnabled) {
+        return;
+      }
+
+      addressBytes = (op == 0x12 || op == 0x21 || op == 0x5c || op == 0xdc) ? 4 : a3;
+      headerNeeded = addressBytes;
+      break;
+
+    case 0xc7:  // CE
+    case 0x60:
+      if (writeEnabled) {
+        phase = PHASE_DATA;
+      }
+      return;
+
+    default:
+      return;
+  }
+
+  phase = PHASE_HEADER;
+}
+
+void SPIFlashBackend::Exchange(const struct spi_ioc_transfer& tr) {
+  const uint8_t* tx = reinterpret_cast<const uint8_t*>(tr.tx_buf);
+  uint8_t* rx = reinterpret_cast<uint8_t*>(tr.rx_buf);
+  size_t i = 0;
+
+  while (i < tr.len) {
+    if (phase == PHASE_DATA) {
+      Data(tx ? tx + i : nullptr, rx ? rx + i : nullptr, tr.len - i);
+      return;
+    }
+
+    if (phase == PHASE_IGNORE) {
+      if (rx) {
+        std::memset(rx + i, 0xff, tr.len - i);
+      }
+      return;
+    }
+
+    uint8_t in = tx ? tx[i] : 0;
+
+    if (rx) {
+      rx[i] = 0xff;
+    }
+
+    if (phase == PHASE_OPCODE) {
+      Start(in);
+    }
+    else {
+      header[headerLen++] = in;
+
+      if (headerLen == headerNeeded) {
+        address = 0;
+
+        for (size_t j = 0; j < addressBytes; j++) {
+          address = address << 8 | header[j];
+        }
+
+        phase = PHASE_DATA;
+      }
+    }
+
+    i++;
+  }
+}
+
+void SPIFlashBackend::Data(const uint8_t* tx, uint8_t* rx, size_t len) {
+  size_t size = memory.size();
+
+  switch (opcode) {
+    case 0x05:
+      if (rx) {
+        std::memset(rx, (Busy() ? STATUS_WIP : 0) | (writeEnabled ? STATUS_WEL : 0), len);
+      }
+      break;
+
+    case 0x9f:
+      for (size_t i = 0; rx && i < len; i++) {
+        rx[i] = dataCount + i < 3 ? jedecId[dataCount + i] : 0;
+      }
+      break;
+
+    case 0x5a:
+      for (size_t i = 0; rx && i < len; i++) {
+        size_t at = address + dataCount + i;
+        rx[i] = at < sfdp.size() ? sfdp[at] : 0xff;
+      }
+      break;
+
+    case 0x02:
+    case 0x12: {
+      // Wraps within the page, like the real command
+      size_t page = (address % size) & ~(PAGE_SIZE - 1);
+
+      for (size_t i = 0; tx && i < len; i++) {
+        memory[page + ((address + dataCount + i) & (PAGE_SIZE - 1))] &= tx[i];
+      }
+
+      if (rx) {
+        std::memset(rx, 0xff, len);
+      }
+      break;
+    }
+
+    case 0xc7:
+    case 0x60:
+    case 0x20:
+    case 0x52:
+    case 0xd8:
+    case 0x21:
+    case 0x5c:
+    case 0xdc:
+      if (rx) {
+        std::memset(rx, 0xff, len);
+      }
+      break;
+
+    default: {
+      // Reads wrap around at the end of the array
+      size_t at = (address + dataCount) % size;
+      size_t done = 0;
+
+      while (rx && done < len) {
+        size_t n = std::min(len - done, size - at);
+        std::memcpy(rx + done, memory.data() + at, n);
+        done += n;
+        at = 0;
+      }
+      break;
+    }
+  }
+
+  dataCount += len;
+}
+
+void SPIFlashBackend::Erase(uint32_t start, size_t size, uint64_t busyNs) {
+  start = static_cast<uint32_t>((start % memory.size()) & ~(size - 1));
+  std::fill(memory.begin() + start, memory.begin() + std::min(memory.size(), start + size), 0xff);
+  busyUntilNs = NowNs() + busyNs;
+  writeEnabled = false;
+}
+
+// Program and erase commands execute when CS goes high
+void SPIFlashBackend::Deselect() {
+  if (phase == PHASE_DATA) {
+    switch (opcode) {
+      case 0x02:
+      case 0x12:
+        if (dataCount > 0) {
+          busyUntilNs = NowNs() + PAGE_PROGRAM_NS;
+          writeEnabled = false;
+        }
+        break;
+
+      case 0x20:
+      case 0x21:
+        Erase(address, 4096, SECTOR_ERASE_NS);
+        break;
+
+      case 0x52:
+      case 0x5c:
+        Erase(address, 32768, BLOCK_ERASE_NS);
+        break;
+
+      case 0xd8:
+      case 0xdc:
+        Erase(address, 65536, BLOCK_ERASE_NS);
+        break;
+
+      case 0xc7:
+      case 0x60:
+        Erase(0, memory.size(), CHIP_ERASE_NS);
+        break;
+
+      default:
+        break;
+    }
+  }
+
+  phase = PHASE_OPCODE;
+  headerLen = 0;
+  dataCount = 0;
+}
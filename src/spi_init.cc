@@ -1,4 +1,10 @@
 #include "spi_device.h"
+#include "spi_addon.h"
+#include "spi_bus.h"
+#include "spi_display.h"
+#include "spi_flash.h"
+#include "spi_program.h"
+#include "spi_regmap.h"
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/ioctl.h>  // For ioctl()
@@ -12,7 +18,28 @@ Napi::Object SPIDevice::Init(Napi::Env env, Napi::Object exports) {
     InstanceMethod("getBitsPerWord", &SPIDevice::GetBitsPerWord),
     InstanceMethod("setMaxSpeedHz", &SPIDevice::SetMaxSpeedHz),
     InstanceMethod("getMaxSpeedHz", &SPIDevice::GetMaxSpeedHz),
-    InstanceMethod("transfer", &SPIDevice::Transfer)
+    InstanceMethod("setModeAsync", &SPIDevice::SetModeAsync),
+    InstanceMethod("setBitsPerWordAsync", &SPIDevice::SetBitsPerWordAsync),
+    InstanceMethod("setMaxSpeedHzAsync", &SPIDevice::SetMaxSpeedHzAsync),
+    InstanceMethod("transfer", &SPIDevice::Transfer),
+    InstanceMethod("transferInto", &SPIDevice::TransferInto),
+    InstanceMethod("transferSync", &SPIDevice::TransferSync),
+    InstanceMethod("transferArena", &SPIDevice::TransferArena),
+    InstanceMethod("transferArenaSync", &SPIDevice::TransferArenaSync),
+    InstanceMethod("transferUntil", &SPIDevice::TransferUntil),
+    InstanceMethod("prepare", &SPIDevice::Prepare),
+    InstanceMethod("startSampling", &SPIDevice::StartSampling),
+    InstanceMethod("stopSampling", &SPIDevice::StopSampling),
+    InstanceMethod("armOnEvent", &SPIDevice::ArmOnEvent),
+    InstanceMethod("disarm", &SPIDevice::Disarm),
+    InstanceMethod("startTrace", &SPIDevice::StartTrace),
+    InstanceMethod("stopTrace", &SPIDevice::StopTrace),
+    InstanceMethod("allocBuffer", &SPIDevice::AllocBuffer),
+    InstanceMethod("getPoolStats", &SPIDevice::GetPoolStats),
+    InstanceMethod("getStats", &SPIDevice::GetStats),
+    InstanceMethod("resetStats", &SPIDevice::ResetStats),
+    InstanceMethod("detach", &SPIDevice::Detach),
+    StaticMethod("release", &SPIDevice::Release)
   });
 
   // Static constants (attached to class itself)
@@ -29,18 +56,27 @@ Napi::Object SPIDevice::Init(Napi::Env env, Napi::Object exports) {
     Napi::PropertyDescriptor::Value("SPI_3WIRE", Napi::Number::New(env, SPI_3WIRE), napi_enumerable),
     Napi::PropertyDescriptor::Value("SPI_LOOP", Napi::Number::New(env, SPI_LOOP), napi_enumerable),
     Napi::PropertyDescriptor::Value("SPI_NO_CS", Napi::Number::New(env, SPI_NO_CS), napi_enumerable),
-    Napi::PropertyDescriptor::Value("SPI_READY", Napi::Number::New(env, SPI_READY), napi_enumerable)
+    Napi::PropertyDescriptor::Value("SPI_READY", Napi::Number::New(env, SPI_READY), napi_enumerable),
+
+    // Field indices of the transferArena() descriptor table
+    Napi::PropertyDescriptor::Value("ARENA", ArenaConstants(env), napi_enumerable)
   });
 
-  static Napi::FunctionReference constructor;
-  constructor = Napi::Persistent(func);
-  constructor.SuppressDestruct();
+  SPIAddon::Get(env)->device = Napi::Persistent(func);
 
   exports.Set("SPIDevice", func);
   return exports;
 }
 
 Napi::Object InitAll(Napi::Env env, Napi::Object exports) {
+  // Deleted by napi when this environment (main thread or Worker) exits
+  env.SetInstanceData(new SPIAddon());
+
+  SPIProgram::Init(env, exports);
+  SPIBus::Init(env, exports);
+  SPIFlash::Init(env, exports);
+  SPIDisplay::Init(env, exports);
+  SPIRegmap::Init(env, exports);
   return SPIDevice::Init(env, exports);
 }
 
@@ -0,0 +1,311 @@
+#include "spi_io_thread.h"
+#include <pthread.h>
+#include <sched.h>
+#include <cerrno>
+#include <cstring>
+
+SPIIoThread::Options SPIIoThread::ParseOptions(const Napi::Value& val, const std::string& name) {
+  Napi::Env env = val.Env();
+  Options options;
+
+  if (val.IsBoolean() || val.IsUndefined()) {
+    return options;
+  }
+
+  if (!val.IsObject()) {
+    throw Napi::TypeError::New(env, "'" + name + "' must be a boolean or an object");
+  }
+
+  Napi::Object obj = val.As<Napi::Object>();
+
+  if (obj.Has("cpu")) {
+    Napi::Value cpu = obj.Get("cpu");
+
+    if (cpu.IsNumber()) {
+      options.cpus.push_back(cpu.As<Napi::Number>().Int32Value());
+    }
+    else if (cpu.IsArray()) {
+      Napi::Array cpus = cpu.As<Napi::Array>();
+      for (uint32_t i = 0; i < cpus.Length(); i++) {
+        Napi::Value c = cpus[i];
+        if (!c.IsNumber()) {
+          throw Napi::TypeError::New(env, "'" + name + ".cpu' must be a number or an array of numbers");
+        }
+        options.cpus.push_back(c.As<Napi::Number>().Int32Value());
+      }
+    }
+    else {
+      throw Napi::TypeError::New(env, "'" + name + ".cpu' must be a number or an array of numbers");
+    }
+
+    for (int c : options.cpus) {
+      if (c < 0 || c >= CPU_SETSIZE) {
+        throw Napi::RangeError::New(env, "'" + name + ".cpu' out of range");
+      }
+    }
+  }
+
+  if (obj.Has("priority")) {
+    if (!obj.Get("priority").IsNumber()) {
+      throw Napi::TypeError::New(env, "'" + name + ".priority' must be a number");
+    }
+
+    options.priority = obj.Get("priority").As<Napi::Number>().Int32Value();
+
+    int min = sched_get_priority_min(SCHED_FIFO);
+    int max = sched_get_priority_max(SCHED_FIFO);
+
+    if (options.priority != 0 && (options.priority < min || options.priority > max)) {
+      throw Napi::RangeError::New(env, "'" + name + ".priority' must be 0 (default policy) or a SCHED_FIFO priority between " +
+        std::to_string(min) + " and " + std::to_string(max));
+    }
+  }
+
+  return options;
+}
+
+SPIIoThread::SPIIoThread(Napi::Env env, SPIDevice* device, const Options& options)
+  : device(device), coalesce(options.coalesce) {
+
+  sem_init(&ready, 0, 0);
+
+  completions = CompletionTsfn::New(env, "SPIDevice I/O", 0, 1, this);
+  completions.Unref(env);  // only keep the event loop alive while jobs are pending
+
+  // Called from RunPreemptible() on this thread, with the mutex held
+  device->preempt = [this] { RunRealtime(); };
+
+  thread = std::thread(&SPIIoThread::Run, this);
+
+  std::string err = ApplyOptions(thread, options, "I/O thread");
+
+  if (!err.empty()) {
+    Stop();
+    throw Napi::Error::New(env, err);
+  }
+}
+
+// Applies CPU affinity and SCHED_FIFO priority to a started thread.
+// Returns an error message, empty on success.
+std::string SPIIoThread::ApplyOptions(std::thread& thread, const Options& options, const char* what) {
+  int err = 0;
+  std::string action;
+
+  if (!options.cpus.empty()) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int c : options.cpus) {
+      CPU_SET(c, &set);
+    }
+
+    err = pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+    action = "CPU affinity";
+  }
+
+  if (err == 0 && options.priority > 0) {
+    sched_param param = {};
+    param.sched_priority = options.priority;
+
+    err = pthread_setschedparam(thread.native_handle(), SCHED_FIFO, &param);
+    action = "SCHED_FIFO priority";
+  }
+
+  if (err != 0) {
+    return std::string("Failed to set ") + what + " " + action + ": " + std::strerror(err);
+  }
+
+  return "";
+}
+
+SPIIoThread::~SPIIoThread() {
+  Stop();
+}
+
+void SPIIoThread::Stop() {
+  if (!thread.joinable()) {
+    return;
+  }
+
+  stopping.store(true, std::memory_order_release);
+  sem_post(&ready);
+  thread.join();
+
+  completions.Release();
+  sem_destroy(&ready);
+  device->preempt = nullptr;
+}
+
+bool SPIIoThread::Submit(Napi::Env env, SPIDevice::Job* job) {
+  if (!queues[job->lane].Push(job)) {
+    return false;
+  }
+
+  if (pending++ == 0) {
+    completions.Ref(env);
+  }
+
+  sem_post(&ready);
+  return true;
+}
+
+void SPIIoThread::Run() {
+  SPIDevice::Job* next = nullptr;  // popped, but did not fit in the previous group
+
+  for (;;) {
+    if (next == nullptr) {
+      // The count can run ahead of the queue when jobs were gathered
+      // without a wait, so an empty Pop() is expected now and then.
+      while (sem_wait(&ready) != 0 && errno == EINTR) {}
+
+      if (stopping.load(std::memory_order_acquire)) {
+        return;
+      }
+
+      if (!Pop(next)) {
+        continue;
+      }
+    }
+
+    group.clear();
+    group.push_back(next);
+    next = coalesce ? Gather() : nullptr;
+
+    ExecuteGroup();
+
+    for (SPIDevice::Job* job : group) {
+      completions.BlockingCall(job);
+    }
+  }
+}
+
+// Realtime jobs first
+bool SPIIoThread::Pop(SPIDevice::Job*& job) {
+  if (queues[SPIDevice::LANE_REALTIME].Pop(job)) {
+    device->realtimeQueued.fetch_sub(1, std::memory_order_release);
+    return true;
+  }
+
+  return queues[SPIDevice::LANE_BULK].Pop(job);
+}
+
+// Runs the waiting realtime jobs while a bulk job is preempted
+void SPIIoThread::RunRealtime() {
+  SPIDevice::Job* job;
+
+  while (queues[SPIDevice::LANE_REALTIME].Pop(job)) {
+    device->realtimeQueued.fetch_sub(1, std::memory_order_release);
+    device->ExecuteJob(job);
+    completions.BlockingCall(job);
+  }
+}
+
+// Pops queued transfer jobs that can share one SPI_IOC_MESSAGE with the
+// first job of the group. Returns a popped job that did not fit, or nullptr.
+SPIDevice::Job* SPIIoThread::Gather() {
+  std::vector<spi_ioc_transfer>* transfers = group.front()->Transfers();
+
+  if (transfers == nullptr || transfers->empty() || transfers->back().cs_change) {
+    // Not a plain transfer, or the caller keeps CS asserted after its message
+    return nullptr;
+  }
+
+  size_t count = transfers->size();
+  SPIBufsizUse use;
+  use.Add(transfers->data(), transfers->size());
+
+  SPIDevice::Job* job;
+
+  while (Pop(job)) {
+    transfers = job->Transfers();
+
+    // Realtime and bulk jobs are not merged
+    if (transfers == nullptr || transfers->empty() || job->lane != group.front()->lane) {
+      return job;
+    }
+
+    SPIBufsizUse merged = use;
+    merged.Add(transfers->data(), transfers->size());
+
+    if (count + transfers->size() > SPIDevice::MAX_MESSAGES || !merged.Fits(device->bufsiz)) {
+      return job;
+    }
+
+    group.push_back(job);
+    count += transfers->size();
+    use = merged;
+
+    if (transfers->back().cs_change) {
+      break;
+    }
+  }
+
+  return nullptr;
+}
+
+void SPIIoThread::ExecuteGroup() {
+  std::unique_lock<std::mutex> lock(device->mutex);
+  SPIDevice::ExecutorScope scope(device, lock);
+
+  if (group.size() == 1) {
+    device->ExecuteJob(group.front());
+    return;
+  }
+
+  uint64_t start = SPIStats::Now();
+
+  merged.clear();
+
+  for (SPIDevice::Job* job : group) {
+    if (!job->Start()) {
+      continue;  // aborted while queued
+    }
+
+    device->stats.queueWait.Record(start - job->queuedNs);
+
+    if (device->DropExpired(job, start)) {
+      continue;
+    }
+
+    std::vector<spi_ioc_transfer>* transfers = job->Transfers();
+
+    if (!merged.empty()) {
+      merged.back().cs_change = 1;  // release CS between callers
+    }
+
+    merged.insert(merged.end(), transfers->begin(), transfers->end());
+  }
+
+  // rx pointers still point into each caller's own buffers,
+  // so the results are split without copying.
+  int err = merged.empty() ? 0 : device->RunTransfers(merged);
+
+  uint64_t end = SPIStats::Now();
+
+  for (SPIDevice::Job* job : group) {
+    if (job->Aborted()) {
+      continue;
+    }
+
+    job->executedNs = end;
+
+    if (err != 0 && job->error.empty()) {
+      job->SetTransferError(err);
+    }
+  }
+}
+
+void SPIIoThread::CallJs(Napi::Env env, Napi::Function,
+    SPIIoThread* context, SPIDevice::Job* job) {
+
+  if (env == nullptr) {
+    // Environment is shutting down
+    delete job;
+    return;
+  }
+
+  if (--context->pending == 0) {
+    context->completions.Unref(env);
+  }
+
+  context->device->CompleteJob(env, job);
+}
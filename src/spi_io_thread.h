@@ -0,0 +1,69 @@
+#ifndef SPI_IO_THREAD_H
+#define SPI_IO_THREAD_H
+
+#include "spi_device.h"
+#include "spi_ring.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <semaphore.h>
+
+// Dedicated I/O thread owned by one SPIDevice (opt-in with the `io_thread` option).
+// Jobs are handed over through a lock-free ring, so no libuv threadpool
+// thread is ever parked on the device mutex. Completions are returned to the
+// JS thread through a single thread-safe function.
+//
+// With coalescing enabled, transfer jobs that are queued together are merged
+// into one SPI_IOC_MESSAGE. cs_change is set on the last message of each
+// caller so CS is still released between callers.
+//
+// Realtime jobs have a ring of their own that is always served first,
+// also between the segments of a running bulk job.
+class SPIIoThread {
+
+public:
+  struct Options {
+    std::vector<int> cpus;  // CPU affinity, empty for no affinity
+    int priority = 0;       // SCHED_FIFO priority, 0 for the default policy
+    bool coalesce = false;  // merge queued transfer jobs into one ioctl
+  };
+
+  static const size_t QUEUE_SIZE = 1024;
+
+  static Options ParseOptions(const Napi::Value& val, const std::string& name = "io_thread");
+  static std::string ApplyOptions(std::thread& thread, const Options& options, const char* what);
+
+  SPIIoThread(Napi::Env env, SPIDevice* device, const Options& options);
+  ~SPIIoThread();
+
+  // JS thread only (single producer)
+  bool Submit(Napi::Env env, SPIDevice::Job* job);
+
+private:
+  static void CallJs(Napi::Env env, Napi::Function callback,
+    SPIIoThread* context, SPIDevice::Job* job);
+
+  using CompletionTsfn = Napi::TypedThreadSafeFunction<SPIIoThread, SPIDevice::Job, CallJs>;
+
+  SPIDevice* device;
+  bool coalesce;
+  CompletionTsfn completions;
+  SPIRing<SPIDevice::Job*, QUEUE_SIZE> queues[SPIDevice::LANE_COUNT];
+  sem_t ready;
+  std::atomic<bool> stopping{false};
+  size_t pending = 0;  // submitted and not yet completed, JS thread only
+  std::thread thread;
+
+  // I/O thread only, reused between iterations
+  std::vector<SPIDevice::Job*> group;
+  std::vector<spi_ioc_transfer> merged;
+
+  void Run();
+  bool Pop(SPIDevice::Job*& job);
+  void RunRealtime();
+  SPIDevice::Job* Gather();
+  void ExecuteGroup();
+  void Stop();
+};
+
+#endif
@@ -7,7 +7,7 @@
 #include <linux/spi/spidev.h>  // For SPI_IOC_WR_MODE etc
 
 void SPIDevice::IoctlOrThrow(unsigned long request, void* arg, const char* action) {
-  if (ioctl(fd, request, arg) == -1) {
+  if (backend->Ioctl(request, arg) == -1) {
     std::string errMsg = std::string(action) + " failed: " + strerror(errno);
     Napi::Error::New(Env(), errMsg).ThrowAsJavaScriptException();
   }
@@ -3,25 +3,34 @@
 #include <unistd.h>
 #include <sys/ioctl.h>  // For ioctl()
 #include <linux/spi/spidev.h>  // For SPI_IOC_WR_MODE etc
+#include <cerrno>
 
-void SPIDevice::SetModeInternal(uint8_t mode) {
-  uint8_t read_mode = 0;
-  IoctlOrThrow(SPI_IOC_RD_MODE, &read_mode, "SPI_IOC_RD_MODE");
+// Caller holds the mutex. No ioctl when the shadow already has the mode.
+int SPIDevice::WriteMode(uint8_t mode) {
+  if (mode == shadowMode.load(std::memory_order_relaxed)) {
+    return 0;
+  }
+
+  if (backend->Ioctl(SPI_IOC_WR_MODE, &mode) == -1) {
+    return errno;
+  }
+
+  shadowMode.store(mode, std::memory_order_relaxed);
+  return 0;
+}
 
-  if (Env().IsExceptionPending()){
-    return;
-  } // stop on error
+void SPIDevice::SetModeInternal(uint8_t mode) {
+  int err = WriteMode(mode);
 
-  if (read_mode != mode) {
-    IoctlOrThrow(SPI_IOC_WR_MODE, &mode, "SPI_IOC_WR_MODE");
+  if (err != 0) {
+    Napi::Error::New(Env(), std::string("SPI_IOC_WR_MODE failed: ") + strerror(err))
+      .ThrowAsJavaScriptException();
   }
 }
 
 Napi::Value SPIDevice::SetMode(const Napi::CallbackInfo& info) {
     Napi::Env env = info.Env();
 
-    SPI_LOCK_GUARD;
-
     if (info.Length() < 1 || !info[0].IsNumber()) {
         Napi::TypeError::New(env, "Mode number (0-3) expected")
             .ThrowAsJavaScriptException();
@@ -32,22 +41,23 @@ Napi::Value SPIDevice::SetMode(const Napi::CallbackInfo& info) {
 
     ValidateMode(env, mode);
 
-    SetModeInternal(static_cast<uint8_t>(mode));
-
-    return env.IsExceptionPending() ? env.Null() : env.Undefined();
-}
+    // Rejected without a C++ throw: never written to the device
+    if (env.IsExceptionPending()) {
+        return env.Null();
+    }
 
-Napi::Value SPIDevice::GetMode(const Napi::CallbackInfo& info) {
-    Napi::Env env = info.Env();
+    // Unchanged: no need to wait for the mutex
+    if (mode == shadowMode.load(std::memory_order_relaxed)) {
+        return env.Undefined();
+    }
 
     SPI_LOCK_GUARD;
 
-    uint8_t mode;
-    IoctlOrThrow(SPI_IOC_RD_MODE, &mode, "SPI_IOC_RD_MODE");
+    SetModeInternal(static_cast<uint8_t>(mode));
 
-    if (env.IsExceptionPending()){
-        return env.Null();
-    }
+    return env.IsExceptionPending() ? env.Null() : env.Undefined();
+}
 
-    return Napi::Number::New(env, mode);
+Napi::Value SPIDevice::GetMode(const Napi::CallbackInfo& info) {
+    return Napi::Number::New(info.Env(), shadowMode.load(std::memory_order_relaxed));
 }
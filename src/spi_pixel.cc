@@ -0,0 +1,195 @@
+#include "spi_pixel.h"
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define SPI_PIXEL_SSE2 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define SPI_PIXEL_NEON 1
+#endif
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define SPI_PIXEL_LITTLE_ENDIAN 1
+#endif
+
+namespace {
+  void Store565(uint8_t* dst, uint8_t r, uint8_t g, uint8_t b) {
+    dst[0] = static_cast<uint8_t>((r & 0xf8) | g >> 5);
+    dst[1] = static_cast<uint8_t>((g << 3 & 0xe0) | b >> 3);
+  }
+
+  void ToWireScalar(const uint8_t* src, uint8_t* dst, size_t i, size_t count, SPIPixel::Format format) {
+    switch (format) {
+      case SPIPixel::RGB565:
+        for (; i < count; i++) {
+          uint16_t value;
+          std::memcpy(&value, src + i * 2, 2);
+          dst[i * 2] = static_cast<uint8_t>(value >> 8);
+          dst[i * 2 + 1] = static_cast<uint8_t>(value);
+        }
+        break;
+
+      case SPIPixel::RGB888:
+        for (; i < count; i++) {
+          Store565(dst + i * 2, src[i * 3], src[i * 3 + 1], src[i * 3 + 2]);
+        }
+        break;
+
+      case SPIPixel::RGBA8888:
+        for (; i < count; i++) {
+          Store565(dst + i * 2, src[i * 4], src[i * 4 + 1], src[i * 4 + 2]);
+        }
+        break;
+    }
+  }
+
+#if SPI_PIXEL_SSE2
+  // 4 RGBA pixels to 32 bit lanes holding the wire bytes in the low half,
+  // sign extended so _mm_packs_epi32() keeps them exact.
+  __m128i Pack565(__m128i px) {
+    const __m128i byte = _mm_set1_epi32(0xff);
+    __m128i r = _mm_and_si128(px, _mm_set1_epi32(0xf8));
+    __m128i g = _mm_and_si128(_mm_srli_epi32(px, 8), byte);
+    __m128i b = _mm_and_si128(_mm_srli_epi32(px, 16), byte);
+    __m128i hi = _mm_or_si128(r, _mm_srli_epi32(g, 5));
+    __m128i lo = _mm_or_si128(_mm_and_si128(_mm_slli_epi32(g, 3), _mm_set1_epi32(0xe0)),
+      _mm_srli_epi32(b, 3));
+    __m128i word = _mm_or_si128(hi, _mm_slli_epi32(lo, 8));
+    return _mm_srai_epi32(_mm_slli_epi32(word, 16), 16);
+  }
+
+  // 8 pixels per iteration. Returns the number converted.
+  size_t ToWireVector(const uint8_t* src, uint8_t* dst, size_t count, SPIPixel::Format format) {
+    size_t i = 0;
+
+    if (format == SPIPixel::RGBA8888) {
+      for (; i + 8 <= count; i += 8) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 4));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 4 + 16));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 2),
+          _mm_packs_epi32(Pack565(a), Pack565(b)));
+      }
+    }
+    else if (format == SPIPixel::RGB565) {
+      for (; i + 8 <= count; i += 8) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 2));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 2),
+          _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8)));
+      }
+    }
+
+    return i;
+  }
+
+  bool BlockDiffers(const uint8_t* a, const uint8_t* b) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a));
+    __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) != 0xffff;
+  }
+#endif
+
+#if SPI_PIXEL_NEON
+  // 16 pixels per iteration, vld3/vld4 split the channels
+  size_t ToWireVector(const uint8_t* src, uint8_t* dst, size_t count, SPIPixel::Format format) {
+    const uint8x16_t top5 = vdupq_n_u8(0xf8);
+    const uint8x16_t mid3 = vdupq_n_u8(0xe0);
+    size_t i = 0;
+
+    if (format == SPIPixel::RGB565) {
+#if SPI_PIXEL_LITTLE_ENDIAN
+      for (; i + 16 <= count; i += 16) {
+        vst1q_u8(dst + i * 2, vrev16q_u8(vld1q_u8(src + i * 2)));
+        vst1q_u8(dst + i * 2 + 16, vrev16q_u8(vld1q_u8(src + i * 2 + 16)));
+      }
+#endif
+      return i;
+    }
+
+    for (; i + 16 <= count; i += 16) {
+      uint8x16_t r, g, b;
+
+      if (format == SPIPixel::RGBA8888) {
+        uint8x16x4_t px = vld4q_u8(src + i * 4);
+        r = px.val[0];
+        g = px.val[1];
+        b = px.val[2];
+      }
+      else {
+        uint8x16x3_t px = vld3q_u8(src + i * 3);
+        r = px.val[0];
+        g = px.val[1];
+        b = px.val[2];
+      }
+
+      uint8x16x2_t out;
+      out.val[0] = vorrq_u8(vandq_u8(r, top5), vshrq_n_u8(g, 5));
+      out.val[1] = vorrq_u8(vandq_u8(vshlq_n_u8(g, 3), mid3), vshrq_n_u8(b, 3));
+      vst2q_u8(dst + i * 2, out);
+    }
+
+    return i;
+  }
+
+  bool BlockDiffers(const uint8_t* a, const uint8_t* b) {
+    uint64x2_t eq = vreinterpretq_u64_u8(vceqq_u8(vld1q_u8(a), vld1q_u8(b)));
+    return (vgetq_lane_u64(eq, 0) & vgetq_lane_u64(eq, 1)) != ~0ull;
+  }
+#endif
+}
+
+size_t SPIPixel::BytesPerPixel(Format format) {
+  switch (format) {
+    case RGB565: return 2;
+    case RGB888: return 3;
+    case RGBA8888: return 4;
+  }
+
+  return 0;
+}
+
+void SPIPixel::ToWire(const uint8_t* src, uint8_t* dst, size_t count, Format format) {
+  size_t i = 0;
+
+#if SPI_PIXEL_SSE2 || SPI_PIXEL_NEON
+  i = ToWireVector(src, dst, count, format);
+#endif
+
+  ToWireScalar(src, dst, i, count, format);
+}
+
+// Skips equal 16 byte blocks from both ends, the bytes are located
+// within the first and last differing block.
+bool SPIPixel::DiffSpan(const uint8_t* a, const uint8_t* b, size_t length, size_t& first, size_t& last) {
+  size_t i = 0;
+
+#if SPI_PIXEL_SSE2 || SPI_PIXEL_NEON
+  while (i + 16 <= length && !BlockDiffers(a + i, b + i)) {
+    i += 16;
+  }
+#endif
+
+  while (i < length && a[i] == b[i]) {
+    i++;
+  }
+
+  if (i == length) {
+    return false;
+  }
+
+  first = i;
+  size_t j = length;
+
+#if SPI_PIXEL_SSE2 || SPI_PIXEL_NEON
+  while (j >= first + 16 && !BlockDiffers(a + j - 16, b + j - 16)) {
+    j -= 16;
+  }
+#endif
+
+  while (a[j - 1] == b[j - 1]) {
+    j--;
+  }
+
+  last = j - 1;
+  return true;
+}
@@ -0,0 +1,28 @@
+#ifndef SPI_PIXEL_H
+#define SPI_PIXEL_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Pixel kernels of SPIDisplay. Displays take RGB565 with the high byte
+// first; the conversions write that wire order directly, so the frame can
+// be sent without another pass. SSE2 or NEON is used when the target has
+// it, the tails and rgb888 on x86 (no byte shuffle in SSE2) take the
+// scalar path.
+namespace SPIPixel {
+  enum Format {
+    RGB565,    // 16 bit values in host order, e.g. a Uint16Array
+    RGB888,    // 3 bytes per pixel, red first
+    RGBA8888   // 4 bytes per pixel, red first, alpha ignored (canvas ImageData)
+  };
+
+  size_t BytesPerPixel(Format format);
+
+  // `count` pixels of `format` into big endian RGB565
+  void ToWire(const uint8_t* src, uint8_t* dst, size_t count, Format format);
+
+  // Byte range [first, last] where a and b differ. Returns false when equal.
+  bool DiffSpan(const uint8_t* a, const uint8_t* b, size_t length, size_t& first, size_t& last);
+}
+
+#endif
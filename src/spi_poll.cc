@@ -0,0 +1,233 @@
+#include "spi_device.h"
+#include <cerrno>
+#include <cmath>
+#include <ctime>
+#include <thread>
+
+namespace {
+  const double DEFAULT_TIMEOUT_MS = 1000;
+  const double MAX_TIMEOUT_MS = 2147483647;  // ~24.8 days, like setTimeout()
+
+  void Sleep(uint64_t ns) {
+    timespec ts = { static_cast<time_t>(ns / 1000000000ull), static_cast<long>(ns % 1000000000ull) };
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR) {}
+  }
+
+  uint8_t ParseByte(Napi::Env env, const Napi::Object& obj, const char* name, uint8_t fallback) {
+    if (!obj.Has(name) || obj.Get(name).IsUndefined()) {
+      return fallback;
+    }
+
+    Napi::Value val = obj.Get(name);
+
+    if (!val.IsNumber()) {
+      throw Napi::TypeError::New(env, std::string("'") + name + "' must be a number");
+    }
+
+    double byte = val.As<Napi::Number>().DoubleValue();
+
+    if (!(byte >= 0 && byte <= 255) || std::floor(byte) != byte) {
+      throw Napi::RangeError::New(env, std::string("'") + name + "' must be an integer between 0 and 255");
+    }
+
+    return static_cast<uint8_t>(byte);
+  }
+}
+
+// transferUntil(messages, { mask, value, byteIndex, intervalUs, timeoutMs, ...queue options })
+Napi::Value SPIDevice::TransferUntil(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 2 || !info[0].IsArray() || !info[1].IsObject()) {
+    Napi::TypeError::New(env, "Array of transfer messages and poll options expected")
+      .ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  Napi::Object obj = info[1].As<Napi::Object>();
+  uint64_t now = SPIStats::Now();
+  TransferBatch batch;
+  JobOptions options;
+  uint8_t mask;
+  uint8_t value;
+  double byteIndex = 0;
+  double intervalUs = 0;
+  double timeoutMs = DEFAULT_TIMEOUT_MS;
+  batch.pool = pool;
+
+  try {
+    ParseTransfers(env, info[0].As<Napi::Array>(), nullptr, batch);
+    options = ParseJobOptions(env, obj);
+
+    mask = ParseByte(env, obj, "mask", 0xff);
+    value = ParseByte(env, obj, "value", 0);
+
+    if ((value & ~mask) != 0) {
+      throw Napi::RangeError::New(env, "'value' has bits outside of 'mask', it can never match");
+    }
+
+    if (obj.Has("byteIndex") && !obj.Get("byteIndex").IsUndefined()) {
+      if (!obj.Get("byteIndex").IsNumber()) {
+        throw Napi::TypeError::New(env, "'byteIndex' must be a number");
+      }
+
+      byteIndex = obj.Get("byteIndex").As<Napi::Number>().DoubleValue();
+
+      if (std::floor(byteIndex) != byteIndex) {
+        throw Napi::RangeError::New(env, "'byteIndex' must be an integer");
+      }
+    }
+
+    if (obj.Has("intervalUs") && !obj.Get("intervalUs").IsUndefined()) {
+      if (!obj.Get("intervalUs").IsNumber()) {
+        throw Napi::TypeError::New(env, "'intervalUs' must be a number");
+      }
+
+      intervalUs = obj.Get("intervalUs").As<Napi::Number>().DoubleValue();
+
+      if (!(intervalUs >= 0 && intervalUs <= MAX_TIMEOUT_MS * 1e3)) {
+        throw Napi::RangeError::New(env, "'intervalUs' must be between 0 and " +
+          std::to_string(static_cast<int64_t>(MAX_TIMEOUT_MS * 1e3)));
+      }
+    }
+
+    // Also bounds the time spent queued, see ParseJobOptions()
+    if (obj.Has("timeoutMs")) {
+      timeoutMs = obj.Get("timeoutMs").As<Napi::Number>().DoubleValue();
+
+      if (timeoutMs > MAX_TIMEOUT_MS) {
+        throw Napi::RangeError::New(env, "'timeoutMs' must not exceed " +
+          std::to_string(static_cast<int64_t>(MAX_TIMEOUT_MS)));
+      }
+    }
+  }
+  catch (const Napi::Error& e) {
+    e.ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  // byteIndex counts through the rx bytes of all messages, negative from the end
+  size_t rxTotal = 0;
+
+  for (const spi_ioc_transfer& tr : batch.transfers) {
+    rxTotal += tr.rx_buf ? tr.len : 0;
+  }
+
+  if (byteIndex < 0) {
+    byteIndex += static_cast<double>(rxTotal);
+  }
+
+  if (!(byteIndex >= 0 && byteIndex < static_cast<double>(rxTotal))) {
+    Napi::RangeError::New(env, "'byteIndex' is outside of the " + std::to_string(rxTotal) +
+      " received bytes").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  size_t message = 0;
+  size_t remaining = static_cast<size_t>(byteIndex);
+
+  for (; message < batch.transfers.size(); message++) {
+    const spi_ioc_transfer& tr = batch.transfers[message];
+
+    if (tr.rx_buf && remaining < tr.len) {
+      break;
+    }
+
+    remaining -= tr.rx_buf ? tr.len : 0;
+  }
+
+  PollJob* job = new PollJob(env, std::move(batch));
+  job->message = message;
+  job->offset = remaining;
+  job->mask = mask;
+  job->value = value;
+  job->intervalNs = static_cast<uint64_t>(intervalUs * 1e3);
+  job->timeoutAtNs = now + static_cast<uint64_t>(timeoutMs * 1e6);
+
+  return QueueJob(env, job, options);
+}
+
+void SPIDevice::PollJob::Execute(SPIDevice* device) {
+  EncodeWords(batch);
+  SealCrcs(batch);
+
+  for (;;) {
+    int err = Run(device, batch.transfers);
+
+    if (err != 0) {
+      SetTransferError(err);
+      return;
+    }
+
+    iterations++;
+
+    int bad = CheckCrcs(batch);
+
+    if (bad >= 0) {
+      SetCrcError(batch, bad);
+      return;
+    }
+
+    const uint8_t* rx = reinterpret_cast<const uint8_t*>(batch.transfers[message].rx_buf);
+
+    if ((rx[offset] & mask) == value) {
+      break;
+    }
+
+    if (SPIStats::Now() >= timeoutAtNs) {
+      error = "Condition not met after " + std::to_string(iterations) + " transfers";
+      code = "ERR_SPI_POLL_TIMEOUT";
+      return;
+    }
+
+    if (lane == LANE_BULK) {
+      device->YieldToRealtime();
+    }
+
+    device->SleepUnlocked(intervalNs);
+  }
+
+  DecodeWords(batch);
+}
+
+Napi::Value SPIDevice::PollJob::Result(Napi::Env env) {
+  Napi::Object result = Napi::Object::New(env);
+  result.Set("rx", BatchResult(env, batch));
+  result.Set("iterations", Napi::Number::New(env, static_cast<double>(iterations)));
+  return result;
+}
+
+// Sleeps between the rounds of a job with the device mutex released, so
+// transferSync(), the setters and sampling are not held up. Without a
+// sleep the thread yields once. The job keeps its place: queued jobs do
+// not start meanwhile. Caller runs the job with the mutex held, through
+// executorLock, and holds it again on return.
+//
+// A threadpool bulk job preempted for this (realtime) job waits for the
+// mutex too and would resume mid-poll, so then the mutex stays held.
+// Under the I/O thread and the bus the preempted job is further up the
+// same stack.
+void SPIDevice::SleepUnlocked(uint64_t ns) {
+  std::unique_lock<std::mutex>* lock = executorLock;
+
+  if (lock == nullptr || bulkSuspended) {
+    if (ns != 0) {
+      Sleep(ns);
+    }
+
+    return;
+  }
+
+  jobSleeping = true;
+  lock->unlock();
+
+  if (ns != 0) {
+    Sleep(ns);
+  }
+  else {
+    std::this_thread::yield();
+  }
+
+  lock->lock();
+  jobSleeping = false;
+}
@@ -0,0 +1,203 @@
+#include "spi_pool.h"
+#include "spi_device.h"
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cstring>
+
+namespace {
+  int SizeClass(size_t size, size_t minBlock) {
+    int c = 0;
+
+    while ((minBlock << c) < size) {
+      c++;
+    }
+
+    return c;
+  }
+}
+
+SPIBufferPool::~SPIBufferPool() {
+  for (auto& entry : slabs) {
+    munmap(entry.second->data, entry.second->size);
+  }
+}
+
+Napi::Buffer<uint8_t> SPIBufferPool::Alloc(Napi::Env env, size_t size) {
+  int c = SizeClass(size, MIN_BLOCK);
+  size_t blockSize = MIN_BLOCK << c;
+
+  if (c >= CLASSES || blockSize > limit) {
+    throw Napi::RangeError::New(env, "Buffer of " + std::to_string(size) +
+      " bytes exceeds the buffer pool size of " + std::to_string(limit) + " bytes");
+  }
+
+  if (freeLists[c].empty()) {
+    // A fresh slab of this size class: faulted in and locked up front,
+    // so no transfer ever waits for a page
+    size_t slabSize = blockSize < SLAB_SIZE ? SLAB_SIZE : blockSize;
+
+    if (reserved + slabSize > limit) {
+      Napi::Error err = Napi::Error::New(env, "Buffer pool is full (" + std::to_string(reserved) +
+        " of " + std::to_string(limit) + " bytes reserved)");
+      err.Value().Set("code", Napi::String::New(env, "ERR_SPI_POOL_EXHAUSTED"));
+      throw err;
+    }
+
+    void* mem = mmap(nullptr, slabSize, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+
+    if (mem == MAP_FAILED) {
+      throw Napi::Error::New(env, std::string("Failed to map a buffer pool slab: ") + std::strerror(errno));
+    }
+
+    std::unique_ptr<Slab> slab(new Slab());
+    slab->data = static_cast<uint8_t*>(mem);
+    slab->size = slabSize;
+    slab->blocks.resize(slabSize / blockSize);
+
+    // Over RLIMIT_MEMLOCK the slab is still usable, just not locked
+    if (mlock(mem, slabSize) == 0) {
+      locked += slabSize;
+    }
+
+    for (size_t i = slab->blocks.size(); i-- > 0;) {
+      slab->blocks[i].data = slab->data + i * blockSize;
+      slab->blocks[i].size = blockSize;
+      freeLists[c].push_back(&slab->blocks[i]);
+    }
+
+    reserved += slabSize;
+    slabs.emplace(reinterpret_cast<uintptr_t>(mem), std::move(slab));
+  }
+  else {
+    reuses++;
+  }
+
+  SPIPoolBlock* block = freeLists[c].back();
+  freeLists[c].pop_back();
+
+  std::memset(block->data, 0, size);
+  block->owned = true;
+  inUse += blockSize;
+  buffers++;
+  allocations++;
+
+  return Napi::Buffer<uint8_t>::New(env, block->data, size, Finalize,
+    new Owner{ shared_from_this(), block });
+}
+
+SPIPoolBlock* SPIBufferPool::Find(const void* data, size_t len) {
+  uintptr_t at = reinterpret_cast<uintptr_t>(data);
+  auto it = slabs.upper_bound(at);
+
+  if (it == slabs.begin()) {
+    return nullptr;
+  }
+
+  const Slab& slab = *(--it)->second;
+
+  if (at + len > it->first + slab.size) {
+    return nullptr;
+  }
+
+  size_t blockSize = slab.blocks[0].size;
+  SPIPoolBlock* block = const_cast<SPIPoolBlock*>(&slab.blocks[(at - it->first) / blockSize]);
+
+  // Within one block, e.g. a subarray() of a pool Buffer
+  if (at + len > reinterpret_cast<uintptr_t>(block->data) + blockSize || !block->owned) {
+    return nullptr;
+  }
+
+  return block;
+}
+
+void SPIBufferPool::Unpin(SPIPoolBlock* block) {
+  if (--block->inFlight == 0 && !block->owned) {
+    Recycle(block);
+  }
+}
+
+void SPIBufferPool::Recycle(SPIPoolBlock* block) {
+  inUse -= block->size;
+  freeLists[SizeClass(block->size, MIN_BLOCK)].push_back(block);
+}
+
+void SPIBufferPool::Finalize(Napi::Env, uint8_t*, Owner* owner) {
+  SPIBufferPool* pool = owner->pool.get();
+  SPIPoolBlock* block = owner->block;
+
+  block->owned = false;
+  pool->buffers--;
+
+  // A transfer still using the block recycles it once it is done
+  if (block->inFlight == 0) {
+    pool->Recycle(block);
+  }
+
+  delete owner;
+}
+
+Napi::Object SPIBufferPool::Stats(Napi::Env env) const {
+  size_t pinned = 0;
+
+  for (const auto& entry : slabs) {
+    for (const SPIPoolBlock& block : entry.second->blocks) {
+      pinned += block.inFlight > 0;
+    }
+  }
+
+  Napi::Object stats = Napi::Object::New(env);
+  stats.Set("limit", Napi::Number::New(env, static_cast<double>(limit)));
+  stats.Set("reserved", Napi::Number::New(env, static_cast<double>(reserved)));
+  stats.Set("locked", Napi::Number::New(env, static_cast<double>(locked)));
+  stats.Set("inUse", Napi::Number::New(env, static_cast<double>(inUse)));
+  stats.Set("buffers", Napi::Number::New(env, static_cast<double>(buffers)));
+  stats.Set("pinned", Napi::Number::New(env, static_cast<double>(pinned)));
+  stats.Set("allocations", Napi::Number::New(env, static_cast<double>(allocations)));
+  stats.Set("reuses", Napi::Number::New(env, static_cast<double>(reuses)));
+  return stats;
+}
+
+// Pins the pool blocks of a batch's messages until the batch is gone
+void SPIDevice::TransferBatch::Pin(SPIPoolBlock* block) {
+  pool->Pin(block);
+  pinned.push_back(block);
+}
+
+SPIDevice::TransferBatch::~TransferBatch() {
+  for (SPIPoolBlock* block : pinned) {
+    pool->Unpin(block);
+  }
+}
+
+Napi::Value SPIDevice::AllocBuffer(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1 || !info[0].IsNumber()) {
+    Napi::TypeError::New(env, "Buffer size expected")
+      .ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  int64_t size = info[0].As<Napi::Number>().Int64Value();
+
+  if (size < 1 || size > UINT32_MAX) {
+    throw Napi::RangeError::New(env, "Buffer size must be between 1 and " + std::to_string(UINT32_MAX));
+  }
+
+  if (!pool) {
+    pool = std::make_shared<SPIBufferPool>(poolLimit);
+  }
+
+  return pool->Alloc(env, static_cast<size_t>(size));
+}
+
+Napi::Value SPIDevice::GetPoolStats(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  if (!pool) {
+    return SPIBufferPool(poolLimit).Stats(env);
+  }
+
+  return pool->Stats(env);
+}
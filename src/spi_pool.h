@@ -0,0 +1,75 @@
+#ifndef SPI_POOL_H
+#define SPI_POOL_H
+
+#include <napi.h>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <vector>
+
+// Block of an SPIBufferPool slab, the memory of one allocBuffer() Buffer
+struct SPIPoolBlock {
+  uint8_t* data;
+  size_t size;            // the size class
+  bool owned = false;     // a Buffer refers to the block
+  uint32_t inFlight = 0;  // batches whose messages use it
+};
+
+// Per device pool of page aligned, mlock'd memory for allocBuffer().
+// Slabs are mapped once, locked, and carved into blocks of one power of
+// two size class; a block goes back to its free list when its Buffer
+// is collected and no batch uses it any more. Transfers recognise pool
+// memory by address and pin the block with a counter instead of a
+// napi reference. Used on the JS thread only.
+class SPIBufferPool : public std::enable_shared_from_this<SPIBufferPool> {
+
+public:
+  static const size_t MIN_LIMIT = 64 << 10;
+
+  explicit SPIBufferPool(size_t limit) : limit(limit) {}
+  ~SPIBufferPool();
+
+  // A zero filled Buffer of `size` bytes, throws when the limit is reached
+  Napi::Buffer<uint8_t> Alloc(Napi::Env env, size_t size);
+
+  // The block holding [data, data + len), nullptr for other memory
+  SPIPoolBlock* Find(const void* data, size_t len);
+
+  void Pin(SPIPoolBlock* block) { block->inFlight++; }
+  void Unpin(SPIPoolBlock* block);
+
+  // { limit, reserved, locked, inUse, buffers, pinned, allocations, reuses }
+  Napi::Object Stats(Napi::Env env) const;
+
+private:
+  static const size_t MIN_BLOCK = 64;
+  static const size_t SLAB_SIZE = 64 << 10;
+  static const int CLASSES = 32;
+
+  struct Slab {
+    uint8_t* data;
+    size_t size;
+    std::vector<SPIPoolBlock> blocks;  // all of one size class
+  };
+
+  // Finalizer hint of a Buffer: keeps the pool alive as long as the Buffer
+  struct Owner {
+    std::shared_ptr<SPIBufferPool> pool;
+    SPIPoolBlock* block;
+  };
+
+  size_t limit;
+  size_t reserved = 0;  // mapped slab bytes
+  size_t locked = 0;    // of which mlock() succeeded, see RLIMIT_MEMLOCK
+  size_t inUse = 0;     // block bytes owned by Buffers or pinned
+  size_t buffers = 0;
+  uint64_t allocations = 0;
+  uint64_t reuses = 0;  // allocations served from a free list
+  std::map<uintptr_t, std::unique_ptr<Slab>> slabs;  // by address
+  std::vector<SPIPoolBlock*> freeLists[CLASSES];
+
+  void Recycle(SPIPoolBlock* block);
+  static void Finalize(Napi::Env env, uint8_t* data, Owner* owner);
+};
+
+#endif
@@ -0,0 +1,186 @@
+#include "spi_program.h"
+#include "spi_addon.h"
+#include <cstring>
+
+Napi::Object SPIProgram::Init(Napi::Env env, Napi::Object exports) {
+  Napi::Function func = DefineClass(env, "SPIProgram", {
+    InstanceMethod("run", &SPIProgram::Run),
+    InstanceMethod("runSync", &SPIProgram::RunSync)
+  });
+
+  SPIAddon::Get(env)->program = Napi::Persistent(func);
+
+  exports.Set("SPIProgram", func);
+  return exports;
+}
+
+Napi::Object SPIProgram::NewInstance(Napi::Env env, Napi::Object device, Napi::Array msgArray) {
+  return SPIAddon::Get(env)->program.New({ device, msgArray });
+}
+
+SPIProgram::SPIProgram(const Napi::CallbackInfo& info)
+  : Napi::ObjectWrap<SPIProgram>(info) {
+
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 2 || !info[0].IsObject() || !info[1].IsArray()) {
+    throw Napi::TypeError::New(env, "Use SPIDevice.prepare() to create a program");
+  }
+
+  Napi::Object deviceObj = info[0].As<Napi::Object>();
+  this->device = SPIDevice::Unwrap(deviceObj);
+  this->deviceRef = Napi::Persistent(deviceObj);
+
+  // Pinned for the life of the program
+  batch.pool = device->pool;
+  SPIDevice::ParseTransfers(env, info[1].As<Napi::Array>(), nullptr, batch);
+
+  if (batch.transfers.empty()) {
+    throw Napi::Error::New(env, "No transfers specified");
+  }
+
+  // Resolve every run with the same array of rx buffers
+  Napi::Array result = SPIDevice::BatchResult(env, batch).As<Napi::Array>();
+  batch.result = Napi::Persistent(static_cast<Napi::Object>(result));
+}
+
+// [{ index, offset, data }], index is the message, offset is into its tx_buf
+std::vector<SPIProgram::Patch> SPIProgram::ParsePatches(Napi::Env env, const Napi::Value& val) {
+  std::vector<Patch> patches;
+
+  if (val.IsUndefined()) {
+    return patches;
+  }
+
+  if (!val.IsArray()) {
+    throw Napi::TypeError::New(env, "Array of tx patches expected");
+  }
+
+  Napi::Array patchArray = val.As<Napi::Array>();
+  patches.reserve(patchArray.Length());
+
+  for (uint32_t i = 0; i < patchArray.Length(); i++) {
+    Napi::Value item = patchArray[i];
+
+    if (!item.IsObject()) {
+      throw Napi::TypeError::New(env, "Each tx patch must be an object { index, offset, data }");
+    }
+
+    Napi::Object obj = item.As<Napi::Object>();
+    Patch patch;
+
+    patch.index = obj.Has("index") ? obj.Get("index").As<Napi::Number>().Uint32Value() : 0;
+    patch.offset = obj.Has("offset") ? obj.Get("offset").As<Napi::Number>().Uint32Value() : 0;
+
+    if (!obj.Has("data") || !obj.Get("data").IsBuffer()) {
+      throw Napi::TypeError::New(env, "tx patch requires a data Buffer");
+    }
+
+    Napi::Buffer<uint8_t> data = obj.Get("data").As<Napi::Buffer<uint8_t>>();
+    patch.data.assign(data.Data(), data.Data() + data.Length());
+
+    if (patch.index >= batch.transfers.size()) {
+      throw Napi::RangeError::New(env, "tx patch index out of range");
+    }
+
+    const spi_ioc_transfer& tr = batch.transfers[patch.index];
+
+    if (tr.tx_buf == 0) {
+      throw Napi::Error::New(env, "tx patch on a transfer without tx_buf");
+    }
+
+    if (patch.offset + patch.data.size() > tr.len) {
+      throw Napi::RangeError::New(env, "tx patch exceeds the tx_buf length");
+    }
+
+    patches.push_back(std::move(patch));
+  }
+
+  return patches;
+}
+
+void SPIProgram::ApplyPatches(SPIDevice::TransferBatch& batch, const std::vector<Patch>& patches) {
+  for (const Patch& patch : patches) {
+    uint8_t* tx = reinterpret_cast<uint8_t*>(batch.transfers[patch.index].tx_buf);
+    std::memcpy(tx + patch.offset, patch.data.data(), patch.data.size());
+  }
+}
+
+Napi::Value SPIProgram::Run(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  std::vector<Patch> patches = ParsePatches(env, info[0]);
+  SPIDevice::JobOptions options = SPIDevice::ParseJobOptions(env, info[1]);
+
+  return device->QueueJob(env, new RunJob(env, this, std::move(patches)), options);
+}
+
+Napi::Value SPIProgram::RunSync(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  std::vector<Patch> patches = ParsePatches(env, info[0]);
+  int err;
+  int bad = -1;
+
+  {
+    SPI_DEVICE_LOCK_GUARD;
+    ApplyPatches(batch, patches);
+    SPIDevice::EncodeWords(batch);
+    SPIDevice::SealCrcs(batch);
+    err = device->RunTransfers(batch.transfers);
+
+    if (err == 0 && (bad = SPIDevice::CheckCrcs(batch)) < 0) {
+      SPIDevice::DecodeWords(batch);
+    }
+  }
+
+  if (err != 0) {
+    throw Napi::Error::New(env, std::string("SPI transfer failed: ") + std::strerror(err));
+  }
+
+  if (bad >= 0) {
+    throw SPIDevice::CrcError(env, batch, bad);
+  }
+
+  return batch.result.Value();
+}
+
+void SPIProgram::RunJob::Execute(SPIDevice* device) {
+  // Patches are applied here, under the device mutex, so they never
+  // change a tx buffer while an earlier run is still in the ioctl.
+  ApplyPatches(program->batch, patches);
+  SPIDevice::EncodeWords(program->batch);
+  SPIDevice::SealCrcs(program->batch);
+
+  int err = Run(device, program->batch.transfers);
+
+  if (err != 0) {
+    SetTransferError(err);
+    return;
+  }
+
+  int bad = SPIDevice::CheckCrcs(program->batch);
+
+  if (bad >= 0) {
+    SetCrcError(program->batch, bad);
+    return;
+  }
+
+  SPIDevice::DecodeWords(program->batch);
+}
+
+Napi::Value SPIProgram::RunJob::Result(Napi::Env) {
+  return program->batch.result.Value();
+}
+
+Napi::Value SPIDevice::Prepare(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1 || !info[0].IsArray()) {
+    Napi::TypeError::New(env, "Array of transfer messages expected")
+      .ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  return SPIProgram::NewInstance(env, Value(), info[0].As<Napi::Array>());
+}
@@ -0,0 +1,61 @@
+#ifndef SPI_PROGRAM_H
+#define SPI_PROGRAM_H
+
+#include "spi_device.h"
+
+// A transfer sequence validated once by SPIDevice::Prepare().
+// The spi_ioc_transfer array and its pinned tx/rx buffers are kept, so
+// run() only issues the ioctl. Every run receives into the same rx
+// buffers and resolves with the same result array.
+class SPIProgram : public Napi::ObjectWrap<SPIProgram> {
+  friend class SPIDevice;
+  friend class SPISampler;
+
+public:
+  static Napi::Object Init(Napi::Env env, Napi::Object exports);
+  static Napi::Object NewInstance(Napi::Env env, Napi::Object device, Napi::Array msgArray);
+  SPIProgram(const Napi::CallbackInfo& info);
+
+  Napi::Value Run(const Napi::CallbackInfo& info);
+  Napi::Value RunSync(const Napi::CallbackInfo& info);
+
+private:
+  // Bytes written into a tx buffer just before the ioctl
+  struct Patch {
+    size_t index;
+    size_t offset;
+    std::vector<uint8_t> data;
+  };
+
+  SPIDevice* device = nullptr;
+  Napi::ObjectReference deviceRef;
+  SPIDevice::TransferBatch batch;
+
+  std::vector<Patch> ParsePatches(Napi::Env env, const Napi::Value& val);
+  static void ApplyPatches(SPIDevice::TransferBatch& batch, const std::vector<Patch>& patches);
+
+  class RunJob : public SPIDevice::Job {
+    public:
+      RunJob(Napi::Env env, SPIProgram* program, std::vector<Patch>&& patches)
+        : SPIDevice::Job(env),
+        program(program),
+        programRef(Napi::Persistent(program->Value())),
+        patches(std::move(patches)) {}
+
+      void Execute(SPIDevice* device) override;
+      Napi::Value Result(Napi::Env env) override;
+
+      // Unpatched runs can be coalesced like plain transfers
+      std::vector<spi_ioc_transfer>* Transfers() override {
+        return patches.empty() && program->batch.words.empty() && program->batch.crcs.empty()
+          ? &program->batch.transfers : nullptr;
+      }
+
+    private:
+      SPIProgram* program;
+      Napi::ObjectReference programRef;  // keeps the program alive while queued
+      std::vector<Patch> patches;
+  };
+};
+
+#endif
@@ -0,0 +1,429 @@
+#include "spi_regmap.h"
+#include "spi_addon.h"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+  const uint32_t MAX_REGISTERS = 65536;
+
+  uint32_t ParseOption(Napi::Env env, const Napi::Object& options, const char* name,
+      uint32_t min, uint32_t max, uint32_t fallback) {
+    if (!options.Has(name) || options.Get(name).IsUndefined()) {
+      return fallback;
+    }
+
+    Napi::Value val = options.Get(name);
+    double value = val.IsNumber() ? val.As<Napi::Number>().DoubleValue() : -1;
+
+    if (!(value >= min && value <= max) || value != static_cast<uint32_t>(value)) {
+      throw Napi::RangeError::New(env, std::string("'") + name + "' must be an integer between " +
+        std::to_string(min) + " and " + std::to_string(max));
+    }
+
+    return static_cast<uint32_t>(value);
+  }
+
+  uint32_t LoadValue(const uint8_t* p, size_t bytes) {
+    uint32_t value = 0;
+
+    for (size_t i = 0; i < bytes; i++) {
+      value = value << 8 | p[i];
+    }
+
+    return value;
+  }
+
+  void StoreValue(uint8_t* p, uint32_t value, size_t bytes) {
+    for (size_t i = bytes; i-- > 0;) {
+      p[i] = static_cast<uint8_t>(value);
+      value >>= 8;
+    }
+  }
+}
+
+Napi::Object SPIRegmap::Init(Napi::Env env, Napi::Object exports) {
+  Napi::Function func = DefineClass(env, "SPIRegmap", {
+    InstanceMethod("read", &SPIRegmap::Read),
+    InstanceMethod("write", &SPIRegmap::Write),
+    InstanceMethod("update", &SPIRegmap::Update),
+    InstanceMethod("sync", &SPIRegmap::Sync),
+    InstanceMethod("invalidate", &SPIRegmap::Invalidate)
+  });
+
+  SPIAddon::Get(env)->regmap = Napi::Persistent(func);
+
+  exports.Set("SPIRegmap", func);
+  return exports;
+}
+
+// new SPIRegmap(device, { addressBytes, addressShift, readFlag, writeFlag, burstFlag,
+//   dummyBytes, valueBytes, burst, maxRegister, volatile, defaults })
+SPIRegmap::SPIRegmap(const Napi::CallbackInfo& info)
+  : Napi::ObjectWrap<SPIRegmap>(info) {
+
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1 || !info[0].IsObject()) {
+    throw Napi::TypeError::New(env, "SPIDevice expected");
+  }
+
+  Napi::Object deviceObj = info[0].As<Napi::Object>();
+
+  try {
+    device = SPIDevice::Unwrap(deviceObj);
+  }
+  catch (const Napi::Error&) {
+    throw Napi::TypeError::New(env, "SPIDevice expected");
+  }
+
+  Napi::Object options = info[1].IsObject() ? info[1].As<Napi::Object>() : Napi::Object::New(env);
+
+  layout.addressBytes = ParseOption(env, options, "addressBytes", 1, 2, 1);
+  uint32_t addressMax = layout.addressBytes == 2 ? 0xffff : 0xff;
+
+  layout.addressShift = ParseOption(env, options, "addressShift", 0, 8 * layout.addressBytes - 1, 0);
+  layout.readFlag = ParseOption(env, options, "readFlag", 0, addressMax, 0x80);
+  layout.writeFlag = ParseOption(env, options, "writeFlag", 0, addressMax, 0);
+  layout.burstFlag = ParseOption(env, options, "burstFlag", 0, addressMax, 0);
+  layout.dummyBytes = ParseOption(env, options, "dummyBytes", 0, 8, 0);
+  layout.valueBytes = ParseOption(env, options, "valueBytes", 1, 4, 1);
+
+  if (options.Has("burst")) {
+    layout.burst = options.Get("burst").ToBoolean().Value();
+  }
+
+  // By default every address the frame can carry next to the read flag
+  uint32_t addressable = (addressMax >> layout.addressShift) & ~(layout.readFlag >> layout.addressShift);
+  maxRegister = ParseOption(env, options, "maxRegister", 0,
+    std::min(addressMax >> layout.addressShift, MAX_REGISTERS - 1), addressable);
+
+  valueMask = layout.valueBytes == 4 ? 0xffffffffu : (1u << (8 * layout.valueBytes)) - 1;
+  values.assign(maxRegister + 1, 0);
+  flags.assign(maxRegister + 1, 0);
+  generation.assign(maxRegister + 1, 0);
+
+  // volatile: [reg, [from, to], ...], never cached
+  if (options.Has("volatile")) {
+    if (!options.Get("volatile").IsArray()) {
+      throw Napi::TypeError::New(env, "'volatile' must be an array of registers and [from, to] ranges");
+    }
+
+    Napi::Array list = options.Get("volatile").As<Napi::Array>();
+
+    for (uint32_t i = 0; i < list.Length(); i++) {
+      Napi::Value entry = list.Get(i);
+      uint32_t from;
+      uint32_t to;
+
+      if (entry.IsArray() && entry.As<Napi::Array>().Length() == 2) {
+        from = ParseRegister(env, entry.As<Napi::Array>().Get(0u));
+        to = ParseRegister(env, entry.As<Napi::Array>().Get(1u));
+      }
+      else {
+        from = to = ParseRegister(env, entry);
+      }
+
+      for (uint32_t reg = from; reg <= to; reg++) {
+        flags[reg] = REG_VOLATILE;
+      }
+    }
+  }
+
+  // defaults: { reg: value }, the reset values, cached as clean
+  if (options.Has("defaults")) {
+    if (!options.Get("defaults").IsObject()) {
+      throw Napi::TypeError::New(env, "'defaults' must be an object of register values");
+    }
+
+    Napi::Object resets = options.Get("defaults").As<Napi::Object>();
+    Napi::Array keys = resets.GetPropertyNames();
+
+    for (uint32_t i = 0; i < keys.Length(); i++) {
+      Napi::Value key = keys.Get(i);
+      uint32_t reg = ParseRegister(env, key.ToNumber());
+      uint32_t value = ParseValue(env, resets.Get(key));
+
+      if (!(flags[reg] & REG_VOLATILE)) {
+        defaults.emplace_back(reg, value);
+        Store(reg, value, false);
+      }
+    }
+  }
+
+  deviceRef = Napi::Persistent(deviceObj);
+}
+
+uint32_t SPIRegmap::ParseRegister(Napi::Env env, const Napi::Value& val) {
+  double reg = val.IsNumber() ? val.As<Napi::Number>().DoubleValue() : -1;
+
+  if (!(reg >= 0 && reg <= maxRegister) || reg != static_cast<uint32_t>(reg)) {
+    throw Napi::RangeError::New(env, "Register must be an integer between 0 and " +
+      std::to_string(maxRegister));
+  }
+
+  return static_cast<uint32_t>(reg);
+}
+
+uint32_t SPIRegmap::ParseValue(Napi::Env env, const Napi::Value& val) {
+  double value = val.IsNumber() ? val.As<Napi::Number>().DoubleValue() : -1;
+
+  if (!(value >= 0 && value <= valueMask) || value != static_cast<uint32_t>(value)) {
+    throw Napi::RangeError::New(env, "Register value must be an integer between 0 and " +
+      std::to_string(valueMask));
+  }
+
+  return static_cast<uint32_t>(value);
+}
+
+// A dirty store of the cached value is dropped: sync() has nothing to do for it
+void SPIRegmap::Store(uint32_t reg, uint32_t value, bool dirty) {
+  if (dirty) {
+    if ((flags[reg] & REG_CACHED) && values[reg] == value) {
+      return;
+    }
+
+    flags[reg] |= REG_DIRTY;
+    generation[reg]++;
+  }
+
+  values[reg] = value;
+  flags[reg] |= REG_CACHED;
+}
+
+// Cache hits settle without a job
+Napi::Value SPIRegmap::Resolved(Napi::Env env, Napi::Value value) {
+  Napi::Promise::Deferred deferred = Napi::Promise::Deferred::New(env);
+  deferred.Resolve(value);
+  return deferred.Promise();
+}
+
+// read(reg[, options])
+Napi::Value SPIRegmap::Read(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  uint32_t reg = ParseRegister(env, info[0]);
+
+  if (flags[reg] & REG_CACHED) {
+    return Resolved(env, Napi::Number::New(env, values[reg]));
+  }
+
+  SPIDevice::JobOptions options = SPIDevice::ParseJobOptions(env, info[1]);
+  return device->QueueJob(env, new ReadJob(env, this, reg), options);
+}
+
+// write(reg, value[, options]): cached until sync(), volatile registers at once
+Napi::Value SPIRegmap::Write(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  uint32_t reg = ParseRegister(env, info[0]);
+  uint32_t value = ParseValue(env, info[1]);
+
+  if (flags[reg] & REG_VOLATILE) {
+    SPIDevice::JobOptions options = SPIDevice::ParseJobOptions(env, info[2]);
+    return device->QueueJob(env, new WriteJob(env, this, reg, valueMask, value), options);
+  }
+
+  Store(reg, value, true);
+  return Resolved(env, env.Undefined());
+}
+
+// update(reg, mask, bits[, options]): read-modify-write, resolves with the new value
+Napi::Value SPIRegmap::Update(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  uint32_t reg = ParseRegister(env, info[0]);
+  uint32_t mask = ParseValue(env, info[1]);
+  uint32_t bits = ParseValue(env, info[2]) & mask;
+
+  if (flags[reg] & REG_VOLATILE) {
+    // Read and write in one job, nothing runs in between
+    SPIDevice::JobOptions options = SPIDevice::ParseJobOptions(env, info[3]);
+    return device->QueueJob(env, new WriteJob(env, this, reg, mask, bits), options);
+  }
+
+  if (flags[reg] & REG_CACHED) {
+    uint32_t value = (values[reg] & ~mask) | bits;
+    Store(reg, value, true);
+    return Resolved(env, Napi::Number::New(env, value));
+  }
+
+  SPIDevice::JobOptions options = SPIDevice::ParseJobOptions(env, info[3]);
+  ReadJob* job = new ReadJob(env, this, reg);
+  job->update = true;
+  job->mask = mask;
+  job->bits = bits;
+  return device->QueueJob(env, job, options);
+}
+
+// sync([options]): resolves with the number of registers written
+Napi::Value SPIRegmap::Sync(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  SPIDevice::JobOptions options = SPIDevice::ParseJobOptions(env, info[0]);
+  SyncJob* job = new SyncJob(env, this);
+
+  for (uint32_t reg = 0; reg <= maxRegister; reg++) {
+    if (!(flags[reg] & REG_DIRTY)) {
+      continue;
+    }
+
+    uint32_t end = reg + 1;
+
+    while (layout.burst && end <= maxRegister && (flags[end] & REG_DIRTY)) {
+      end++;
+    }
+
+    uint8_t header[2];
+    size_t headerLen = Header(layout, reg, layout.writeFlag | (end - reg > 1 ? layout.burstFlag : 0), header);
+    size_t start = job->frames.size();
+
+    job->frames.insert(job->frames.end(), header, header + headerLen);
+    job->frames.resize(start + headerLen + (end - reg) * layout.valueBytes);
+
+    for (uint32_t r = reg; r < end; r++) {
+      StoreValue(job->frames.data() + start + headerLen + (r - reg) * layout.valueBytes,
+        values[r], layout.valueBytes);
+      job->written.emplace_back(r, generation[r]);
+    }
+
+    job->lengths.push_back(job->frames.size() - start);
+    reg = end - 1;
+  }
+
+  if (job->written.empty()) {
+    delete job;
+    return Resolved(env, Napi::Number::New(env, 0));
+  }
+
+  return device->QueueJob(env, job, options);
+}
+
+// invalidate(): forget the cache, e.g. after a reset of the peripheral.
+// Writes not synced yet are dropped, the defaults are cached again.
+Napi::Value SPIRegmap::Invalidate(const Napi::CallbackInfo& info) {
+  for (uint32_t reg = 0; reg <= maxRegister; reg++) {
+    flags[reg] &= REG_VOLATILE;
+    generation[reg]++;
+  }
+
+  for (const auto& entry : defaults) {
+    Store(entry.first, entry.second, false);
+  }
+
+  return info.Env().Undefined();
+}
+
+size_t SPIRegmap::Header(const Layout& layout, uint32_t reg, uint32_t flag, uint8_t* out) {
+  uint32_t word = (reg << layout.addressShift) | flag;
+  StoreValue(out, word, layout.addressBytes);
+  return layout.addressBytes;
+}
+
+// One frame: address with the read flag, dummy bytes, the value.
+// The caller holds the device mutex.
+int SPIRegmap::ReadRegister(SPIDevice* device, const Layout& layout, uint32_t reg, uint32_t& value) {
+  uint8_t tx[2 + 8 + 4] = {};
+  uint8_t rx[sizeof(tx)] = {};
+  size_t headerLen = Header(layout, reg, layout.readFlag, tx) + layout.dummyBytes;
+
+  std::vector<spi_ioc_transfer> message(1);
+  message[0] = {};
+  message[0].tx_buf = (unsigned long)tx;
+  message[0].rx_buf = (unsigned long)rx;
+  message[0].len = static_cast<uint32_t>(headerLen + layout.valueBytes);
+
+  int err = device->RunTransfers(message);
+
+  if (err == 0) {
+    value = LoadValue(rx + headerLen, layout.valueBytes);
+  }
+
+  return err;
+}
+
+int SPIRegmap::WriteRegister(SPIDevice* device, const Layout& layout, uint32_t reg, uint32_t value) {
+  uint8_t tx[2 + 4];
+  size_t headerLen = Header(layout, reg, layout.writeFlag, tx);
+  StoreValue(tx + headerLen, value, layout.valueBytes);
+
+  std::vector<spi_ioc_transfer> message(1);
+  message[0] = {};
+  message[0].tx_buf = (unsigned long)tx;
+  message[0].len = static_cast<uint32_t>(headerLen + layout.valueBytes);
+
+  return device->RunTransfers(message);
+}
+
+void SPIRegmap::ReadJob::Execute(SPIDevice* device) {
+  int err = ReadRegister(device, layout, reg, value);
+
+  if (err != 0) {
+    SetTransferError(err);
+  }
+}
+
+// Fills the cache; update() applies its bits to the newest value
+Napi::Value SPIRegmap::ReadJob::Result(Napi::Env env) {
+  uint8_t regFlags = regmap->flags[reg];
+
+  if (update) {
+    uint32_t base = (regFlags & REG_CACHED) ? regmap->values[reg] : value;
+    value = (base & ~mask) | bits;
+    regmap->Store(reg, value, true);
+  }
+  else if (!(regFlags & (REG_VOLATILE | REG_CACHED))) {
+    regmap->Store(reg, value, false);
+  }
+
+  return Napi::Number::New(env, value);
+}
+
+void SPIRegmap::WriteJob::Execute(SPIDevice* device) {
+  uint32_t full = layout.valueBytes == 4 ? 0xffffffffu : (1u << (8 * layout.valueBytes)) - 1;
+  int err = 0;
+  value = bits;
+
+  if (mask != full) {
+    err = ReadRegister(device, layout, reg, value);
+    value = (value & ~mask) | bits;
+  }
+
+  if (err == 0) {
+    err = WriteRegister(device, layout, reg, value);
+  }
+
+  if (err != 0) {
+    SetTransferError(err);
+  }
+}
+
+Napi::Value SPIRegmap::WriteJob::Result(Napi::Env env) {
+  return Napi::Number::New(env, value);
+}
+
+// The bursts are separate transfers with CS released in between,
+// issued together through the batching of RunTransfers()
+void SPIRegmap::SyncJob::Execute(SPIDevice* device) {
+  size_t offset = 0;
+  transfers.assign(lengths.size(), spi_ioc_transfer());
+
+  for (size_t i = 0; i < lengths.size(); i++) {
+    transfers[i].tx_buf = (unsigned long)(frames.data() + offset);
+    transfers[i].len = static_cast<uint32_t>(lengths[i]);
+    transfers[i].cs_change = i + 1 < lengths.size() ? 1 : 0;
+    offset += lengths[i];
+  }
+
+  int err = Run(device, transfers);
+
+  if (err != 0) {
+    SetTransferError(err);
+  }
+}
+
+// Registers written again since sync() was called stay dirty
+Napi::Value SPIRegmap::SyncJob::Result(Napi::Env env) {
+  for (const auto& entry : written) {
+    if (regmap->generation[entry.first] == entry.second) {
+      regmap->flags[entry.first] &= ~REG_DIRTY;
+    }
+  }
+
+  return Napi::Number::New(env, static_cast<double>(written.size()));
+}
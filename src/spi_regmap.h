@@ -0,0 +1,128 @@
+#ifndef SPI_REGMAP_H
+#define SPI_REGMAP_H
+
+#include "spi_device.h"
+
+// Register map of a peripheral on an SPIDevice, in the style of the
+// kernel regmap: the frame layout is declared once, cacheable registers
+// are served from a write-back cache without bus traffic, and sync()
+// writes the dirty ones, adjacent registers combined into bursts, as
+// one batch of spi_ioc_transfers. Volatile registers always go to the
+// bus. The cache lives on the JS thread; jobs carry what they need.
+class SPIRegmap : public Napi::ObjectWrap<SPIRegmap> {
+
+public:
+  static Napi::Object Init(Napi::Env env, Napi::Object exports);
+  SPIRegmap(const Napi::CallbackInfo& info);
+
+  Napi::Value Read(const Napi::CallbackInfo& info);
+  Napi::Value Write(const Napi::CallbackInfo& info);
+  Napi::Value Update(const Napi::CallbackInfo& info);
+  Napi::Value Sync(const Napi::CallbackInfo& info);
+  Napi::Value Invalidate(const Napi::CallbackInfo& info);
+
+private:
+  // How a register access looks on the wire
+  struct Layout {
+    size_t addressBytes = 1;
+    uint32_t addressShift = 0;
+    uint32_t readFlag = 0x80;   // OR'ed into the shifted address
+    uint32_t writeFlag = 0;
+    uint32_t burstFlag = 0;     // OR'ed in for multi-register accesses
+    size_t dummyBytes = 0;      // between address and data of a read
+    size_t valueBytes = 1;      // big endian
+    bool burst = true;          // the device auto-increments the address
+  };
+
+  enum RegisterFlags : uint8_t {
+    REG_VOLATILE = 1,
+    REG_CACHED = 2,
+    REG_DIRTY = 4
+  };
+
+  SPIDevice* device = nullptr;
+  Napi::ObjectReference deviceRef;
+  Layout layout;
+  uint32_t maxRegister = 0;
+  uint32_t valueMask = 0xff;
+  std::vector<uint32_t> values;
+  std::vector<uint8_t> flags;
+  std::vector<uint32_t> generation;  // bumped by every cached write
+  std::vector<std::pair<uint32_t, uint32_t>> defaults;  // register, reset value
+
+  uint32_t ParseRegister(Napi::Env env, const Napi::Value& val);
+  uint32_t ParseValue(Napi::Env env, const Napi::Value& val);
+  void Store(uint32_t reg, uint32_t value, bool dirty);
+  Napi::Value Resolved(Napi::Env env, Napi::Value value);
+
+  static size_t Header(const Layout& layout, uint32_t reg, uint32_t flag, uint8_t* out);
+  static int ReadRegister(SPIDevice* device, const Layout& layout, uint32_t reg, uint32_t& value);
+  static int WriteRegister(SPIDevice* device, const Layout& layout, uint32_t reg, uint32_t value);
+
+  class RegmapJob : public SPIDevice::Job {
+    public:
+      RegmapJob(Napi::Env env, SPIRegmap* regmap)
+        : SPIDevice::Job(env),
+        regmap(regmap),
+        regmapRef(Napi::Persistent(regmap->Value())),
+        layout(regmap->layout) {}
+
+    protected:
+      SPIRegmap* regmap;
+      Napi::ObjectReference regmapRef;  // keeps the regmap alive while queued
+      Layout layout;
+  };
+
+  // read(), and update() of a register that is not cached yet
+  class ReadJob : public RegmapJob {
+    public:
+      ReadJob(Napi::Env env, SPIRegmap* regmap, uint32_t reg)
+        : RegmapJob(env, regmap), reg(reg) {}
+
+      void Execute(SPIDevice* device) override;
+      Napi::Value Result(Napi::Env env) override;
+
+      bool update = false;  // apply mask / bits to the cache in Result()
+      uint32_t mask = 0;
+      uint32_t bits = 0;
+
+    private:
+      uint32_t reg;
+      uint32_t value = 0;
+  };
+
+  // write() and update() of a volatile register
+  class WriteJob : public RegmapJob {
+    public:
+      WriteJob(Napi::Env env, SPIRegmap* regmap, uint32_t reg, uint32_t mask, uint32_t bits)
+        : RegmapJob(env, regmap), reg(reg), mask(mask), bits(bits) {}
+
+      void Execute(SPIDevice* device) override;
+      Napi::Value Result(Napi::Env env) override;
+
+    private:
+      uint32_t reg;
+      uint32_t mask;  // all bits: plain write, otherwise read-modify-write
+      uint32_t bits;
+      uint32_t value = 0;
+  };
+
+  // sync(): the dirty registers, one transfer per burst, one batch
+  class SyncJob : public RegmapJob {
+    public:
+      SyncJob(Napi::Env env, SPIRegmap* regmap)
+        : RegmapJob(env, regmap) {}
+
+      void Execute(SPIDevice* device) override;
+      Napi::Value Result(Napi::Env env) override;
+
+      std::vector<uint8_t> frames;  // all bursts back to back
+      std::vector<size_t> lengths;
+      std::vector<std::pair<uint32_t, uint32_t>> written;  // register, generation
+
+    private:
+      std::vector<spi_ioc_transfer> transfers;
+  };
+};
+
+#endif
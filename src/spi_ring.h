@@ -0,0 +1,49 @@
+#ifndef SPI_RING_H
+#define SPI_RING_H
+
+#include <atomic>
+#include <array>
+#include <cstddef>
+
+// Bounded lock-free single-producer / single-consumer ring.
+// Push() may only be called from one thread and Pop() from one other thread.
+template <typename T, size_t N>
+class SPIRing {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "SPIRing size must be a power of two");
+
+public:
+  bool Push(const T& item) {
+    size_t head = this->head.load(std::memory_order_relaxed);
+
+    if (head - this->tail.load(std::memory_order_acquire) == N) {
+      return false;  // full
+    }
+
+    slots[head & (N - 1)] = item;
+    this->head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool Pop(T& item) {
+    size_t tail = this->tail.load(std::memory_order_relaxed);
+
+    if (tail == this->head.load(std::memory_order_acquire)) {
+      return false;  // empty
+    }
+
+    item = slots[tail & (N - 1)];
+    this->tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool Empty() const {
+    return tail.load(std::memory_order_acquire) == head.load(std::memory_order_acquire);
+  }
+
+private:
+  std::array<T, N> slots;
+  alignas(64) std::atomic<size_t> head{0};
+  alignas(64) std::atomic<size_t> tail{0};
+};
+
+#endif
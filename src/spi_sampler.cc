@@ -0,0 +1,569 @@
+#include "spi_sampler.h"
+#include "spi_program.h"
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <linux/gpio.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+namespace {
+  // Upper bound on one sleep, so Stop() never waits a full long interval
+  const uint64_t MAX_SLEEP_NS = 100000000;
+
+  uint64_t NowNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+  }
+
+  void SleepUntil(uint64_t ns) {
+    timespec ts;
+    ts.tv_sec = static_cast<time_t>(ns / 1000000000ull);
+    ts.tv_nsec = static_cast<long>(ns % 1000000000ull);
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {}
+  }
+
+  size_t ParseCount(Napi::Env env, const Napi::Object& obj, const char* name,
+      size_t defaultValue, int64_t min) {
+    if (!obj.Has(name)) {
+      return defaultValue;
+    }
+
+    if (!obj.Get(name).IsNumber()) {
+      throw Napi::TypeError::New(env, std::string("'") + name + "' must be a number");
+    }
+
+    int64_t value = obj.Get(name).As<Napi::Number>().Int64Value();
+
+    if (value < min) {
+      throw Napi::RangeError::New(env, std::string("'") + name + "' must be at least " + std::to_string(min));
+    }
+
+    return static_cast<size_t>(value);
+  }
+}
+
+SPISampler::Options SPISampler::ParseOptions(Napi::Env env, const Napi::Object& obj, bool timed) {
+  Options options;
+  options.batchSize = ParseCount(env, obj, "batchSize", 1, 1);
+  // One batch is filled while the others wait for JS, so at least two
+  options.ringBatches = ParseCount(env, obj, "ringBatches", 4, 2);
+  options.thread = SPIIoThread::ParseOptions(obj, timed ? "startSampling" : "armOnEvent");
+
+  if (!timed) {
+    return options;
+  }
+
+  if (!obj.Has("intervalNs") || !(obj.Get("intervalNs").IsNumber() || obj.Get("intervalNs").IsBigInt())) {
+    throw Napi::TypeError::New(env, "'intervalNs' number or bigint expected");
+  }
+
+  Napi::Value interval = obj.Get("intervalNs");
+
+  if (interval.IsBigInt()) {
+    bool lossless;
+    options.intervalNs = interval.As<Napi::BigInt>().Uint64Value(&lossless);
+  }
+  else {
+    int64_t value = interval.As<Napi::Number>().Int64Value();
+    options.intervalNs = value > 0 ? static_cast<uint64_t>(value) : 0;
+  }
+
+  if (options.intervalNs == 0) {
+    throw Napi::RangeError::New(env, "'intervalNs' must be greater than 0");
+  }
+
+  return options;
+}
+
+SPISampler::SPISampler(Napi::Env env, SPIDevice* device, SPIProgram* program,
+    Napi::Object programObj, Napi::Function callback, const Options& options)
+  : device(device),
+    program(program),
+    programRef(Napi::Persistent(programObj)),
+    transfers(&program->batch.transfers),
+    options(options) {
+
+  // Batches carry the raw rx bytes, decode them in the callback. The
+  // typed arrays of the program are JS memory the thread can not touch.
+  if (!program->batch.words.empty()) {
+    throw Napi::Error::New(env, "Programs with encode or decode can not be sampled");
+  }
+
+  for (const spi_ioc_transfer& tr : *transfers) {
+    if (tr.rx_buf != 0) {
+      sampleBytes += tr.len;
+    }
+  }
+
+  ring = new Ring();
+  ring->count = options.ringBatches;
+  ring->samples = options.batchSize;
+  ring->batchBytes = sampleBytes * options.batchSize;
+  ring->batches.reset(new Batch[ring->count]);
+
+  for (size_t i = 0; i < ring->count; i++) {
+    ring->batches[i].data.reset(new uint8_t[ring->batchBytes > 0 ? ring->batchBytes : 1]);
+  }
+
+  if (options.eventFd >= 0) {
+    try {
+      OpenEventFd(env);
+    }
+    catch (const Napi::Error&) {
+      CloseFds();
+      delete ring;
+      throw;
+    }
+
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    epoll_event trigger = {};
+    trigger.events = EPOLLIN | EPOLLPRI;
+    trigger.data.fd = eventFd;
+
+    epoll_event wake = {};
+    wake.events = EPOLLIN;
+    wake.data.fd = wakeFd;
+
+    if (epollFd < 0 || wakeFd < 0 ||
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, eventFd, &trigger) == -1 ||
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &wake) == -1) {
+      std::string err = std::string("Failed to watch the event fd: ") + std::strerror(errno);
+
+      CloseFds();
+      delete ring;
+      throw Napi::Error::New(env, err);
+    }
+  }
+
+  delivery = DeliveryTsfn::New(env, callback, "SPIDevice sampling", 0, 1, ring, Finalize);
+
+  thread = std::thread(&SPISampler::Run, this);
+
+  std::string err = SPIIoThread::ApplyOptions(thread, options.thread, "sampling thread");
+
+  if (!err.empty()) {
+    Stop();
+    CloseFds();
+    throw Napi::Error::New(env, err);
+  }
+}
+
+SPISampler::~SPISampler() {
+  Stop();
+  CloseFds();
+}
+
+void SPISampler::CloseFds() {
+  if (epollFd >= 0) {
+    close(epollFd);
+    epollFd = -1;
+  }
+
+  if (wakeFd >= 0) {
+    close(wakeFd);
+    wakeFd = -1;
+  }
+
+  if (eventFd >= 0) {
+    // The caller's blocking reads work as before
+    if (sharedFlags >= 0) {
+      fcntl(eventFd, F_SETFL, sharedFlags);
+    }
+
+    close(eventFd);
+    eventFd = -1;
+  }
+}
+
+void SPISampler::Stop() {
+  if (!thread.joinable()) {
+    return;
+  }
+
+  stopping.store(true, std::memory_order_release);
+
+  if (wakeFd >= 0) {
+    uint64_t one = 1;
+    ssize_t written = write(wakeFd, &one, sizeof(one));
+    (void)written;
+  }
+
+  thread.join();
+
+  // Batches already queued are still delivered, the ring is freed
+  // by the finalizer once the thread-safe function is done.
+  delivery.Release();
+}
+
+void SPISampler::Run() {
+  const uint64_t interval = options.intervalNs;
+
+  uint64_t next = NowNs();
+  uint64_t sequence = 0;
+  uint64_t overruns = 0;
+  uint64_t dropped = 0;
+  uint64_t errors = 0;
+  uint64_t crcErrors = 0;
+  uint64_t events = 0;  // consumed from the event fd, not run yet
+  size_t slot = 0;
+  size_t filled = 0;
+
+  while (!stopping.load(std::memory_order_acquire)) {
+    uint64_t now = NowNs();
+
+    if (epollFd >= 0) {
+      if (events == 0 && !WaitEvent(events)) {
+        break;
+      }
+
+      if (events == 0) {
+        continue;  // woken without an event
+      }
+
+      events--;
+    }
+    else if (now < next) {
+      SleepUntil(std::min(next, now + MAX_SLEEP_NS));
+      continue;
+    }
+
+    Batch& batch = ring->batches[slot];
+    uint8_t* dst = batch.data.get() + filled * sampleBytes;
+
+    uint64_t sampled;
+
+    // The rx buffers are the program's, run() and runSync() write them
+    // too: copy them out before another run can take the mutex
+    {
+      std::lock_guard<std::mutex> lock(device->mutex);
+
+      // Per sample like every run: the tx CRCs cover patches of run()
+      SPIDevice::SealCrcs(program->batch);
+
+      if (device->RunTransfers(*transfers) != 0) {
+        errors++;
+      }
+      else if (SPIDevice::CheckCrcs(program->batch) >= 0) {
+        crcErrors++;
+      }
+
+      sampled = NowNs();
+
+      for (const spi_ioc_transfer& tr : *transfers) {
+        if (tr.rx_buf != 0) {
+          std::memcpy(dst, reinterpret_cast<const void*>(tr.rx_buf), tr.len);
+          dst += tr.len;
+        }
+      }
+    }
+
+    if (filled == 0) {
+      batch.firstNs = sampled;
+    }
+
+    batch.lastNs = sampled;
+
+    if (++filled == options.batchSize) {
+      size_t nextSlot = (slot + 1) % ring->count;
+
+      if (ring->batches[nextSlot].pending.load(std::memory_order_acquire)) {
+        // JS is behind: the ring is full, overwrite this batch
+        dropped++;
+      }
+      else {
+        batch.sequence = sequence++;
+        batch.overruns = overruns;
+        batch.dropped = dropped;
+        batch.errors = errors;
+        batch.crcErrors = crcErrors;
+        batch.pending.store(true, std::memory_order_release);
+
+        delivery.NonBlockingCall(&batch);
+        slot = nextSlot;
+      }
+
+      filled = 0;
+    }
+
+    if (epollFd >= 0) {
+      continue;
+    }
+
+    // Absolute deadlines: no drift. Deadlines that were missed
+    // are skipped and counted as overruns.
+    next += interval;
+    now = NowNs();
+
+    if (now > next) {
+      uint64_t missed = (now - next) / interval + 1;
+      overruns += missed;
+      next += missed * interval;
+    }
+  }
+}
+
+// One program run per event: reads the fd one line event record at a
+// time and an eventfd as a count, so edges that arrive together are not
+// folded into one run. Pipes count a run per byte. Anything else, like a
+// sysfs GPIO value file, is drained and rewound per wakeup.
+//
+// The sampler reads a non-blocking fd of its own, so a spurious wakeup
+// never blocks Stop() and closing the caller's fd number can not make it
+// read a file that later reuses the number. Pipes and files are opened
+// again through /proc, a new open file description. Anonymous inodes
+// (eventfd, GPIO line requests) and sockets can not be reopened: a dup
+// shares the caller's status flags, so O_NONBLOCK is set on it until
+// CloseFds() restores them.
+void SPISampler::OpenEventFd(Napi::Env env) {
+  int fd = options.eventFd;
+  std::string link = "/proc/self/fd/" + std::to_string(fd);
+
+  eventFd = open(link.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+
+  if (eventFd < 0) {
+    eventFd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    int flags = eventFd >= 0 ? fcntl(eventFd, F_GETFL) : -1;
+
+    if (flags == -1) {
+      throw Napi::Error::New(env, std::string("Failed to open the event fd: ") + std::strerror(errno));
+    }
+
+    if (!(flags & O_NONBLOCK)) {
+      if (fcntl(eventFd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        throw Napi::Error::New(env, std::string("Failed to make the event fd non-blocking: ") + std::strerror(errno));
+      }
+
+      sharedFlags = flags;
+    }
+  }
+
+  struct stat st;
+
+  if (fstat(eventFd, &st) == 0 && (S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode))) {
+    eventSize = 1;
+    return;
+  }
+
+  char target[64];
+  ssize_t n = readlink(link.c_str(), target, sizeof(target) - 1);
+  std::string name(target, n > 0 ? static_cast<size_t>(n) : 0);
+
+  if (name == "anon_inode:[eventfd]") {
+    eventSize = sizeof(uint64_t);
+    eventCounter = true;
+  }
+  else if (name == "anon_inode:gpio-line") {
+    eventSize = sizeof(gpio_v2_line_event);
+  }
+  else if (name == "anon_inode:gpio-event") {
+    eventSize = sizeof(gpioevent_data);  // GPIO character device ABI v1
+  }
+}
+
+// Blocks until the event fd is ready and consumes one event, or all
+// of an eventfd counter, see OpenEventFd(). `events` is the number
+// of runs they ask for, 0 when the fd had nothing after all. Returns
+// false on Stop(), or when the fd hung up or failed.
+bool SPISampler::WaitEvent(uint64_t& events) {
+  epoll_event ready[2];
+  int count;
+
+  do {
+    count = epoll_wait(epollFd, ready, 2, -1);
+  } while (count == -1 && errno == EINTR);
+
+  if (count <= 0 || stopping.load(std::memory_order_acquire)) {
+    return false;
+  }
+
+  for (int i = 0; i < count; i++) {
+    if (ready[i].data.fd != eventFd) {
+      continue;
+    }
+
+    if (!(ready[i].events & (EPOLLIN | EPOLLPRI))) {
+      return false;  // EPOLLHUP or EPOLLERR only
+    }
+
+    ssize_t n;
+
+    if (eventCounter) {
+      uint64_t value = 0;
+      n = read(eventFd, &value, sizeof(value));
+      events = n == sizeof(value) ? value : 0;
+      return true;
+    }
+
+    if (eventSize > 0) {
+      uint8_t record[sizeof(gpio_v2_line_event)];
+      n = read(eventFd, record, eventSize);
+      events = n == static_cast<ssize_t>(eventSize) ? 1 : 0;
+    }
+    else {
+      // A sysfs GPIO value file reads 0 bytes until it is rewound
+      uint8_t scratch[256];
+      n = read(eventFd, scratch, sizeof(scratch));
+
+      if (n == 0 && lseek(eventFd, 0, SEEK_SET) == 0) {
+        n = read(eventFd, scratch, sizeof(scratch));
+      }
+
+      events = n > 0 ? 1 : 0;
+    }
+
+    if (n == 0 && (ready[i].events & EPOLLHUP)) {
+      return false;  // write end of a pipe closed
+    }
+
+    return true;
+  }
+
+  return false;
+}
+
+void SPISampler::CallJs(Napi::Env env, Napi::Function callback, Ring* ring, Batch* batch) {
+  if (env == nullptr) {
+    return;
+  }
+
+  Napi::Buffer<uint8_t> data = Napi::Buffer<uint8_t>::Copy(env, batch->data.get(), ring->batchBytes);
+
+  Napi::Object info = Napi::Object::New(env);
+  info.Set("sequence", Napi::Number::New(env, static_cast<double>(batch->sequence)));
+  info.Set("samples", Napi::Number::New(env, static_cast<double>(ring->samples)));
+  info.Set("firstNs", Napi::BigInt::New(env, batch->firstNs));
+  info.Set("lastNs", Napi::BigInt::New(env, batch->lastNs));
+  info.Set("overruns", Napi::Number::New(env, static_cast<double>(batch->overruns)));
+  info.Set("dropped", Napi::Number::New(env, static_cast<double>(batch->dropped)));
+  info.Set("errors", Napi::Number::New(env, static_cast<double>(batch->errors)));
+  info.Set("crcErrors", Napi::Number::New(env, static_cast<double>(batch->crcErrors)));
+
+  // The copy is made, the sampling thread may reuse the slot
+  batch->pending.store(false, std::memory_order_release);
+
+  try {
+    callback.Call({ data, info });
+  }
+  catch (const Napi::Error& e) {
+    e.ThrowAsJavaScriptException();
+  }
+}
+
+void SPISampler::Finalize(Napi::Env, void*, Ring* ring) {
+  delete ring;
+}
+
+Napi::Value SPIDevice::StartSampling(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 2 || !info[0].IsObject() || !info[1].IsFunction()) {
+    Napi::TypeError::New(env, "Sampling options object and callback function expected")
+      .ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  if (sampler) {
+    throw Napi::Error::New(env, "Sampling or an event trigger is already running on this device");
+  }
+
+  Napi::Object obj = info[0].As<Napi::Object>();
+
+  if (!obj.Has("program") || !obj.Get("program").IsObject()) {
+    throw Napi::TypeError::New(env, "'program' from SPIDevice.prepare() expected");
+  }
+
+  Napi::Object programObj = obj.Get("program").As<Napi::Object>();
+  SPIProgram* program;
+
+  try {
+    program = SPIProgram::Unwrap(programObj);
+  }
+  catch (const Napi::Error&) {
+    throw Napi::TypeError::New(env, "'program' from SPIDevice.prepare() expected");
+  }
+
+  if (program == nullptr || program->device != this) {
+    throw Napi::Error::New(env, "'program' must be prepared on this device");
+  }
+
+  SPISampler::Options options = SPISampler::ParseOptions(env, obj, true);
+
+  sampler.reset(new SPISampler(env, this, program, programObj,
+    info[1].As<Napi::Function>(), options));
+
+  // The sampling thread uses the device until stopSampling()
+  Ref();
+
+  return env.Undefined();
+}
+
+Napi::Value SPIDevice::StopSampling(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  if (sampler) {
+    sampler.reset();
+    Unref();
+  }
+
+  return env.Undefined();
+}
+
+// armOnEvent(fd, program, onBatch[, { batchSize, ringBatches, cpu, priority }])
+Napi::Value SPIDevice::ArmOnEvent(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 3 || !info[0].IsNumber() || !info[1].IsObject() || !info[2].IsFunction()) {
+    Napi::TypeError::New(env, "File descriptor, program and callback function expected")
+      .ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  if (sampler) {
+    throw Napi::Error::New(env, "Sampling or an event trigger is already running on this device");
+  }
+
+  int fd = info[0].As<Napi::Number>().Int32Value();
+
+  if (fd < 0) {
+    throw Napi::RangeError::New(env, "File descriptor must not be negative");
+  }
+
+  Napi::Object programObj = info[1].As<Napi::Object>();
+  SPIProgram* program;
+
+  try {
+    program = SPIProgram::Unwrap(programObj);
+  }
+  catch (const Napi::Error&) {
+    throw Napi::TypeError::New(env, "Program from SPIDevice.prepare() expected");
+  }
+
+  if (program == nullptr || program->device != this) {
+    throw Napi::Error::New(env, "Program must be prepared on this device");
+  }
+
+  Napi::Object obj = info[3].IsObject() ? info[3].As<Napi::Object>() : Napi::Object::New(env);
+  SPISampler::Options options = SPISampler::ParseOptions(env, obj, false);
+  options.eventFd = fd;
+
+  sampler.reset(new SPISampler(env, this, program, programObj,
+    info[2].As<Napi::Function>(), options));
+
+  // The trigger thread uses the device until disarm()
+  Ref();
+
+  return env.Undefined();
+}
+
+Napi::Value SPIDevice::Disarm(const Napi::CallbackInfo& info) {
+  return StopSampling(info);
+}
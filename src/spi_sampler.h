@@ -0,0 +1,87 @@
+#ifndef SPI_SAMPLER_H
+#define SPI_SAMPLER_H
+
+#include "spi_device.h"
+#include "spi_io_thread.h"
+#include <atomic>
+#include <memory>
+#include <thread>
+
+class SPIProgram;
+
+// Runs a prepared program on a native thread, either at a fixed rate
+// driven by clock_nanosleep() with absolute deadlines, or each time a
+// pollable fd (a GPIO line event fd, an eventfd, a pipe) becomes ready,
+// waited for with epoll. The rx data of every run is appended to a
+// preallocated ring of batches; full batches are delivered to a JS
+// callback through a thread-safe function.
+class SPISampler {
+
+public:
+  struct Options {
+    uint64_t intervalNs = 0;  // timed sampling
+    int eventFd = -1;         // or runs triggered by this fd
+    size_t batchSize = 1;
+    size_t ringBatches = 4;
+    SPIIoThread::Options thread;
+  };
+
+  static Options ParseOptions(Napi::Env env, const Napi::Object& obj, bool timed);
+
+  SPISampler(Napi::Env env, SPIDevice* device, SPIProgram* program,
+    Napi::Object programObj, Napi::Function callback, const Options& options);
+  ~SPISampler();
+
+  void Stop();
+
+private:
+  struct Batch {
+    std::unique_ptr<uint8_t[]> data;
+    std::atomic<bool> pending{false};  // waiting for delivery to JS
+    uint64_t sequence = 0;
+    uint64_t firstNs = 0;
+    uint64_t lastNs = 0;
+    uint64_t overruns = 0;
+    uint64_t dropped = 0;
+    uint64_t errors = 0;
+    uint64_t crcErrors = 0;
+  };
+
+  // Shared with the thread-safe function and freed by its finalizer,
+  // so queued deliveries stay valid after Stop().
+  struct Ring {
+    std::unique_ptr<Batch[]> batches;
+    size_t count;
+    size_t batchBytes;
+    size_t samples;
+  };
+
+  static void CallJs(Napi::Env env, Napi::Function callback, Ring* ring, Batch* batch);
+  static void Finalize(Napi::Env env, void* data, Ring* ring);
+
+  using DeliveryTsfn = Napi::TypedThreadSafeFunction<Ring, Batch, CallJs>;
+
+  SPIDevice* device;
+  SPIProgram* program;
+  Napi::ObjectReference programRef;
+  std::vector<spi_ioc_transfer>* transfers;
+  size_t sampleBytes = 0;
+  Options options;
+  Ring* ring;
+  DeliveryTsfn delivery;
+  std::atomic<bool> stopping{false};
+  std::thread thread;
+  int epollFd = -1;  // event triggered: eventFd and wakeFd
+  int wakeFd = -1;   // eventfd written by Stop()
+  int eventFd = -1;  // own open of options.eventFd, or a dup of it
+  int sharedFlags = -1;       // status flags to restore on a dup, see OpenEventFd()
+  size_t eventSize = 0;       // bytes of one event on eventFd, 0: drain and rewind
+  bool eventCounter = false;  // an eventfd, its value counts the events
+
+  void Run();
+  void OpenEventFd(Napi::Env env);
+  void CloseFds();
+  bool WaitEvent(uint64_t& events);
+};
+
+#endif
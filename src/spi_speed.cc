@@ -1,25 +1,34 @@
 #include "spi_device.h"
 #include <sys/ioctl.h>
 #include <linux/spi/spidev.h>  // For SPI_IOC_WR_MODE etc
+#include <cerrno>
 
-void SPIDevice::SetMaxSpeedHzInternal(uint32_t speed) {
-  uint32_t read_speed = 0;
-  IoctlOrThrow(SPI_IOC_RD_MAX_SPEED_HZ, &read_speed, "SPI_IOC_RD_MAX_SPEED_HZ");
+// Caller holds the mutex. No ioctl when the shadow already has the speed.
+int SPIDevice::WriteMaxSpeedHz(uint32_t speed) {
+  if (speed == shadowSpeed.load(std::memory_order_relaxed)) {
+    return 0;
+  }
+
+  if (backend->Ioctl(SPI_IOC_WR_MAX_SPEED_HZ, &speed) == -1) {
+    return errno;
+  }
 
-  if (Env().IsExceptionPending()){
-    return;
-  } // stop on error
+  shadowSpeed.store(speed, std::memory_order_relaxed);
+  return 0;
+}
 
-  if (read_speed != speed) {
-    IoctlOrThrow(SPI_IOC_WR_MAX_SPEED_HZ, &speed, "SPI_IOC_WR_MAX_SPEED_HZ");
+void SPIDevice::SetMaxSpeedHzInternal(uint32_t speed) {
+  int err = WriteMaxSpeedHz(speed);
+
+  if (err != 0) {
+    Napi::Error::New(Env(), std::string("SPI_IOC_WR_MAX_SPEED_HZ failed: ") + strerror(err))
+      .ThrowAsJavaScriptException();
   }
 }
 
 Napi::Value SPIDevice::SetMaxSpeedHz(const Napi::CallbackInfo& info) {
     Napi::Env env = info.Env();
 
-    SPI_LOCK_GUARD;
-
     if (info.Length() < 1 || !info[0].IsNumber()) {
       Napi::TypeError::New(env, "Speed in Hz expected")
         .ThrowAsJavaScriptException();
@@ -30,22 +39,22 @@ Napi::Value SPIDevice::SetMaxSpeedHz(const Napi::CallbackInfo& info) {
 
     ValidateMaxSpeedHz(env, speed);
 
+    if (env.IsExceptionPending()) {
+      return env.Null();
+    }
+
+    // Unchanged: no need to wait for the mutex
+    if (speed == shadowSpeed.load(std::memory_order_relaxed)) {
+      return env.Undefined();
+    }
+
+    SPI_LOCK_GUARD;
+
     SetMaxSpeedHzInternal(speed);
 
     return env.IsExceptionPending() ? env.Null() : env.Undefined();
 }
 
 Napi::Value SPIDevice::GetMaxSpeedHz(const Napi::CallbackInfo& info) {
-  Napi::Env env = info.Env();
-
-  SPI_LOCK_GUARD;
-
-  uint32_t speed;
-  IoctlOrThrow(SPI_IOC_RD_MAX_SPEED_HZ, &speed, "SPI_IOC_RD_MAX_SPEED_HZ");
-
-  if (env.IsExceptionPending()){
-    return env.Null();
-  }
-
-  return Napi::Number::New(env, speed);
+  return Napi::Number::New(info.Env(), shadowSpeed.load(std::memory_order_relaxed));
 }
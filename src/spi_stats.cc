@@ -0,0 +1,156 @@
+#include "spi_device.h"
+#include <string>
+
+size_t SPIHistogram::Index(uint64_t ns) {
+  if (ns < (1u << SUB_BITS)) {
+    return static_cast<size_t>(ns);
+  }
+
+  int shift = 63 - __builtin_clzll(ns) - SUB_BITS;
+  size_t sub = static_cast<size_t>(ns >> shift) & ((1u << SUB_BITS) - 1);
+
+  return (static_cast<size_t>(shift + 1) << SUB_BITS) + sub;
+}
+
+uint64_t SPIHistogram::UpperBound(size_t index) {
+  if (index < (1u << SUB_BITS)) {
+    return index;
+  }
+
+  int shift = static_cast<int>(index >> SUB_BITS) - 1;
+  uint64_t sub = index & ((1u << SUB_BITS) - 1);
+
+  return (((1ull << SUB_BITS) + sub + 1) << shift) - 1;
+}
+
+void SPIHistogram::Record(uint64_t ns) {
+  buckets[Index(ns)].fetch_add(1, std::memory_order_relaxed);
+  count.fetch_add(1, std::memory_order_relaxed);
+  sum.fetch_add(ns, std::memory_order_relaxed);
+
+  uint64_t prev = max.load(std::memory_order_relaxed);
+
+  while (ns > prev && !max.compare_exchange_weak(prev, ns, std::memory_order_relaxed)) {}
+}
+
+void SPIHistogram::Reset() {
+  for (std::atomic<uint64_t>& bucket : buckets) {
+    bucket.store(0, std::memory_order_relaxed);
+  }
+
+  count.store(0, std::memory_order_relaxed);
+  sum.store(0, std::memory_order_relaxed);
+  max.store(0, std::memory_order_relaxed);
+}
+
+Napi::Object SPIHistogram::Snapshot(Napi::Env env) const {
+  static const double PERCENTILES[] = { 50, 90, 99, 99.9 };
+  static const char* NAMES[] = { "p50", "p90", "p99", "p999" };
+
+  // Buckets are copied first, recording may go on meanwhile
+  uint64_t copy[BUCKETS];
+  uint64_t total = 0;
+
+  for (size_t i = 0; i < BUCKETS; i++) {
+    copy[i] = buckets[i].load(std::memory_order_relaxed);
+    total += copy[i];
+  }
+
+  uint64_t maxNs = max.load(std::memory_order_relaxed);
+
+  Napi::Object obj = Napi::Object::New(env);
+  obj.Set("count", Napi::Number::New(env, static_cast<double>(total)));
+  obj.Set("mean", Napi::Number::New(env, total == 0 ? 0 :
+    static_cast<double>(sum.load(std::memory_order_relaxed)) / static_cast<double>(total)));
+  obj.Set("max", Napi::Number::New(env, static_cast<double>(maxNs)));
+
+  size_t i = 0;
+  uint64_t seen = 0;
+
+  for (size_t p = 0; p < sizeof(PERCENTILES) / sizeof(PERCENTILES[0]); p++) {
+    uint64_t rank = static_cast<uint64_t>(static_cast<double>(total) * PERCENTILES[p] / 100.0);
+    uint64_t value = 0;
+
+    if (total > 0) {
+      while (i < BUCKETS && seen + copy[i] <= rank) {
+        seen += copy[i++];
+      }
+
+      value = i < BUCKETS ? UpperBound(i) : maxNs;
+
+      if (value > maxNs) {
+        value = maxNs;
+      }
+    }
+
+    obj.Set(NAMES[p], Napi::Number::New(env, static_cast<double>(value)));
+  }
+
+  return obj;
+}
+
+void SPIStats::RecordError(int err) {
+  if (err < 0 || err > MAX_ERRNO) {
+    err = MAX_ERRNO;
+  }
+
+  Add(errors[err], 1);
+}
+
+void SPIStats::Reset() {
+  transfers.store(0, std::memory_order_relaxed);
+  messages.store(0, std::memory_order_relaxed);
+  bytesIn.store(0, std::memory_order_relaxed);
+  bytesOut.store(0, std::memory_order_relaxed);
+  deadlineMisses.store(0, std::memory_order_relaxed);
+  preemptions.store(0, std::memory_order_relaxed);
+  aborted.store(0, std::memory_order_relaxed);
+
+  for (std::atomic<uint64_t>& counter : errors) {
+    counter.store(0, std::memory_order_relaxed);
+  }
+
+  queueWait.Reset();
+  ioctl.Reset();
+  completion.Reset();
+}
+
+Napi::Object SPIStats::Snapshot(Napi::Env env) const {
+  Napi::Object obj = Napi::Object::New(env);
+
+  obj.Set("transfers", Napi::Number::New(env, static_cast<double>(transfers.load(std::memory_order_relaxed))));
+  obj.Set("messages", Napi::Number::New(env, static_cast<double>(messages.load(std::memory_order_relaxed))));
+  obj.Set("bytesIn", Napi::Number::New(env, static_cast<double>(bytesIn.load(std::memory_order_relaxed))));
+  obj.Set("bytesOut", Napi::Number::New(env, static_cast<double>(bytesOut.load(std::memory_order_relaxed))));
+
+  obj.Set("deadlineMisses", Napi::Number::New(env, static_cast<double>(deadlineMisses.load(std::memory_order_relaxed))));
+  obj.Set("preemptions", Napi::Number::New(env, static_cast<double>(preemptions.load(std::memory_order_relaxed))));
+  obj.Set("aborted", Napi::Number::New(env, static_cast<double>(aborted.load(std::memory_order_relaxed))));
+
+  // { [errno]: count }, only errors that occurred
+  Napi::Object errorObj = Napi::Object::New(env);
+
+  for (int i = 0; i <= MAX_ERRNO; i++) {
+    uint64_t n = errors[i].load(std::memory_order_relaxed);
+
+    if (n != 0) {
+      errorObj.Set(std::to_string(i), Napi::Number::New(env, static_cast<double>(n)));
+    }
+  }
+
+  obj.Set("errors", errorObj);
+  obj.Set("queueWait", queueWait.Snapshot(env));
+  obj.Set("ioctl", ioctl.Snapshot(env));
+  obj.Set("completion", completion.Snapshot(env));
+
+  return obj;
+}
+
+Napi::Value SPIDevice::GetStats(const Napi::CallbackInfo& info) {
+  return stats.Snapshot(info.Env());
+}
+
+Napi::Value SPIDevice::ResetStats(const Napi::CallbackInfo& info) {
+  stats.Reset();
+  return info.Env().Undefined();
+}
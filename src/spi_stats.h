@@ -0,0 +1,69 @@
+#ifndef SPI_STATS_H
+#define SPI_STATS_H
+
+#include <napi.h>
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+
+// Latency histogram with log-linear buckets: 8 linear sub-buckets per
+// power of two, so every recorded value is within 12.5% of its bucket.
+// Record() is a few relaxed atomic adds and safe from any thread.
+class SPIHistogram {
+
+public:
+  void Record(uint64_t ns);
+  void Reset();
+
+  // { count, mean, max, p50, p90, p99, p999 } in nanoseconds
+  Napi::Object Snapshot(Napi::Env env) const;
+
+private:
+  static const int SUB_BITS = 3;
+  static const size_t BUCKETS = (64 - SUB_BITS + 1) << SUB_BITS;
+
+  std::atomic<uint64_t> buckets[BUCKETS] = {};
+  std::atomic<uint64_t> count{0};
+  std::atomic<uint64_t> sum{0};
+  std::atomic<uint64_t> max{0};
+
+  static size_t Index(uint64_t ns);
+  static uint64_t UpperBound(size_t index);
+};
+
+// Per device counters, always on. Updated lock-free from the threadpool,
+// the I/O thread and the sampling thread; read by getStats().
+class SPIStats {
+
+public:
+  static const int MAX_ERRNO = 134;  // larger errno values share the last slot
+
+  std::atomic<uint64_t> transfers{0};  // SPI_IOC_MESSAGE sequences, split or not
+  std::atomic<uint64_t> messages{0};   // spi_ioc_transfer entries
+  std::atomic<uint64_t> bytesIn{0};
+  std::atomic<uint64_t> bytesOut{0};
+  std::atomic<uint64_t> errors[MAX_ERRNO + 1] = {};
+  std::atomic<uint64_t> deadlineMisses{0};  // jobs dropped before they started
+  std::atomic<uint64_t> preemptions{0};     // bulk jobs paused for realtime jobs
+  std::atomic<uint64_t> aborted{0};         // jobs aborted before they started
+
+  SPIHistogram queueWait;   // queued on the JS thread -> Execute() with the mutex held
+  SPIHistogram ioctl;       // RunTransfers(), all ioctls of one sequence
+  SPIHistogram completion;  // end of Execute() -> Promise settled on the JS thread
+
+  static uint64_t Now() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+  }
+
+  static void Add(std::atomic<uint64_t>& counter, uint64_t value) {
+    counter.fetch_add(value, std::memory_order_relaxed);
+  }
+
+  void RecordError(int err);
+  void Reset();
+  Napi::Object Snapshot(Napi::Env env) const;
+};
+
+#endif
@@ -0,0 +1,243 @@
+#include "spi_trace.h"
+#include "spi_device.h"
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+
+static_assert(sizeof(SPITrace::FileHeader) == 128, "trace file header layout");
+static_assert(sizeof(SPITrace::RecordHeader) == 32, "trace record header layout");
+static_assert(sizeof(SPITrace::TransferHeader) == 20, "trace transfer header layout");
+
+namespace {
+  const size_t DEFAULT_CAPACITY = 4 << 20;
+  const size_t MIN_CAPACITY = 64 << 10;
+  const size_t MAX_CAPACITY = size_t(1) << 30;
+  const uint32_t DEFAULT_MAX_BYTES = 16;
+  const uint32_t MAX_MAX_BYTES = 65536;
+
+  uint64_t ClockNs(clockid_t clock) {
+    timespec ts;
+    clock_gettime(clock, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+  }
+}
+
+SPITrace::SPITrace(Napi::Env env, const std::string& path, size_t capacity, uint32_t maxBytes)
+  : capacity(capacity & ~size_t(7)), maxBytes(maxBytes) {
+
+  mapSize = sizeof(FileHeader) + this->capacity;
+  fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+  if (fd < 0) {
+    throw Napi::Error::New(env, "Failed to open trace file " + path + ": " + std::strerror(errno));
+  }
+
+  // Allocate the blocks now: a write to a hole of a full file system
+  // through the mapping would be a SIGBUS in the transfer path.
+  int err = posix_fallocate(fd, 0, static_cast<off_t>(mapSize));
+
+  if (err == 0) {
+    void* mem = mmap(nullptr, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (mem == MAP_FAILED) {
+      err = errno;
+    }
+    else {
+      map = static_cast<uint8_t*>(mem);
+    }
+  }
+
+  if (err != 0) {
+    close(fd);
+    throw Napi::Error::New(env, "Failed to map trace file " + path + ": " + std::strerror(err));
+  }
+
+  header = reinterpret_cast<FileHeader*>(map);
+  ring = map + sizeof(FileHeader);
+
+  std::memset(header, 0, sizeof(FileHeader));
+  std::memcpy(header->magic, "SPITRACE", sizeof(header->magic));
+  header->version = VERSION;
+  header->headerSize = sizeof(FileHeader);
+  header->capacity = this->capacity;
+  header->maxBytes = maxBytes;
+  header->monotonicNs = ClockNs(CLOCK_MONOTONIC);
+  header->realtimeNs = ClockNs(CLOCK_REALTIME);
+}
+
+SPITrace::~SPITrace() {
+  // The page cache has the data, the kernel writes it back
+  munmap(map, mapSize);
+  close(fd);
+}
+
+void SPITrace::Record(const std::vector<spi_ioc_transfer>& transfers, uint32_t speedHz,
+    uint64_t startNs, uint64_t durationNs, int error) {
+
+  size_t size = sizeof(RecordHeader) + transfers.size() * sizeof(TransferHeader);
+
+  for (const spi_ioc_transfer& tr : transfers) {
+    size_t n = std::min<size_t>(tr.len, maxBytes);
+    size += (tr.tx_buf ? n : 0) + (tr.rx_buf ? n : 0);
+  }
+
+  size = (size + 7) & ~size_t(7);
+
+  if (size > capacity || transfers.size() > UINT16_MAX) {
+    header->skipped++;
+    return;
+  }
+
+  uint64_t head = header->head;
+  uint64_t pos = head % capacity;
+  uint64_t pad = pos + size > capacity ? capacity - pos : 0;
+
+  // Drop the oldest records until the new one fits. Only the first
+  // 8 bytes of a padding record are in the ring, its size and flags.
+  uint64_t tail = header->tail;
+
+  while (head + pad + size - tail > capacity) {
+    const RecordHeader* old = reinterpret_cast<const RecordHeader*>(ring + tail % capacity);
+
+    if (!(old->flags & RECORD_PADDING)) {
+      header->overwritten++;
+    }
+
+    tail += old->size;
+  }
+
+  header->tail = tail;
+
+  if (pad != 0) {
+    RecordHeader* filler = reinterpret_cast<RecordHeader*>(ring + pos);
+    filler->size = static_cast<uint32_t>(pad);
+    filler->count = 0;
+    filler->flags = RECORD_PADDING;
+    head += pad;
+    pos = 0;
+  }
+
+  uint8_t* out = ring + pos;
+  RecordHeader* record = reinterpret_cast<RecordHeader*>(out);
+  record->size = static_cast<uint32_t>(size);
+  record->count = static_cast<uint16_t>(transfers.size());
+  record->flags = 0;
+  record->error = error;
+  record->speedHz = speedHz;
+  record->startNs = startNs;
+  record->durationNs = durationNs;
+
+  TransferHeader* th = reinterpret_cast<TransferHeader*>(out + sizeof(RecordHeader));
+  uint8_t* data = out + sizeof(RecordHeader) + transfers.size() * sizeof(TransferHeader);
+
+  for (const spi_ioc_transfer& tr : transfers) {
+    uint32_t n = std::min<uint32_t>(tr.len, maxBytes);
+
+    th->len = tr.len;
+    th->speedHz = tr.speed_hz;
+    th->captured = n;
+    th->delayUsecs = tr.delay_usecs;
+    th->bitsPerWord = tr.bits_per_word;
+    th->csChange = tr.cs_change;
+    th->txNbits = tr.tx_nbits;
+    th->rxNbits = tr.rx_nbits;
+    th->wordDelayUsecs = tr.word_delay_usecs;
+    th->flags = (tr.tx_buf ? TRANSFER_TX : 0) | (tr.rx_buf ? TRANSFER_RX : 0);
+    th++;
+
+    if (tr.tx_buf) {
+      std::memcpy(data, reinterpret_cast<const void*>(tr.tx_buf), n);
+      data += n;
+    }
+
+    if (tr.rx_buf) {
+      std::memcpy(data, reinterpret_cast<const void*>(tr.rx_buf), n);
+      data += n;
+    }
+  }
+
+  header->records++;
+
+  // A reader of the live file trusts everything up to head
+  __atomic_store_n(&header->head, head + size, __ATOMIC_RELEASE);
+}
+
+// startTrace(path[, { size, maxBytes }])
+Napi::Value SPIDevice::StartTrace(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1 || !info[0].IsString()) {
+    Napi::TypeError::New(env, "Trace file path expected")
+      .ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  if (trace) {
+    throw Napi::Error::New(env, "Tracing is already running on this device");
+  }
+
+  size_t capacity = DEFAULT_CAPACITY;
+  uint32_t maxBytes = DEFAULT_MAX_BYTES;
+
+  if (info.Length() >= 2 && !info[1].IsUndefined()) {
+    if (!info[1].IsObject()) {
+      throw Napi::TypeError::New(env, "Trace options must be an object");
+    }
+
+    Napi::Object obj = info[1].As<Napi::Object>();
+
+    if (obj.Has("size")) {
+      if (!obj.Get("size").IsNumber()) {
+        throw Napi::TypeError::New(env, "'size' must be a number");
+      }
+
+      int64_t value = obj.Get("size").As<Napi::Number>().Int64Value();
+
+      if (value < static_cast<int64_t>(MIN_CAPACITY) || value > static_cast<int64_t>(MAX_CAPACITY)) {
+        throw Napi::RangeError::New(env, "'size' must be between 64 KiB and 1 GiB");
+      }
+
+      capacity = static_cast<size_t>(value);
+    }
+
+    if (obj.Has("maxBytes")) {
+      if (!obj.Get("maxBytes").IsNumber()) {
+        throw Napi::TypeError::New(env, "'maxBytes' must be a number");
+      }
+
+      int64_t value = obj.Get("maxBytes").As<Napi::Number>().Int64Value();
+
+      if (value < 0 || value > MAX_MAX_BYTES) {
+        throw Napi::RangeError::New(env, "'maxBytes' must be between 0 and " +
+          std::to_string(MAX_MAX_BYTES));
+      }
+
+      maxBytes = static_cast<uint32_t>(value);
+    }
+  }
+
+  std::unique_ptr<SPITrace> started(new SPITrace(env, info[0].As<Napi::String>().Utf8Value(),
+    capacity, maxBytes));
+
+  {
+    SPI_LOCK_GUARD;
+    trace = std::move(started);
+  }
+
+  return env.Undefined();
+}
+
+Napi::Value SPIDevice::StopTrace(const Napi::CallbackInfo& info) {
+  std::unique_ptr<SPITrace> stopped;
+
+  {
+    SPI_LOCK_GUARD;
+    stopped = std::move(trace);
+  }
+
+  return info.Env().Undefined();
+}
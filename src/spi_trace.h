@@ -0,0 +1,94 @@
+#ifndef SPI_TRACE_H
+#define SPI_TRACE_H
+
+#include <napi.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <linux/spi/spidev.h>
+
+// Binary trace of every SPI_IOC_MESSAGE of a device, appended to a ring
+// in a memory-mapped file by RunTransfers(). Recording is a few memcpys
+// into the page cache, the kernel writes the pages back in its own time.
+// Only called with the device mutex held, so there is one writer.
+//
+// File layout, host byte order (see replay.js for a reader):
+//   FileHeader, then `capacity` bytes of ring. Records are 8 byte aligned
+//   and live between the monotonic byte offsets `tail` (oldest) and `head`,
+//   at offset % capacity. A record that does not fit before the end of the
+//   ring is preceded by a padding record up to the end.
+//   Record: RecordHeader, `count` TransferHeaders, then per transfer the
+//   captured tx bytes (if it sends) followed by the captured rx bytes
+//   (if it receives), at most maxBytes each.
+class SPITrace {
+
+public:
+  static const uint32_t VERSION = 1;
+
+  struct FileHeader {
+    char magic[8];           // "SPITRACE"
+    uint32_t version;
+    uint32_t headerSize;     // offset of the ring
+    uint64_t capacity;       // bytes in the ring
+    uint64_t head;           // end of the newest record, updated last
+    uint64_t tail;           // start of the oldest record
+    uint32_t maxBytes;       // captured bytes per direction and transfer
+    uint32_t reserved;
+    uint64_t records;        // recorded since startTrace()
+    uint64_t overwritten;    // records dropped off the tail
+    uint64_t skipped;        // records larger than the ring
+    uint64_t monotonicNs;    // CLOCK_MONOTONIC and CLOCK_REALTIME at
+    uint64_t realtimeNs;     // startTrace(), to date the records
+    uint8_t padding[40];
+  };
+
+  enum RecordFlags : uint16_t {
+    RECORD_PADDING = 1  // filler up to the end of the ring
+  };
+
+  struct RecordHeader {
+    uint32_t size;         // including the padding to 8 bytes
+    uint16_t count;        // transfers
+    uint16_t flags;
+    int32_t error;         // errno of the ioctl, 0 on success
+    uint32_t speedHz;      // device speed, for transfers with speedHz 0
+    uint64_t startNs;      // CLOCK_MONOTONIC
+    uint64_t durationNs;
+  };
+
+  enum TransferFlags : uint8_t {
+    TRANSFER_TX = 1,
+    TRANSFER_RX = 2
+  };
+
+  struct TransferHeader {
+    uint32_t len;
+    uint32_t speedHz;
+    uint32_t captured;     // min(len, maxBytes)
+    uint16_t delayUsecs;
+    uint8_t bitsPerWord;
+    uint8_t csChange;
+    uint8_t txNbits;
+    uint8_t rxNbits;
+    uint8_t wordDelayUsecs;
+    uint8_t flags;
+  };
+
+  // Creates or truncates the file. Throws a Napi::Error on failure.
+  SPITrace(Napi::Env env, const std::string& path, size_t capacity, uint32_t maxBytes);
+  ~SPITrace();
+
+  void Record(const std::vector<spi_ioc_transfer>& transfers, uint32_t speedHz,
+    uint64_t startNs, uint64_t durationNs, int error);
+
+private:
+  int fd = -1;
+  uint8_t* map = nullptr;
+  size_t mapSize = 0;
+  FileHeader* header = nullptr;
+  uint8_t* ring = nullptr;
+  uint64_t capacity = 0;
+  uint32_t maxBytes = 0;
+};
+
+#endif
@@ -1,14 +1,18 @@
 #include "spi_device.h"
+#include "spi_bus.h"
+#include "spi_crc.h"
+#include "spi_io_thread.h"
+#include "spi_pool.h"
+#include "spi_trace.h"
 #include <sys/ioctl.h>
+#include <algorithm>
 #include <cerrno>
+#include <cmath>
 #include <cstring>
 
 namespace {
-    std::string GetSystemError() {
-        return std::strerror(errno);
-    }
-
-    const size_t MAX_SPI_TRANSFER_SIZE = 4096; // Adjust per your hardware
+    // Split points inside a transfer stay on a word boundary for any bits_per_word
+    const size_t CHUNK_ALIGN = 4;
 
     void ValidateBuffer(Napi::Env env, const Napi::Buffer<uint8_t>& buf) {
         // Check buffer exists
@@ -21,10 +25,191 @@ namespace {
             throw Napi::Error::New(env, "Buffer cannot be empty");
         }
 
-        if (buf.Length() > MAX_SPI_TRANSFER_SIZE) {
+        // Transfers over the spidev bufsiz are split in RunTransfers(),
+        // only the 32 bit len field of spi_ioc_transfer is a hard limit.
+        if (buf.Length() > UINT32_MAX) {
             throw Napi::Error::New(env,
-                "Buffer too large (max " + std::to_string(MAX_SPI_TRANSFER_SIZE) + " bytes)");
+                "Buffer too large (max " + std::to_string(UINT32_MAX) + " bytes)");
+        }
+    }
+
+    // Receive memory can be any Buffer or TypedArray (also on a SharedArrayBuffer).
+    void GetRxMemory(Napi::Env env, const Napi::Value& val, uint8_t*& data, size_t& length) {
+        if (!val.IsTypedArray()) {
+            throw Napi::TypeError::New(env, "rx buffer must be a Buffer or TypedArray");
+        }
+
+        Napi::TypedArray array = val.As<Napi::TypedArray>();
+        void* raw = nullptr;
+        napi_status status = napi_get_typedarray_info(env, array,
+            nullptr, nullptr, &raw, nullptr, nullptr);
+
+        if (status != napi_ok) {
+            throw Napi::Error::New(env, "Failed to access rx buffer memory");
+        }
+
+        data = static_cast<uint8_t*>(raw);
+        length = array.ByteLength();
+    }
+
+    uint32_t ParseFormatNumber(Napi::Env env, const Napi::Object& obj, const char* name,
+        const char* what, uint32_t min, uint32_t max) {
+        if (!obj.Get(name).IsNumber()) {
+            throw Napi::TypeError::New(env, std::string(what) + "." + name + " must be a number");
+        }
+
+        int64_t value = obj.Get(name).As<Napi::Number>().Int64Value();
+
+        if (value < min || value > max) {
+            throw Napi::RangeError::New(env, std::string(what) + "." + name + " must be between " +
+                std::to_string(min) + " and " + std::to_string(max));
+        }
+
+        return static_cast<uint32_t>(value);
+    }
+
+    // decode: { into, ... } or encode: { from, ... } of a transfer object:
+    // Int16Array, Int32Array or Float32Array, and the word format
+    // { bits, bytes, shift, endian: 'big' | 'little', signed, scale }.
+    SPIWordOp ParseWordOp(Napi::Env env, const Napi::Value& val, bool encode, Napi::Object& array) {
+        const char* what = encode ? "encode" : "decode";
+        const char* key = encode ? "from" : "into";
+
+        if (!val.IsObject()) {
+            throw Napi::TypeError::New(env, std::string(what) + " must be an object");
+        }
+
+        Napi::Object obj = val.As<Napi::Object>();
+        Napi::Value data = obj.Get(key);
+
+        if (!data.IsTypedArray()) {
+            throw Napi::TypeError::New(env, std::string(what) + "." + key +
+                " must be an Int16Array, Int32Array or Float32Array");
+        }
+
+        Napi::TypedArray typed = data.As<Napi::TypedArray>();
+        SPIWordOp op = {};
+
+        switch (typed.TypedArrayType()) {
+            case napi_int16_array:
+                op.format.type = SPIWordFormat::INT16;
+                break;
+            case napi_int32_array:
+                op.format.type = SPIWordFormat::INT32;
+                break;
+            case napi_float32_array:
+                op.format.type = SPIWordFormat::FLOAT32;
+                break;
+            default:
+                throw Napi::TypeError::New(env, std::string(what) + "." + key +
+                    " must be an Int16Array, Int32Array or Float32Array");
+        }
+
+        void* raw = nullptr;
+
+        if (napi_get_typedarray_info(env, typed, nullptr, &op.count, &raw, nullptr, nullptr) != napi_ok) {
+            throw Napi::Error::New(env, std::string("Failed to access ") + what + "." + key + " memory");
+        }
+
+        op.encode = encode;
+        op.data = raw;
+
+        // Word size follows the sample width, or the element size when neither is given
+        uint32_t bits = obj.Has("bits") ? ParseFormatNumber(env, obj, "bits", what, 1, 32) : 0;
+        uint32_t bytes = obj.Has("bytes") ? ParseFormatNumber(env, obj, "bytes", what, 1, 4)
+            : bits != 0 ? (bits + 7) / 8 : typed.ElementSize();
+
+        op.format.bytes = static_cast<uint8_t>(bytes);
+        op.format.bits = static_cast<uint8_t>(bits != 0 ? bits : bytes * 8);
+
+        if (obj.Has("shift")) {
+            op.format.shift = static_cast<uint8_t>(ParseFormatNumber(env, obj, "shift", what, 0, 31));
+        }
+
+        if (op.format.bits + op.format.shift > op.format.bytes * 8) {
+            throw Napi::RangeError::New(env, std::string(what) +
+                ": bits + shift exceed the " + std::to_string(bytes) + " byte word");
+        }
+
+        if (obj.Has("endian")) {
+            Napi::Value endian = obj.Get("endian");
+            std::string name = endian.IsString() ? endian.As<Napi::String>().Utf8Value() : "";
+
+            if (name != "big" && name != "little") {
+                throw Napi::TypeError::New(env, std::string(what) + ".endian must be 'big' or 'little'");
+            }
+
+            op.format.bigEndian = name == "big";
+        }
+
+        if (obj.Has("signed")) {
+            op.format.isSigned = obj.Get("signed").ToBoolean().Value();
+        }
+
+        if (obj.Has("scale")) {
+            if (op.format.type != SPIWordFormat::FLOAT32) {
+                throw Napi::TypeError::New(env, std::string(what) + ".scale requires a Float32Array");
+            }
+
+            if (!obj.Get("scale").IsNumber()) {
+                throw Napi::TypeError::New(env, std::string(what) + ".scale must be a number");
+            }
+
+            double scale = obj.Get("scale").As<Napi::Number>().DoubleValue();
+
+            if (!std::isfinite(scale) || scale == 0) {
+                throw Napi::RangeError::New(env, std::string(what) + ".scale must be finite and not 0");
+            }
+
+            op.format.scale = static_cast<float>(scale);
         }
+
+        array = typed;
+        return op;
+    }
+
+    // crc: { type, tx, rx, skip, chunk } of a message, see SPICrcOp
+    SPICrcOp ParseCrcOp(Napi::Env env, const Napi::Value& val) {
+        if (!val.IsObject()) {
+            throw Napi::TypeError::New(env, "crc must be an object { type, tx, rx, skip, chunk }");
+        }
+
+        Napi::Object obj = val.As<Napi::Object>();
+        Napi::Value type = obj.Get("type");
+        SPICrcOp op = {};
+
+        op.algorithm = type.IsString() ? SPICrc::Find(type.As<Napi::String>().Utf8Value()) : nullptr;
+
+        if (op.algorithm == nullptr) {
+            throw Napi::TypeError::New(env, "crc.type must be one of " + SPICrc::Names());
+        }
+
+        op.tx = obj.Get("tx").ToBoolean().Value();
+        op.rx = obj.Get("rx").ToBoolean().Value();
+
+        if (!op.tx && !op.rx) {
+            throw Napi::Error::New(env, "crc needs tx, rx or both set to true");
+        }
+
+        const char* counts[] = { "skip", "chunk" };
+
+        for (const char* name : counts) {
+            Napi::Value count = obj.Get(name);
+
+            if (count.IsUndefined()) {
+                continue;
+            }
+
+            double value = count.IsNumber() ? count.As<Napi::Number>().DoubleValue() : -1;
+
+            if (!(value >= 0 && value <= UINT32_MAX) || std::floor(value) != value) {
+                throw Napi::RangeError::New(env, std::string("crc.") + name + " must be a byte count");
+            }
+
+            (name == counts[0] ? op.skip : op.chunk) = static_cast<size_t>(value);
+        }
+
+        return op;
     }
 
     void ValidateBitLength(Napi::Env env, uint32_t bits, const std::string& paramName) {
@@ -48,25 +233,17 @@ namespace {
     }
 }
 
-Napi::Value SPIDevice::Transfer(const Napi::CallbackInfo& info) {
-  Napi::Env env = info.Env();
-  auto deferred = Napi::Promise::Deferred::New(env);
+void SPIDevice::ParseTransfers(Napi::Env env, const Napi::Array& msgArray,
+    const Napi::Array* rxArray, TransferBatch& batch) {
 
-  if (info.Length() < 1 || !info[0].IsArray()) {
-    Napi::TypeError::New(env, "Array of transfer messages expected")
-      .ThrowAsJavaScriptException();
-    return env.Null();
+  if (rxArray != nullptr && rxArray->Length() != msgArray.Length()) {
+    throw Napi::Error::New(env,
+      "Expected one rx buffer per transfer message");
   }
 
-  Napi::Array msgArray = info[0].As<Napi::Array>();
-
-  std::vector<spi_ioc_transfer> transfers;
-  std::vector<Napi::Reference<Napi::Buffer<uint8_t>>> txRefs;
-  std::vector<Napi::Reference<Napi::Buffer<uint8_t>>> rxRefs;
-
-  transfers.reserve(msgArray.Length());
-  txRefs.reserve(msgArray.Length());
-  rxRefs.reserve(msgArray.Length());
+  batch.transfers.reserve(msgArray.Length());
+  batch.txRefs.reserve(msgArray.Length());
+  batch.rxRefs.reserve(msgArray.Length());
 
   for (uint32_t i = 0; i < msgArray.Length(); i++) {
 
@@ -74,144 +251,982 @@ Napi::Value SPIDevice::Transfer(const Napi::CallbackInfo& info) {
     spi_ioc_transfer tr = {};
 
     Napi::Buffer<uint8_t> txBuf;
-    Napi::Buffer<uint8_t> rxBuf;
+    bool hasTx = false;
+    Napi::Value rxVal = env.Undefined();  // undefined: allocate, null: tx only
+    size_t len = 0;
+    std::vector<SPIWordOp> ops;
+    std::vector<Napi::Object> opArrays;
+    SPICrcOp crc = {};
 
-    try {
-      if (val.IsBuffer()) {
-        // Simple buffer case
-        txBuf = val.As<Napi::Buffer<uint8_t>>();
-        ValidateBuffer(env, txBuf);
-        rxBuf = Napi::Buffer<uint8_t>::New(env, txBuf.Length());
-      }
-      else if (val.IsObject()) {
-        // Configured transfer case
-        Napi::Object obj = val.As<Napi::Object>();
-        if (!obj.Has("tx_buf") || !obj.Get("tx_buf").IsBuffer()) {
-          throw Napi::Error::New(env, "Transfer object requires tx_buf Buffer");
+    if (rxArray != nullptr) {
+      rxVal = (*rxArray)[i];
+    }
+
+    if (val.IsBuffer()) {
+      // Simple buffer case
+      txBuf = val.As<Napi::Buffer<uint8_t>>();
+      hasTx = true;
+    }
+    else if (val.IsObject()) {
+      // Configured transfer case
+      Napi::Object obj = val.As<Napi::Object>();
+
+      // tx_buf null or left out: rx only, spidev clocks out zeros
+      if (obj.Has("tx_buf") && !obj.Get("tx_buf").IsNull() && !obj.Get("tx_buf").IsUndefined()) {
+        if (!obj.Get("tx_buf").IsBuffer()) {
+          throw Napi::Error::New(env, "tx_buf must be a Buffer or null");
         }
 
         txBuf = obj.Get("tx_buf").As<Napi::Buffer<uint8_t>>();
-        ValidateBuffer(env, txBuf);
-        rxBuf = Napi::Buffer<uint8_t>::New(env, txBuf.Length());
+        hasTx = true;
+      }
 
-        // Apply optional parameters
-        if (obj.Has("speed_hz")){
-          tr.speed_hz = obj.Get("speed_hz").As<Napi::Number>().Uint32Value();
+      // Words packed from a typed array into tx_buf just before the ioctl
+      if (obj.Has("encode")) {
+        Napi::Object from;
+        SPIWordOp op = ParseWordOp(env, obj.Get("encode"), true, from);
+
+        if (!hasTx) {
+          txBuf = Napi::Buffer<uint8_t>::New(env, op.count * op.format.bytes);
+          hasTx = true;
         }
 
-        if (obj.Has("bits_per_word")) {
-          uint32_t bits_per_word = obj.Get("bits_per_word").As<Napi::Number>().Uint32Value();
-          ValidateBitLength(env, bits_per_word, "bits_per_word");
-          tr.bits_per_word = static_cast<uint8_t>(bits_per_word);
+        ops.push_back(op);
+        opArrays.push_back(from);
+      }
+
+      if (obj.Has("crc") && !obj.Get("crc").IsUndefined()) {
+        crc = ParseCrcOp(env, obj.Get("crc"));
+      }
+
+      // The tx data moves into a buffer with room for the CRCs: after
+      // every `chunk` bytes, or after all of them
+      if (crc.tx) {
+        if (!hasTx) {
+          throw Napi::Error::New(env, "crc.tx requires tx data");
         }
 
-        if (obj.Has("delay_usecs")) {
-          uint32_t delay_usecs = obj.Get("delay_usecs").As<Napi::Number>().Uint32Value();
+        size_t n = SPICrc::Bytes(*crc.algorithm);
+        size_t dataLen = txBuf.Length();
+        size_t chunk = crc.chunk ? crc.chunk : dataLen;
 
-          // Absolute maximum defined by Linux SPI headers
-          const uint32_t MAX_DELAY_US = 65535;
+        if (crc.chunk && !ops.empty()) {
+          throw Napi::Error::New(env, "crc.chunk cannot be combined with encode");
+        }
 
-          if (delay_usecs > MAX_DELAY_US) {
-            throw Napi::Error::New(env,
-              "delay_usecs cannot exceed " +
-              std::to_string(MAX_DELAY_US) + " µs");
-          }
+        if (dataLen == 0 || dataLen % chunk != 0) {
+          throw Napi::RangeError::New(env, "tx data length must be a non-zero multiple of crc.chunk");
+        }
+
+        Napi::Buffer<uint8_t> framed = Napi::Buffer<uint8_t>::New(env, dataLen / chunk * (chunk + n));
 
-          tr.delay_usecs = static_cast<uint16_t>(delay_usecs);
+        for (size_t at = 0; at < dataLen; at += chunk) {
+          std::memcpy(framed.Data() + at / chunk * (chunk + n), txBuf.Data() + at, chunk);
         }
 
-        if (obj.Has("cs_change")) {
-          uint32_t cs_change = obj.Get("cs_change").As<Napi::Number>().Uint32Value();
+        txBuf = framed;
+      }
 
-          if (cs_change != 0 && cs_change != 1) {
-            throw Napi::Error::New(env,
-              "cs_change must be 0 (keep CS active) or 1 (release CS)");
-          }
+      if (obj.Has("rx_buf") && !obj.Get("rx_buf").IsUndefined()) {
+        if (rxArray != nullptr) {
+          throw Napi::Error::New(env,
+            "rx buffer given both as rx_buf and in the rx buffer array");
+        }
+        rxVal = obj.Get("rx_buf");
+      }
 
-          tr.cs_change = static_cast<uint8_t>(cs_change);
+      if (obj.Has("rx_len")) {
+        if (!obj.Get("rx_len").IsNumber()) {
+          throw Napi::TypeError::New(env, "rx_len must be a number");
         }
 
-        if (obj.Has("word_delay_usecs")) {
-          uint32_t word_delay_usecs = obj.Get("word_delay_usecs").As<Napi::Number>().Uint32Value();
+        double value = obj.Get("rx_len").As<Napi::Number>().DoubleValue();
+
+        // The len field of spi_ioc_transfer is 32 bit
+        if (!(value >= 1 && value <= UINT32_MAX) || std::floor(value) != value) {
+          throw Napi::RangeError::New(env,
+            "rx_len must be an integer between 1 and " + std::to_string(UINT32_MAX));
+        }
 
-          // Kernel-defined maximum (from spidev.h)
-          const uint32_t MAX_WORD_DELAY_US = 255;
+        len = static_cast<size_t>(value);
 
-          if (word_delay_usecs > MAX_WORD_DELAY_US) {
-            throw Napi::Error::New(env,
-              "word_delay_usecs cannot exceed " +
-              std::to_string(MAX_WORD_DELAY_US) + " µs");
-          }
+        if (hasTx && len != txBuf.Length()) {
+          throw Napi::Error::New(env, "rx_len must match the tx_buf length");
+        }
+      }
+
+      if (!hasTx && rxVal.IsNull()) {
+        throw Napi::Error::New(env, "Transfer object requires tx_buf, rx_buf or rx_len");
+      }
+
+      // rx words unpacked into a typed array when the ioctl completes
+      if (obj.Has("decode")) {
+        Napi::Object into;
+        SPIWordOp op = ParseWordOp(env, obj.Get("decode"), false, into);
+
+        if (rxVal.IsNull()) {
+          throw Napi::Error::New(env, "decode requires rx data, rx_buf is null");
+        }
+
+        if (!hasTx && len == 0 && rxVal.IsUndefined()) {
+          len = op.count * op.format.bytes;  // rx only, sized by the typed array
+        }
 
-          tr.word_delay_usecs = static_cast<uint16_t>(word_delay_usecs);
+        ops.push_back(op);
+        opArrays.push_back(into);
+      }
+
+      if (obj.Has("speed_hz")){
+        tr.speed_hz = obj.Get("speed_hz").As<Napi::Number>().Uint32Value();
+      }
+
+      if (obj.Has("bits_per_word")) {
+        uint32_t bits_per_word = obj.Get("bits_per_word").As<Napi::Number>().Uint32Value();
+        ValidateBitLength(env, bits_per_word, "bits_per_word");
+        tr.bits_per_word = static_cast<uint8_t>(bits_per_word);
+      }
+
+      if (obj.Has("delay_usecs")) {
+        uint32_t delay_usecs = obj.Get("delay_usecs").As<Napi::Number>().Uint32Value();
+
+        // Absolute maximum defined by Linux SPI headers
+        const uint32_t MAX_DELAY_US = 65535;
+
+        if (delay_usecs > MAX_DELAY_US) {
+          throw Napi::Error::New(env,
+            "delay_usecs cannot exceed " +
+            std::to_string(MAX_DELAY_US) + " µs");
+        }
+
+        tr.delay_usecs = static_cast<uint16_t>(delay_usecs);
+      }
+
+      if (obj.Has("cs_change")) {
+        uint32_t cs_change = obj.Get("cs_change").As<Napi::Number>().Uint32Value();
+
+        if (cs_change != 0 && cs_change != 1) {
+          throw Napi::Error::New(env,
+            "cs_change must be 0 (keep CS active) or 1 (release CS)");
+        }
+
+        tr.cs_change = static_cast<uint8_t>(cs_change);
+      }
+
+      if (obj.Has("word_delay_usecs")) {
+        uint32_t word_delay_usecs = obj.Get("word_delay_usecs").As<Napi::Number>().Uint32Value();
+
+        // Kernel-defined maximum (from spidev.h)
+        const uint32_t MAX_WORD_DELAY_US = 255;
+
+        if (word_delay_usecs > MAX_WORD_DELAY_US) {
+          throw Napi::Error::New(env,
+            "word_delay_usecs cannot exceed " +
+            std::to_string(MAX_WORD_DELAY_US) + " µs");
         }
 
-        if (obj.Has("tx_nbits")) {
-          uint32_t tx_nbits = obj.Get("tx_nbits").As<Napi::Number>().Uint32Value();
-          ValidateBitLength(env, tx_nbits, "tx_nbits");
-          tr.tx_nbits = static_cast<uint8_t>(tx_nbits);
+        tr.word_delay_usecs = static_cast<uint16_t>(word_delay_usecs);
+      }
+
+      if (obj.Has("tx_nbits")) {
+        uint32_t tx_nbits = obj.Get("tx_nbits").As<Napi::Number>().Uint32Value();
+        ValidateBitLength(env, tx_nbits, "tx_nbits");
+        tr.tx_nbits = static_cast<uint8_t>(tx_nbits);
+      }
+
+      if (obj.Has("rx_nbits")) {
+        uint32_t rx_nbits = obj.Get("rx_nbits").As<Napi::Number>().Uint32Value();
+        ValidateBitLength(env, rx_nbits, "rx_nbits");
+        tr.rx_nbits = static_cast<uint8_t>(rx_nbits);
+      }
+    }
+    else {
+      throw Napi::Error::New(env, "Each transfer must be a Buffer or Object");
+    }
+
+    // Pool memory is known good and stays put, it is pinned below
+    SPIPoolBlock* txBlock = hasTx && batch.pool ? batch.pool->Find(txBuf.Data(), txBuf.Length()) : nullptr;
+    SPIPoolBlock* rxBlock = nullptr;
+
+    if (hasTx) {
+      if (txBlock == nullptr) {
+        ValidateBuffer(env, txBuf);
+      }
+
+      len = txBuf.Length();
+    }
+
+    Napi::Object rxObj;
+    uint8_t* rxData = nullptr;
+
+    if (rxVal.IsUndefined()) {
+      if (len == 0) {
+        throw Napi::Error::New(env, "Transfer object requires tx_buf, rx_buf or rx_len");
+      }
+
+      Napi::Buffer<uint8_t> rxBuf = Napi::Buffer<uint8_t>::New(env, len);
+      rxObj = rxBuf;
+      rxData = rxBuf.Data();
+    }
+    else if (!rxVal.IsNull()) {
+      size_t rxLength = 0;
+      GetRxMemory(env, rxVal, rxData, rxLength);
+
+      if (len == 0) {
+        len = rxLength;  // rx only into the whole rx_buf
+      }
+
+      if (rxLength == 0 || rxLength > UINT32_MAX) {
+        throw Napi::RangeError::New(env, "Invalid rx buffer length");
+      }
+
+      if (rxLength < len) {
+        throw Napi::RangeError::New(env,
+          "rx buffer too small (" + std::to_string(rxLength) +
+          " bytes) for a " + std::to_string(len) + " byte transfer");
+      }
+
+      rxObj = rxVal.As<Napi::Object>();
+
+      // Returned through the caller's array, no reference needed
+      if (rxArray != nullptr && batch.pool) {
+        rxBlock = batch.pool->Find(rxData, rxLength);
+      }
+    }
+
+    if (crc.rx) {
+      size_t n = SPICrc::Bytes(*crc.algorithm);
+      size_t frames = len > crc.skip ? len - crc.skip : 0;
+
+      if (rxData == nullptr) {
+        throw Napi::Error::New(env, "crc.rx requires rx data, rx_buf is null");
+      }
+
+      if (crc.chunk ? frames == 0 || frames % (crc.chunk + n) != 0 : frames <= n) {
+        throw Napi::RangeError::New(env, "rx data after crc.skip must hold " +
+          std::string(crc.chunk ? "whole frames of crc.chunk bytes and a CRC" : "data and a CRC"));
+      }
+    }
+
+    // Set up transfer struct, a zero buffer address is half duplex
+    tr.tx_buf = hasTx ? (unsigned long)txBuf.Data() : 0;
+    tr.rx_buf = (unsigned long)rxData;
+    tr.len = static_cast<uint32_t>(len);
+
+    for (size_t j = 0; j < ops.size(); j++) {
+      size_t bytes = ops[j].count * ops[j].format.bytes;
+
+      if (bytes > len) {
+        throw Napi::RangeError::New(env, std::string(ops[j].encode ? "encode" : "decode") +
+          " needs " + std::to_string(bytes) + " bytes, the transfer has " + std::to_string(len));
+      }
+
+      ops[j].index = batch.transfers.size();
+      batch.words.push_back(ops[j]);
+      batch.wordRefs.push_back(Napi::Persistent(opArrays[j]));
+    }
+
+    if (crc.algorithm != nullptr) {
+      crc.index = batch.transfers.size();
+      batch.crcs.push_back(crc);
+    }
+
+    if (txBlock != nullptr) {
+      batch.Pin(txBlock);
+    }
+
+    if (rxBlock != nullptr) {
+      batch.Pin(rxBlock);
+    }
+
+    batch.transfers.push_back(tr);
+    batch.txRefs.push_back(hasTx && txBlock == nullptr
+      ? Napi::Persistent(static_cast<Napi::Object>(txBuf))
+      : Napi::ObjectReference());
+    batch.rxRefs.push_back(rxData != nullptr && rxBlock == nullptr
+      ? Napi::Persistent(rxObj)
+      : Napi::ObjectReference());
+  }
+
+  // Sealed again before every ioctl, after encode and patches. Sealing
+  // here leaves the tx buffers complete from the start.
+  SealCrcs(batch);
+}
+
+// One rx Buffer per message, null for tx only messages
+Napi::Value SPIDevice::BatchResult(Napi::Env env, TransferBatch& batch) {
+  if (!batch.result.IsEmpty()) {
+    return batch.result.Value();
+  }
+
+  Napi::Array result = Napi::Array::New(env, batch.rxRefs.size());
+
+  for (size_t i = 0; i < batch.rxRefs.size(); i++) {
+    if (batch.rxRefs[i].IsEmpty()) {
+      result.Set(i, env.Null());
+    }
+    else {
+      result.Set(i, batch.rxRefs[i].Value());
+    }
+  }
+
+  return result;
+}
+
+Napi::Value SPIDevice::Transfer(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1 || !info[0].IsArray()) {
+    Napi::TypeError::New(env, "Array of transfer messages expected")
+      .ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  TransferBatch batch;
+  JobOptions options;
+  batch.pool = pool;
+
+  try {
+    ParseTransfers(env, info[0].As<Napi::Array>(), nullptr, batch);
+    options = ParseJobOptions(env, info[1]);
+  }
+  catch (const Napi::Error& e) {
+    e.ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  return QueueJob(env, new TransferJob(env, std::move(batch)), options);
+}
+
+Napi::Value SPIDevice::TransferInto(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 2 || !info[0].IsArray() || !info[1].IsArray()) {
+    Napi::TypeError::New(env,
+      "Array of transfer messages and array of rx buffers expected")
+      .ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  Napi::Array rxArray = info[1].As<Napi::Array>();
+  TransferBatch batch;
+  JobOptions options;
+  batch.pool = pool;
+
+  try {
+    ParseTransfers(env, info[0].As<Napi::Array>(), &rxArray, batch);
+    options = ParseJobOptions(env, info[2]);
+  }
+  catch (const Napi::Error& e) {
+    e.ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  // Resolve with the caller's own array: no result allocation per call
+  batch.result = Napi::Persistent(static_cast<Napi::Object>(rxArray));
+
+  return QueueJob(env, new TransferJob(env, std::move(batch)), options);
+}
+
+// Synchronous fast path: the ioctl runs on the calling thread.
+// Meant for tiny register transfers where the threadpool round trip
+// costs more than the transfer itself.
+Napi::Value SPIDevice::TransferSync(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1 || !info[0].IsArray()) {
+    Napi::TypeError::New(env, "Array of transfer messages expected")
+      .ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  TransferBatch batch;
+  batch.pool = pool;
+
+  try {
+    ParseTransfers(env, info[0].As<Napi::Array>(), nullptr, batch);
+  }
+  catch (const Napi::Error& e) {
+    e.ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  if (batch.transfers.empty()) {
+    Napi::Error::New(env, "No transfers specified").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  int err;
+  int bad = -1;
+  {
+    SPI_LOCK_GUARD;
+    EncodeWords(batch);
+    SealCrcs(batch);
+    err = RunTransfers(batch.transfers);
+
+    if (err == 0 && (bad = CheckCrcs(batch)) < 0) {
+      DecodeWords(batch);
+    }
+  }
+
+  if (err != 0) {
+    Napi::Error::New(env, std::string("SPI transfer failed: ") + std::strerror(err))
+      .ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  if (bad >= 0) {
+    CrcError(env, batch, bad).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  return BatchResult(env, batch);
+}
+
+// Packs the encode typed arrays into their tx buffers.
+// The caller holds the device mutex.
+void SPIDevice::EncodeWords(TransferBatch& batch) {
+  for (const SPIWordOp& op : batch.words) {
+    if (op.encode) {
+      uint8_t* tx = reinterpret_cast<uint8_t*>(batch.transfers[op.index].tx_buf);
+      SPICodec::Encode(op.data, tx, op.count, op.format);
+    }
+  }
+}
+
+// Unpacks the received words into the decode typed arrays
+void SPIDevice::DecodeWords(TransferBatch& batch) {
+  for (const SPIWordOp& op : batch.words) {
+    if (!op.encode) {
+      const uint8_t* rx = reinterpret_cast<const uint8_t*>(batch.transfers[op.index].rx_buf);
+      SPICodec::Decode(rx, op.data, op.count, op.format);
+    }
+  }
+}
+
+// Fills in the tx CRCs after the tx data is final
+void SPIDevice::SealCrcs(TransferBatch& batch) {
+  for (const SPICrcOp& op : batch.crcs) {
+    if (op.tx) {
+      const spi_ioc_transfer& tr = batch.transfers[op.index];
+      SPICrc::Seal(*op.algorithm, reinterpret_cast<uint8_t*>(tr.tx_buf), tr.len, op.chunk);
+    }
+  }
+}
+
+// Verifies the rx CRCs, returns the first failing message or -1
+int SPIDevice::CheckCrcs(const TransferBatch& batch) {
+  for (const SPICrcOp& op : batch.crcs) {
+    const spi_ioc_transfer& tr = batch.transfers[op.index];
+
+    if (op.rx && !SPICrc::Verify(*op.algorithm,
+        reinterpret_cast<const uint8_t*>(tr.rx_buf) + op.skip, tr.len - op.skip, op.chunk)) {
+      return static_cast<int>(op.index);
+    }
+  }
+
+  return -1;
+}
+
+Napi::Error SPIDevice::CrcError(Napi::Env env, const TransferBatch& batch, int index) {
+  Napi::Error err = Napi::Error::New(env, CrcMismatch(batch, index));
+  err.Value().Set("code", Napi::String::New(env, CRC_MISMATCH));
+  return err;
+}
+
+std::string SPIDevice::CrcMismatch(const TransferBatch& batch, int index) {
+  for (const SPICrcOp& op : batch.crcs) {
+    if (op.index == static_cast<size_t>(index)) {
+      return std::string("CRC mismatch (") + op.algorithm->name + ") in the rx data of message " +
+        std::to_string(index);
+    }
+  }
+
+  return "CRC mismatch in the rx data of message " + std::to_string(index);
+}
+
+// Issues the messages, returns 0 or an errno value.
+// The caller holds the device mutex.
+int SPIDevice::RunTransfers(std::vector<spi_ioc_transfer>& transfers) {
+  SPIBufsizUse use;
+  size_t bytesIn = 0;
+  size_t bytesOut = 0;
+
+  for (const spi_ioc_transfer& tr : transfers) {
+    use.Add(tr);
+    bytesIn += tr.rx_buf ? tr.len : 0;
+    bytesOut += tr.tx_buf ? tr.len : 0;
+  }
+
+  uint64_t start = SPIStats::Now();
+  int err = 0;
+
+  if (!use.Fits(bufsiz) || transfers.size() > MAX_MESSAGES) {
+    err = RunChunked(transfers);
+  }
+  else if (backend->Ioctl(SPI_IOC_MESSAGE(transfers.size()), transfers.data()) < 1) {
+    err = errno;
+  }
+
+  uint64_t elapsed = SPIStats::Now() - start;
+  stats.ioctl.Record(elapsed);
+  SPIStats::Add(stats.transfers, 1);
+
+  if (trace) {
+    trace->Record(transfers, shadowSpeed.load(std::memory_order_relaxed), start, elapsed, err);
+  }
+  SPIStats::Add(stats.messages, transfers.size());
+
+  if (err != 0) {
+    stats.RecordError(err);
+    return err;
+  }
+
+  SPIStats::Add(stats.bytesIn, bytesIn);
+  SPIStats::Add(stats.bytesOut, bytesOut);
+
+  return 0;
+}
+
+// Splits messages that exceed the spidev bufsiz or the message count
+// into as few SPI_IOC_MESSAGE calls as possible. CS stays asserted
+// across the split points unless the caller asked to release it there:
+// cs_change on the last transfer of an ioctl keeps CS asserted.
+int SPIDevice::RunChunked(const std::vector<spi_ioc_transfer>& transfers) {
+  SPIBufsizUse use;
+  chunks.clear();
+
+  for (const spi_ioc_transfer& tr : transfers) {
+    size_t offset = 0;
+
+    do {
+      // Room in the bounce buffers this transfer uses
+      size_t used = std::max(tr.tx_buf ? use.tx : 0, tr.rx_buf ? use.rx : 0);
+      size_t room = bufsiz > used ? bufsiz - used : 0;
+      size_t len = tr.len - offset;
+
+      if (SPIBufsizUse::Align(len) > room) {
+        // An aligned chunk, which also keeps the split on a word boundary
+        len = room - room % std::max(SPI_DMA_MINALIGN, CHUNK_ALIGN);
+
+        if (len == 0 && chunks.empty()) {
+          // bufsiz below one alignment unit: let spidev refuse it
+          len = std::min(tr.len - offset, std::max(bufsiz - bufsiz % CHUNK_ALIGN, CHUNK_ALIGN));
         }
+      }
 
-        if (obj.Has("rx_nbits")) {
-          uint32_t rx_nbits = obj.Get("rx_nbits").As<Napi::Number>().Uint32Value();
-          ValidateBitLength(env, rx_nbits, "rx_nbits");
-          tr.rx_nbits = static_cast<uint8_t>(rx_nbits);
+      if ((len == 0 && offset < tr.len) || chunks.size() == MAX_MESSAGES) {
+        // Flush: keep CS asserted into the next ioctl, unless the
+        // last chunk ends a transfer that releases CS anyway.
+        spi_ioc_transfer& last = chunks.back();
+        last.cs_change = last.cs_change ? 0 : 1;
+
+        if (backend->Ioctl(SPI_IOC_MESSAGE(chunks.size()), chunks.data()) < 1) {
+          return errno;
         }
+
+        chunks.clear();
+        use = SPIBufsizUse();
+        continue;
+      }
+
+      spi_ioc_transfer chunk = tr;
+      chunk.tx_buf = tr.tx_buf ? tr.tx_buf + offset : 0;
+      chunk.rx_buf = tr.rx_buf ? tr.rx_buf + offset : 0;
+      chunk.len = static_cast<uint32_t>(len);
+
+      offset += len;
+
+      if (offset < tr.len) {
+        // Inside a transfer: no CS toggle or delay
+        chunk.cs_change = 0;
+        chunk.delay_usecs = 0;
       }
-      else {
-        throw Napi::Error::New(env, "Each transfer must be a Buffer or Object");
+
+      chunks.push_back(chunk);
+      use.Add(chunk);
+    } while (offset < tr.len);
+  }
+
+  if (!chunks.empty() &&
+      backend->Ioctl(SPI_IOC_MESSAGE(chunks.size()), chunks.data()) < 1) {
+    return errno;
+  }
+
+  return 0;
+}
+
+// Lane and deadline of a queued job: { priority: 'realtime' | 'bulk', deadline: ms }
+SPIDevice::JobOptions SPIDevice::ParseJobOptions(Napi::Env env, const Napi::Value& val) {
+  JobOptions options;
+
+  if (val.IsUndefined()) {
+    return options;
+  }
+
+  if (!val.IsObject()) {
+    throw Napi::TypeError::New(env, "Transfer options must be an object");
+  }
+
+  Napi::Object obj = val.As<Napi::Object>();
+
+  if (obj.Has("priority")) {
+    Napi::Value priority = obj.Get("priority");
+    std::string name = priority.IsString() ? priority.As<Napi::String>().Utf8Value() : "";
+
+    if (name != "realtime" && name != "bulk") {
+      throw Napi::TypeError::New(env, "'priority' must be 'realtime' or 'bulk'");
+    }
+
+    options.lane = name == "realtime" ? LANE_REALTIME : LANE_BULK;
+  }
+
+  if (obj.Has("deadline")) {
+    if (!obj.Get("deadline").IsNumber()) {
+      throw Napi::TypeError::New(env, "'deadline' must be a number of milliseconds");
+    }
+
+    double ms = obj.Get("deadline").As<Napi::Number>().DoubleValue();
+
+    if (!(ms > 0)) {
+      throw Napi::RangeError::New(env, "'deadline' must be greater than 0");
+    }
+
+    options.deadlineNs = SPIStats::Now() + static_cast<uint64_t>(ms * 1e6);
+  }
+
+  if (obj.Has("signal") && !obj.Get("signal").IsUndefined()) {
+    Napi::Value signal = obj.Get("signal");
+
+    if (!signal.IsObject() || !signal.As<Napi::Object>().Get("addEventListener").IsFunction()) {
+      throw Napi::TypeError::New(env, "'signal' must be an AbortSignal");
+    }
+
+    options.signals.push_back(signal.As<Napi::Object>());
+  }
+
+  if (obj.Has("timeoutMs")) {
+    if (!obj.Get("timeoutMs").IsNumber()) {
+      throw Napi::TypeError::New(env, "'timeoutMs' must be a number");
+    }
+
+    double ms = obj.Get("timeoutMs").As<Napi::Number>().DoubleValue();
+
+    if (!(ms >= 0)) {
+      throw Napi::RangeError::New(env, "'timeoutMs' must not be negative");
+    }
+
+    // Same rejection as fetch() and friends: a TimeoutError DOMException
+    Napi::Object abortSignal = env.Global().Get("AbortSignal").As<Napi::Object>();
+    Napi::Function timeout = abortSignal.Get("timeout").As<Napi::Function>();
+    options.signals.push_back(timeout.Call(abortSignal, { Napi::Number::New(env, ms) }).As<Napi::Object>());
+  }
+
+  return options;
+}
+
+Napi::Value SPIDevice::QueueJob(Napi::Env env, Job* job, const JobOptions& options) {
+  Napi::Promise promise = job->Promise();
+
+  // Keep the device alive while the job is pending
+  Ref();
+  pendingJobs++;
+  job->device = this;
+  job->lane = options.lane;
+  job->deadlineNs = options.deadlineNs;
+  job->queuedNs = SPIStats::Now();
+
+  if (!options.signals.empty()) {
+    job->Watch(env, options.signals);
+
+    if (job->Aborted()) {
+      // Signal was aborted before the call: never queued
+      CompleteJob(env, job);
+      return promise;
+    }
+  }
+
+  if (job->lane == LANE_REALTIME) {
+    realtimeUsed = true;
+    realtimeQueued.fetch_add(1, std::memory_order_release);
+  }
+
+  if (bus) {
+    bus->Submit(env, this, job);
+  }
+  else if (ioThread) {
+    if (!ioThread->Submit(env, job)) {
+      if (job->lane == LANE_REALTIME) {
+        realtimeQueued.fetch_sub(1, std::memory_order_release);
       }
 
-      // Set up transfer struct
-      tr.tx_buf = (unsigned long)txBuf.Data();
-      tr.rx_buf = (unsigned long)rxBuf.Data();
-      tr.len = txBuf.Length();
+      job->error = "SPI I/O queue is full";
+      CompleteJob(env, job);
+    }
+  }
+  else {
+    {
+      std::lock_guard<std::mutex> lock(queueMutex);
+      queued[job->lane].push_back(job);
+    }
+
+    auto* worker = new TransferWorker(env, this);
+    worker->Queue();
+  }
+
+  return promise;
+}
+
+// Threadpool queue. Caller holds the mutex. Bulk jobs wait while
+// another bulk job is preempted, so they still run in call order, and
+// no job starts while the running one sleeps (see SleepUnlocked()).
+SPIDevice::Job* SPIDevice::PopQueued() {
+  std::lock_guard<std::mutex> lock(queueMutex);
+  Job* job = nullptr;
+
+  if (jobSleeping) {
+    return nullptr;
+  }
+
+  if (!queued[LANE_REALTIME].empty()) {
+    job = queued[LANE_REALTIME].front();
+    queued[LANE_REALTIME].pop_front();
+    realtimeQueued.fetch_sub(1, std::memory_order_release);
+  }
+  else if (!bulkSuspended && !queued[LANE_BULK].empty()) {
+    job = queued[LANE_BULK].front();
+    queued[LANE_BULK].pop_front();
+  }
+
+  return job;
+}
+
+// Fails a job that can no longer start in time, without touching the bus
+bool SPIDevice::DropExpired(Job* job, uint64_t now) {
+  if (job->deadlineNs == 0 || now <= job->deadlineNs) {
+    return false;
+  }
+
+  job->error = "SPI transfer missed its deadline";
+  job->code = "ERR_SPI_DEADLINE";
+  SPIStats::Add(stats.deadlineMisses, 1);
+  return true;
+}
+
+// Runs a job with the device mutex held, off the JS thread
+void SPIDevice::ExecuteJob(Job* job) {
+  if (!job->Start()) {
+    return;  // aborted while queued, never reaches the ioctl
+  }
+
+  job->executedNs = SPIStats::Now();
+  stats.queueWait.Record(job->executedNs - job->queuedNs);
+
+  if (!DropExpired(job, job->executedNs)) {
+    job->Execute(this);
+  }
+
+  job->executedNs = SPIStats::Now();
+}
+
+// Bulk jobs: once realtime jobs are in use on the device, the messages
+// are issued in segments that end where the caller releases CS
+// (cs_change), and waiting realtime jobs run between the segments.
+int SPIDevice::RunPreemptible(std::vector<spi_ioc_transfer>& transfers) {
+  if (!preempt || !realtimeUsed || transfers.size() < 2) {
+    return RunTransfers(transfers);
+  }
+
+  size_t begin = 0;
+
+  for (size_t i = 0; i < transfers.size(); i++) {
+    bool last = i + 1 == transfers.size();
+
+    if (!last && !transfers[i].cs_change) {
+      continue;
+    }
+
+    if (begin == 0 && last) {
+      return RunTransfers(transfers);  // CS is never released in between
+    }
 
-      transfers.push_back(tr);
-      txRefs.push_back(Napi::Persistent(txBuf));
-      rxRefs.push_back(Napi::Persistent(rxBuf));
+    segment.assign(transfers.begin() + begin, transfers.begin() + i + 1);
+
+    if (!last) {
+      // CS is released at the end of the ioctl
+      segment.back().cs_change = 0;
     }
-    catch (const Napi::Error& e) {
-      e.ThrowAsJavaScriptException();
-      return env.Null();
+
+    int err = RunTransfers(segment);
+
+    if (err != 0) {
+      return err;
+    }
+
+    begin = i + 1;
+
+    if (!last) {
+      YieldToRealtime();
     }
   }
 
-  auto* worker = new TransferWorker(env, this,
-    std::move(transfers),
-    std::move(txRefs),
-    std::move(rxRefs),
-    deferred);
-  worker->Queue();
+  return 0;
+}
 
-  return deferred.Promise();
+// Runs the waiting realtime jobs from inside a bulk job, at a point
+// where CS is released. No-op for realtime jobs and without waiters.
+// On a bus these are the realtime jobs of all its devices.
+void SPIDevice::YieldToRealtime() {
+  if (!preempt) {
+    return;
+  }
+
+  std::atomic<size_t>& waiting = bus ? bus->realtimeQueued : realtimeQueued;
+
+  if (waiting.load(std::memory_order_acquire) > 0) {
+    SPIStats::Add(stats.preemptions, 1);
+    preempt();
+  }
+}
+
+void SPIDevice::CompleteJob(Napi::Env env, Job* job) {
+  if (job->executedNs != 0) {
+    stats.completion.Record(SPIStats::Now() - job->executedNs);
+  }
+
+  job->Complete(env);
+  delete job;
+  pendingJobs--;
+  Unref();
+}
+
+void SPIDevice::Job::Complete(Napi::Env env) {
+  Unwatch();
+
+  if (Aborted()) {
+    return;  // rejected when it was aborted
+  }
+
+  if (!error.empty()) {
+    Napi::Error err = Napi::Error::New(env, error);
+
+    if (!code.empty()) {
+      err.Value().Set("code", Napi::String::New(env, code));
+    }
+
+    deferred.Reject(err.Value());
+    return;
+  }
+
+  deferred.Resolve(Result(env));
+}
+
+void SPIDevice::TransferJob::Execute(SPIDevice* device) {
+  if (batch.transfers.empty()) {
+    error = "No transfers specified";
+    return;
+  }
+
+  EncodeWords(batch);
+  SealCrcs(batch);
+
+  int err = Run(device, batch.transfers);
+
+  if (err != 0) {
+    SetTransferError(err);
+    return;
+  }
+
+  int bad = CheckCrcs(batch);
+
+  if (bad >= 0) {
+    SetCrcError(batch, bad);
+    return;
+  }
+
+  DecodeWords(batch);
+}
+
+void SPIDevice::Job::SetTransferError(int err) {
+  error = std::string("SPI transfer failed: ") + std::strerror(err);
+}
+
+void SPIDevice::Job::SetCrcError(const TransferBatch& batch, int index) {
+  error = CrcMismatch(batch, index);
+  code = CRC_MISMATCH;
+}
+
+int SPIDevice::Job::Run(SPIDevice* device, std::vector<spi_ioc_transfer>& transfers) {
+  return lane == LANE_BULK ? device->RunPreemptible(transfers) : device->RunTransfers(transfers);
+}
+
+Napi::Value SPIDevice::TransferJob::Result(Napi::Env env) {
+  return BatchResult(env, batch);
 }
 
 void SPIDevice::TransferWorker::Execute() {
+  // The bulk job of this worker was aborted and unlinked
+  if (device->RetireWorker(LANE_BULK)) {
+    return;
+  }
 
-  SPI_DEVICE_LOCK_GUARD;
+  std::unique_lock<std::mutex> lock(device->mutex);
 
-  if (transfers.empty()) {
-    SetError("No transfers specified");
+  // There is one worker per queued job, so there is always a job to
+  // pop here, unless a preempted bulk job holds back the bulk lane.
+  // Unlinked jobs retire workers that are already waiting.
+  device->turn.wait(lock, [this] {
+    return device->RetireWorker(LANE_REALTIME) || device->RetireWorker(LANE_BULK) ||
+      (job = device->PopQueued()) != nullptr;
+  });
+
+  if (job == nullptr) {
+    // A preempted bulk job may be waiting for the unlinked realtime job
+    device->turn.notify_all();
     return;
   }
 
-  if (ioctl(device->fd, SPI_IOC_MESSAGE(transfers.size()), transfers.data()) < 1) {
-    SetError(std::string("SPI transfer failed: ") + GetSystemError());
+  // Preempting a bulk job: let the other workers run the realtime jobs.
+  // Only realtime jobs run meanwhile, they leave preempt alone.
+  if (job->lane == LANE_BULK) {
+    device->preempt = [this, &lock] {
+      device->bulkSuspended = true;
+      device->turn.notify_all();
+      device->turn.wait(lock, [this] {
+        return device->realtimeQueued.load(std::memory_order_acquire) == 0;
+      });
+      device->bulkSuspended = false;
+    };
+  }
+
+  {
+    ExecutorScope scope(device, lock);
+    device->ExecuteJob(job);
+  }
+
+  if (job->lane == LANE_BULK) {
+    device->preempt = nullptr;
   }
+
+  device->turn.notify_all();
 }
 
 void SPIDevice::TransferWorker::OnOK() {
-  Napi::Env env = Env();
-  Napi::Array result = Napi::Array::New(env, rxRefs.size());
-
-  for (size_t i = 0; i < rxRefs.size(); i++) {
-    result.Set(i, rxRefs[i].Value());
+  if (job == nullptr) {
+    device->Unref();  // retired, see Unlink()
+    return;
   }
 
-  deferred.Resolve(result);
+  device->CompleteJob(Env(), job);
 }
 
 void SPIDevice::TransferWorker::OnError(const Napi::Error& e) {
-  deferred.Reject(e.Value());
+  if (job == nullptr) {
+    device->Unref();
+    return;
+  }
+
+  job->Reject(e.Value());
+  delete job;
+  device->pendingJobs--;
+  device->Unref();
 }